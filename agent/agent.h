@@ -64,6 +64,35 @@ enum daemon_type
    DAEMON_MAX_TYPE
   };
 
+/* The operations and phases for which latency histograms are kept.
+   When you add a new one, also add it to metric_names in metrics.c */
+enum agent_metric
+  {
+   METRIC_PKSIGN,
+   METRIC_PKDECRYPT,
+   METRIC_GET_PASSPHRASE,
+   METRIC_SSH_REQUEST_IDENTITIES,
+   METRIC_SSH_SIGN,
+   METRIC_SSH_OTHER,
+   METRIC_READ_KEY,
+   METRIC_UNPROTECT,
+   METRIC_SCD,
+   METRIC_PINENTRY,
+   METRIC_LAST
+  };
+
+/* The counters kept by metrics.c.  */
+enum agent_counter
+  {
+   COUNTER_CACHE_HIT,
+   COUNTER_CACHE_MISS,
+   COUNTER_KEYFILE_CACHE_HIT,
+   COUNTER_KEYFILE_CACHE_MISS,
+   COUNTER_KEK_CACHE_HIT,
+   COUNTER_KEK_CACHE_MISS,
+   COUNTER_LAST
+  };
+
 /* A large struct name "opt" to keep global flags */
 EXTERN_UNLESS_MAIN_MODULE
 struct
@@ -203,6 +232,12 @@ struct
   /* The value of the option --s2k-count.  If this option is not given
    * or 0 an auto-calibrated value is used.  */
   unsigned long s2k_count;
+
+  /* If set new keys are protected using Argon2id instead of the
+   * OpenPGP S2K.  The memory is given in KiB.  */
+  int s2k_argon2;
+  unsigned long s2k_argon2_memory;
+  unsigned long s2k_argon2_lanes;
 } opt;
 
 
@@ -410,6 +445,10 @@ void agent_set_progress_cb (void (*cb)(ctrl_t ctrl, const char *what,
                                        int printchar, int current, int total),
                             ctrl_t ctrl);
 gpg_error_t agent_copy_startup_env (ctrl_t ctrl);
+#if GCRYPT_VERSION_NUMBER >= 0x010a00
+gpg_error_t agent_kdf_compute (gcry_kdf_hd_t hd); /* Also implemented in
+                                                     other tools */
+#endif
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
 int get_agent_active_connection_count (void);
@@ -429,6 +468,7 @@ gpg_error_t agent_print_status (ctrl_t ctrl, const char *keyword,
      GPGRT_ATTR_PRINTF(3,4);
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
+void get_agent_eventcounters (unsigned int *r_key, unsigned int *r_card);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
 gpg_error_t pinentry_loopback (ctrl_t, const char *keyword,
                                unsigned char **buffer, size_t *size,
@@ -452,6 +492,7 @@ gpg_error_t ssh_search_control_file (ssh_control_file_t cf,
                                      const char *hexgrip,
                                      int *r_disabled,
                                      int *r_ttl, int *r_confirm);
+void ssh_flush_identity_cache (void);
 
 void start_command_handler_ssh_stream (ctrl_t ctrl, estream_t stream);
 void start_command_handler_ssh (ctrl_t, gnupg_fd_t);
@@ -483,6 +524,8 @@ gpg_error_t agent_ssh_key_from_file (ctrl_t ctrl,
 int agent_pk_get_algo (gcry_sexp_t s_key);
 int agent_is_tpm2_key(gcry_sexp_t s_key);
 int agent_key_available (const unsigned char *grip);
+gpg_error_t agent_list_keygrips (unsigned char **r_grips, size_t *r_ngrips);
+void agent_flush_key_file_cache (void);
 gpg_error_t agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
                                       int *r_keytype,
                                       unsigned char **r_shadow_info,
@@ -491,6 +534,9 @@ gpg_error_t agent_delete_key (ctrl_t ctrl, const char *desc_text,
                               const unsigned char *grip,
                               int force, int only_stubs);
 gpg_error_t agent_update_private_key (const unsigned char *grip, nvc_t pk);
+void agent_begin_key_writes (void);
+void agent_end_key_writes (void);
+void agent_sync_key_directory (void);
 
 /*-- call-pinentry.c --*/
 void initialize_module_call_pinentry (void);
@@ -525,6 +571,10 @@ int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
 void agent_store_cache_hit (const char *key);
+int agent_get_kek_cache (const unsigned char *tag,
+                         unsigned char *key, size_t keylen);
+void agent_put_kek_cache (const unsigned char *tag,
+                          const unsigned char *key, size_t keylen);
 
 
 /*-- pksign.c --*/
@@ -536,6 +586,11 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                const unsigned char *digests,
+                                unsigned int ndigests,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
@@ -559,6 +614,7 @@ gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
                                      char **passphrase_addr);
 
 /*-- protect.c --*/
+void enable_s2k_calibration_file (void);
 void set_s2k_calibration_time (unsigned int milliseconds);
 unsigned long get_calibrated_s2k_count (void);
 unsigned long get_standard_s2k_count (void);
@@ -741,6 +797,13 @@ gpg_error_t agent_card_keyinfo (ctrl_t ctrl, const char *keygrip,
 /*-- learncard.c --*/
 int agent_handle_learn (ctrl_t ctrl, int send, void *assuan_context, int force);
 
+/*-- metrics.c --*/
+uint64_t agent_metric_start (void);
+void agent_metric_stop (enum agent_metric metric, uint64_t start);
+void agent_count (enum agent_counter cnt);
+void agent_reset_metrics (void);
+void agent_format_metrics (membuf_t *mb);
+
 
 /*-- cvt-openpgp.c --*/
 gpg_error_t
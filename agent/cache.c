@@ -34,8 +34,9 @@
 /* The size of the encryption key in bytes.  */
 #define ENCRYPTION_KEYSIZE (128/8)
 
-/* A mutex used to serialize access to the cache.  */
-static npth_mutex_t cache_lock;
+/* A lock used to serialize access to the cache.  Lookups take only
+ * a read lock.  */
+static npth_rwlock_t cache_lock;
 /* The encryption context.  This is the only place where the
    encryption key for all cached entries is available.  It would be nice
    to keep this (or just the key) in some hardware device, for example
@@ -56,7 +57,11 @@ struct secret_data_s {
 /* The cache object.  */
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;        /* Next item in the hash bucket.  */
+  ITEM wnext;       /* Next item in the timer wheel slot.  */
+  ITEM *wprevp;     /* Pointer to the link to this item or NULL if
+                     * the item is not in the timer wheel.  */
+  time_t deadline;  /* The time this item is due in the timer wheel.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
@@ -66,12 +71,44 @@ struct cache_item_s {
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the key.  The
+ * cache mode and the restricted flag are not part of the hash because
+ * depending on the mode a lookup may match items of other modes.  */
+#define CACHE_HASH_SIZE 1024
+static ITEM thecache[CACHE_HASH_SIZE];
+
+/* The timer wheel used to expire items.  Each item with a deadline
+ * is linked into the slot DEADLINE % TIMER_WHEEL_SIZE.  Accessing an
+ * item does not move it; instead the deadline is recomputed when the
+ * slot is due.  WHEEL_TIME is the time up to which the wheel has been
+ * processed.  */
+#define TIMER_WHEEL_SIZE 512
+static ITEM timer_wheel[TIMER_WHEEL_SIZE];
+static time_t wheel_time;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
+/* The cache for derived key encryption keys.  Running the S2K
+ * function for a protected key takes about 100ms by design; with a
+ * cached passphrase this is done again for each operation.  We thus
+ * remember the KEK derived for a passphrase and S2K parameters and
+ * use the same TTL rules as for the passphrase cache.  The items are
+ * identified by a tag computed by protect.c.  */
+#define KEK_CACHE_SIZE 16
+
+struct kek_cache_item_s
+{
+  int used;
+  time_t created;
+  time_t accessed;
+  unsigned char tag[32];
+  size_t keylen;
+  unsigned char key[32];
+};
+static struct kek_cache_item_s *kek_cache;  /* In secure memory.  */
+static npth_mutex_t kek_cache_lock = NPTH_MUTEX_INITIALIZER;
+
 
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
@@ -80,7 +117,7 @@ initialize_module_cache (void)
 {
   int err;
 
-  err = npth_mutex_init (&cache_lock, NULL);
+  err = npth_rwlock_init (&cache_lock, NULL);
 
   if (err)
     log_fatal ("error initializing cache module: %s\n", strerror (err));
@@ -194,99 +231,274 @@ new_data (const char *string, struct secret_data_s **r_data)
 
 
 
-/* Check whether there are items to expire.  */
-static void
-housekeeping (void)
+/* Return the hash bucket for KEY.  */
+static unsigned int
+hash_key (const char *key)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  unsigned int h = 5381;
+
+  for (; *key; key++)
+    h = (h << 5) + h + *(const unsigned char *)key;
+  return h % CACHE_HASH_SIZE;
+}
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+
+/* Return the maximum lifetime for the item R or NO_MAX_TTL if there
+ * is none.  We don't do this for data items which are used to storage
+ * secrets in meory and are not user entered passphrases etc.  Note
+ * that a configured maximum of 0 expires the item after a second.  */
+#define NO_MAX_TTL ((unsigned long)(-1))
+
+static unsigned long
+item_maxttl (ITEM r)
+{
+  switch (r->cache_mode)
     {
-      if (r->cache_mode == CACHE_MODE_PIN)
-        ; /* Don't let it expire - scdaemon explicitly flushes them.  */
-      else if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s'.%d (%ds after last access)\n",
-                       r->key, r->restricted, r->ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+    case CACHE_MODE_DATA:
+    case CACHE_MODE_PIN:
+      return NO_MAX_TTL;
+    case CACHE_MODE_SSH: return opt.max_cache_ttl_ssh;
+    default: return opt.max_cache_ttl;
     }
+}
 
-  /* Second, make sure that we also remove them based on the created
-   * stamp so that the user has to enter it from time to time.  We
-   * don't do this for data items which are used to storage secrets in
-   * meory and are not user entered passphrases etc.  */
-  for (r=thecache; r; r = r->next)
+
+/* Return the time at which the item R needs to be looked at by the
+ * housekeeping or 0 if never.  For an item with data this is the
+ * time its data expires; for an empty item this is the time the item
+ * will be removed.  */
+static time_t
+item_deadline (ITEM r)
+{
+  time_t deadline = 0;
+  unsigned long maxttl;
+
+  if (r->pw)
+    {
+      /* PIN items don't expire - scdaemon explicitly flushes them.  */
+      if (r->cache_mode != CACHE_MODE_PIN && r->ttl >= 0)
+        deadline = r->accessed + r->ttl + 1;
+      /* Make sure that we also remove them based on the created stamp
+       * so that the user has to enter it from time to time.  */
+      if ((maxttl = item_maxttl (r)) != NO_MAX_TTL
+          && (!deadline || r->created + maxttl + 1 < deadline))
+        deadline = r->created + maxttl + 1;
+    }
+  else if (r->ttl >= 0)
     {
-      unsigned long maxttl;
+      /* Make sure that we don't have too many items in the cache.
+       * Expire old and unused entries after 30 minutes.  */
+      deadline = r->accessed + 60*30 + 1;
+    }
 
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_DATA:
-        case CACHE_MODE_PIN:
-          continue;  /* No MAX TTL here.  */
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (r->pw && r->created + maxttl < current)
+  return deadline;
+}
+
+
+/* Return true if the data of R has expired.  This is used on the read
+ * path so that items not yet handled by the housekeeping won't be
+ * returned.  */
+static int
+item_expired (ITEM r, time_t current)
+{
+  time_t deadline;
+
+  if (!r->pw)
+    return 1;
+  deadline = item_deadline (r);
+  return deadline && deadline <= current;
+}
+
+
+/* Remove R from the timer wheel.  */
+static void
+wheel_unlink (ITEM r)
+{
+  if (!r->wprevp)
+    return;
+  *r->wprevp = r->wnext;
+  if (r->wnext)
+    r->wnext->wprevp = r->wprevp;
+  r->wnext = NULL;
+  r->wprevp = NULL;
+}
+
+
+/* (Re-)insert R into the timer wheel according to its deadline.  */
+static void
+wheel_schedule (ITEM r)
+{
+  ITEM *slot;
+  time_t due;
+
+  wheel_unlink (r);
+  r->deadline = item_deadline (r);
+  if (!r->deadline)
+    return;
+
+  if (!wheel_time)
+    wheel_time = gnupg_get_time ();
+  /* Items which are already due are processed with the next tick.  */
+  due = r->deadline > wheel_time? r->deadline : wheel_time + 1;
+  slot = timer_wheel + (due % TIMER_WHEEL_SIZE);
+  r->wnext = *slot;
+  if (r->wnext)
+    r->wnext->wprevp = &r->wnext;
+  r->wprevp = slot;
+  *slot = r;
+}
+
+
+/* Remove the item R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+
+  wheel_unlink (r);
+  for (rp = thecache + hash_key (r->key); *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  release_data (r->pw);
+  xfree (r);
+}
+
+
+/* Handle the item R from a due timer wheel slot.  */
+static void
+expire_item (ITEM r, time_t current)
+{
+  r->deadline = item_deadline (r);
+  if (r->deadline && r->deadline <= current)
+    {
+      if (r->pw)
         {
           if (DBG_CACHE)
-            log_debug ("  expired '%s'.%d (%lus after creation)\n",
-                       r->key, r->restricted, opt.max_cache_ttl);
+            {
+              if (r->cache_mode != CACHE_MODE_PIN && r->ttl >= 0
+                  && r->accessed + r->ttl < current)
+                log_debug ("  expired '%s'.%d (%ds after last access)\n",
+                           r->key, r->restricted, r->ttl);
+              else
+                log_debug ("  expired '%s'.%d (%lus after creation)\n",
+                           r->key, r->restricted, item_maxttl (r));
+            }
           release_data (r->pw);
           r->pw = NULL;
           r->accessed = current;
         }
-    }
-
-  /* Third, make sure that we don't have too many items in the list.
-   * Expire old and unused entries after 30 minutes.  */
-  for (rprev=NULL, r=thecache; r; )
-    {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      else
         {
-          ITEM r2 = r->next;
           if (DBG_CACHE)
             log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
                        r->key, r->restricted, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
+          remove_item (r);
+          return;
         }
-      else
+    }
+  wheel_schedule (r);
+}
+
+
+/* Check whether there are items to expire.  Only the slots of the
+ * timer wheel which became due since the last call are looked at.  */
+static void
+housekeeping (void)
+{
+  time_t current = gnupg_get_time ();
+  time_t t;
+  ITEM r, rnext, list;
+
+  if (!wheel_time || current <= wheel_time)
+    return;
+
+  /* If we have not been called for a full round of the wheel we
+   * need to process all slots once.  */
+  if (current - wheel_time >= TIMER_WHEEL_SIZE)
+    t = current - TIMER_WHEEL_SIZE + 1;
+  else
+    t = wheel_time + 1;
+  wheel_time = current;
+  for (; t <= current; t++)
+    {
+      /* Detach the slot first because the items will be scheduled
+       * again and may end up in the same slot.  */
+      list = timer_wheel[t % TIMER_WHEEL_SIZE];
+      timer_wheel[t % TIMER_WHEEL_SIZE] = NULL;
+      if (list)
+        list->wprevp = &list;
+      for (r = list; r; r = rnext)
         {
-          rprev = r;
-          r = r->next;
+          rnext = r->wnext;
+          r->wprevp = NULL;
+          r->wnext = NULL;
+          if (rnext)
+            rnext->wprevp = &list;
+          list = rnext;
+          expire_item (r, current);
         }
     }
 }
 
 
+static void
+lock_cache (int write)
+{
+  int res = write? npth_rwlock_wrlock (&cache_lock)
+    /**/         : npth_rwlock_rdlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache lock: %s\n", strerror (res));
+}
+
+
+static void
+unlock_cache (void)
+{
+  int res = npth_rwlock_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache lock: %s\n", strerror (res));
+}
+
+
 void
 agent_cache_housekeeping (void)
 {
-  int res;
-
   if (DBG_CACHE)
     log_debug ("agent_cache_housekeeping\n");
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
-
+  lock_cache (1);
   housekeeping ();
+  unlock_cache ();
+}
+
 
-  res = npth_mutex_unlock (&cache_lock);
+static void
+lock_kek_cache (void)
+{
+  int res = npth_mutex_lock (&kek_cache_lock);
   if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+    log_fatal ("failed to acquire KEK cache mutex: %s\n", strerror (res));
+}
+
+static void
+unlock_kek_cache (void)
+{
+  int res = npth_mutex_unlock (&kek_cache_lock);
+  if (res)
+    log_fatal ("failed to release KEK cache mutex: %s\n", strerror (res));
+}
+
+
+static void
+flush_kek_cache (void)
+{
+  lock_kek_cache ();
+  if (kek_cache)
+    wipememory (kek_cache, KEK_CACHE_SIZE * sizeof *kek_cache);
+  unlock_kek_cache ();
 }
 
 
@@ -294,32 +506,33 @@ void
 agent_flush_cache (int pincache_only)
 {
   ITEM r;
-  int res;
+  int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
-
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-    }
-
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  lock_cache (1);
+
+  for (i=0; i < CACHE_HASH_SIZE; i++)
+    for (r=thecache[i]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_data (r->pw);
+            r->pw = NULL;
+            r->accessed = 0;
+            wheel_schedule (r);
+          }
+      }
+
+  unlock_cache ();
+
+  if (!pincache_only)
+    flush_kek_cache ();
 }
 
 
@@ -348,12 +561,10 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
 {
   gpg_error_t err = 0;
   ITEM r;
-  int res;
+  unsigned int bucket;
   int restricted = ctrl? ctrl->restricted : -1;
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+  lock_cache (1);
 
   if (DBG_CACHE)
     log_debug ("agent_put_cache '%s'.%d (mode %d) requested ttl=%d\n",
@@ -373,7 +584,8 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  bucket = hash_key (key);
+  for (r=thecache[bucket]; r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN && data)
         {
@@ -411,6 +623,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      wheel_schedule (r);
     }
   else if (data) /* Insert.  */
     {
@@ -429,8 +642,9 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              r->next = thecache[bucket];
+              thecache[bucket] = r;
+              wheel_schedule (r);
             }
         }
       if (err)
@@ -438,33 +652,30 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
     }
 
  out:
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  unlock_cache ();
 
   return err;
 }
 
 
 /* Try to find an item in the cache.  Returns NULL if not found or an
- * malloced string with the value.  */
+ * malloced string with the value.  Only a read lock is taken; expired
+ * items are skipped but their removal is left to the housekeeping.  */
 char *
 agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
 {
   gpg_error_t err;
   ITEM r;
   char *value = NULL;
-  int res;
   int last_stored = 0;
   int restricted = ctrl? ctrl->restricted : -1;
   int yes;
+  time_t current;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+  lock_cache (0);
 
   if (!key)
     {
@@ -478,16 +689,17 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
     log_debug ("agent_get_cache '%s'.%d (mode %d)%s ...\n",
                key, restricted, cache_mode,
                last_stored? " (stored cache key)":"");
-  housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  current = gnupg_get_time ();
+  for (r=thecache[hash_key (key)]; r; r = r->next)
     {
-      if (cache_mode == CACHE_MODE_PIN)
-        yes = (r->pw && !strcmp (r->key, key));
-      else if (r->pw
-               && ((cache_mode != CACHE_MODE_USER
-                    && cache_mode != CACHE_MODE_NONCE)
-                   || cache_mode_equal (r->cache_mode, cache_mode))
+      if (item_expired (r, current))
+        yes = 0;
+      else if (cache_mode == CACHE_MODE_PIN)
+        yes = !strcmp (r->key, key);
+      else if (((cache_mode != CACHE_MODE_USER
+                 && cache_mode != CACHE_MODE_NONCE)
+                || cache_mode_equal (r->cache_mode, cache_mode))
                && r->restricted == restricted
                && !strcmp (r->key, key))
         yes = 1;
@@ -498,9 +710,12 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
         {
           /* Note: To avoid races KEY may not be accessed anymore
            * below.  Note also that we don't update the accessed time
-           * for data items.  */
+           * for data items.  Updating the time under the read lock is
+           * fine because this is not a yielding operation.  The timer
+           * wheel is not touched; the deadline is recomputed when the
+           * old one is due.  */
           if (r->cache_mode != CACHE_MODE_DATA)
-            r->accessed = gnupg_get_time ();
+            r->accessed = current;
           if (DBG_CACHE)
             log_debug ("... hit\n");
           if (r->pw->totallen < 32)
@@ -529,10 +744,9 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
     log_debug ("... miss\n");
 
  out:
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  unlock_cache ();
 
+  agent_count (value? COUNTER_CACHE_HIT : COUNTER_CACHE_MISS);
   return value;
 }
 
@@ -569,3 +783,93 @@ agent_store_cache_hit (const char *key)
 
   xfree (old);
 }
+
+
+/* Look up the KEK identified by the 32 byte TAG and store it at KEY.
+ * Returns true on a cache hit.  */
+int
+agent_get_kek_cache (const unsigned char *tag,
+                     unsigned char *key, size_t keylen)
+{
+  struct kek_cache_item_s *item;
+  time_t now;
+  int i;
+  int hit = 0;
+
+  if (keylen > sizeof kek_cache->key
+      || !opt.def_cache_ttl || !opt.max_cache_ttl)
+    return 0;
+
+  lock_kek_cache ();
+  if (!kek_cache)
+    goto leave;
+
+  now = gnupg_get_time ();
+  for (i=0; i < KEK_CACHE_SIZE; i++)
+    {
+      item = kek_cache + i;
+      if (item->used
+          && (item->accessed + opt.def_cache_ttl < now
+              || item->created + opt.max_cache_ttl < now))
+        wipememory (item, sizeof *item);  /* Expired.  */
+
+      if (item->used && item->keylen == keylen
+          && !memcmp (item->tag, tag, sizeof item->tag))
+        {
+          if (DBG_CACHE)
+            log_debug ("KEK cache hit\n");
+          memcpy (key, item->key, keylen);
+          item->accessed = now;
+          hit = 1;
+          break;
+        }
+    }
+
+ leave:
+  unlock_kek_cache ();
+  agent_count (hit? COUNTER_KEK_CACHE_HIT : COUNTER_KEK_CACHE_MISS);
+  return hit;
+}
+
+
+/* Store the KEY identified by the 32 byte TAG in the KEK cache.  */
+void
+agent_put_kek_cache (const unsigned char *tag,
+                     const unsigned char *key, size_t keylen)
+{
+  struct kek_cache_item_s *item, *victim;
+  time_t now;
+  int i;
+
+  if (keylen > sizeof kek_cache->key
+      || !opt.def_cache_ttl || !opt.max_cache_ttl)
+    return;
+
+  lock_kek_cache ();
+  if (!kek_cache)
+    {
+      kek_cache = gcry_calloc_secure (KEK_CACHE_SIZE, sizeof *kek_cache);
+      if (!kek_cache)
+        goto leave;
+    }
+
+  now = gnupg_get_time ();
+  victim = NULL;
+  for (i=0; i < KEK_CACHE_SIZE; i++)
+    {
+      item = kek_cache + i;
+      if (!victim || !item->used
+          || (victim->used && item->accessed < victim->accessed))
+        victim = item;
+      if (!item->used)
+        break;
+    }
+  victim->used = 1;
+  victim->created = victim->accessed = now;
+  memcpy (victim->tag, tag, sizeof victim->tag);
+  victim->keylen = keylen;
+  memcpy (victim->key, key, keylen);
+
+ leave:
+  unlock_kek_cache ();
+}
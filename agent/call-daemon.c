@@ -63,6 +63,7 @@ struct daemon_local_s
                              used with this connection. */
   unsigned int in_use: 1; /* CTX is in use.  */
   unsigned int invalid:1; /* CTX is invalid, should be released.  */
+  uint64_t started;       /* Time daemon_start was called or 0.  */
 };
 
 
@@ -220,6 +221,9 @@ daemon_unlock (enum daemon_type type, ctrl_t ctrl, gpg_error_t rc)
       return gpg_error (GPG_ERR_INTERNAL);
     }
   ctrl->d_local[type]->in_use = 0;
+  if (type == DAEMON_SCD)
+    agent_metric_stop (METRIC_SCD, ctrl->d_local[type]->started);
+  ctrl->d_local[type]->started = 0;
   if (ctrl->d_local[type]->invalid)
     {
       assuan_release (ctrl->d_local[type]->ctx);
@@ -266,6 +270,7 @@ daemon_start (enum daemon_type type, ctrl_t ctrl)
   int rc;
   char *abs_homedir = NULL;
   struct daemon_global_s *g = &daemon_global[type];
+  uint64_t started = agent_metric_start ();
   const char *name = gnupg_module_name (daemon_modules[type]);
 
   log_assert (type < DAEMON_MAX_TYPE);
@@ -278,6 +283,7 @@ daemon_start (enum daemon_type type, ctrl_t ctrl)
   if (ctrl->d_local[type] && ctrl->d_local[type]->ctx)
     {
       ctrl->d_local[type]->in_use = 1;
+      ctrl->d_local[type]->started = started;
       return 0; /* Okay, the context is fine.  */
     }
 
@@ -526,6 +532,7 @@ daemon_start (enum daemon_type type, ctrl_t ctrl)
     {
       ctrl->d_local[type]->ctx = ctx;
       ctrl->d_local[type]->invalid = 0;
+      ctrl->d_local[type]->started = started;
     }
   return err;
 }
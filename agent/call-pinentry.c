@@ -79,6 +79,9 @@ static struct
 /* A mutex used to serialize access to the pinentry. */
 static npth_mutex_t entry_lock;
 
+/* The time ENTRY_LOCK was taken; used for the metrics.  */
+static uint64_t entry_lock_taken;
+
 /* The thread ID of the popup working thread. */
 static npth_t  popup_tid;
 
@@ -189,6 +192,8 @@ unlock_pinentry (ctrl_t ctrl, gpg_error_t rc)
   if (--ctrl->pinentry_active == 0)
     {
       entry_ctx = NULL;
+      agent_metric_stop (METRIC_PINENTRY, entry_lock_taken);
+      entry_lock_taken = 0;
       err = npth_mutex_unlock (&entry_lock);
       if (err)
         {
@@ -341,6 +346,7 @@ start_pinentry (ctrl_t ctrl)
                  gpg_strerror (rc));
       return rc;
     }
+  entry_lock_taken = agent_metric_start ();
 
   if (entry_ctx)
     return 0;
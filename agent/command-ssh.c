@@ -1088,6 +1088,196 @@ search_control_file (ssh_control_file_t cf, const char *hexgrip,
 }
 
 
+/* An index of the sshcontrol file.  Each sign request needs the TTL
+ * and the confirm flag of the key and the list of identities needs
+ * to look up each key file; without the index this would require to
+ * read and parse the entire file for each lookup.  The index is
+ * rebuilt if the file's inode, size or mtime changed.  */
+struct control_index_item_s
+{
+  char hexgrip[40+1];
+  int disabled;
+  int ttl;
+  int confirm;
+  int lnr;
+};
+
+static struct
+{
+  int valid;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  struct control_index_item_s *items;  /* Sorted by HEXGRIP.  */
+  size_t nitems;
+} control_index;
+
+
+/* Helper for qsort and bsearch.  */
+static int
+cmp_control_index_items (const void *a_arg, const void *b_arg)
+{
+  const struct control_index_item_s *a = a_arg;
+  const struct control_index_item_s *b = b_arg;
+  int res;
+
+  res = strcmp (a->hexgrip, b->hexgrip);
+  if (!res)
+    res = a->lnr - b->lnr;
+  return res;
+}
+
+
+/* Make sure that the index of the control file is up to date.
+ * Returns false if the index can't be used; the caller should then
+ * search the control file directly.  */
+static int
+update_control_index (void)
+{
+  gpg_error_t err;
+  char *fname;
+  struct stat st;
+  ssh_control_file_t cf;
+  struct control_index_item_s *items = NULL;
+  size_t nitems = 0;
+  size_t allocated = 0;
+
+  fname = make_filename_try (gnupg_homedir (), SSH_CONTROL_FILE_NAME, NULL);
+  if (!fname)
+    return 0;
+  if (gnupg_stat (fname, &st))
+    {
+      /* Let open_control_file create the file.  */
+      xfree (fname);
+      return 0;
+    }
+  xfree (fname);
+
+  if (control_index.valid
+      && control_index.ino == st.st_ino
+      && control_index.size == st.st_size
+      && control_index.mtime == st.st_mtime)
+    return 1;
+
+  if (open_control_file (&cf, 0))
+    return 0;
+  while (!(err = read_control_file_item (cf)))
+    {
+      if (!cf->item.valid)
+        continue; /* Should not happen.  */
+      if (nitems == allocated)
+        {
+          struct control_index_item_s *newitems;
+
+          allocated += 64;
+          newitems = xtryreallocarray (items, nitems, allocated,
+                                       sizeof *items);
+          if (!newitems)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          items = newitems;
+        }
+      strcpy (items[nitems].hexgrip, cf->item.hexgrip);
+      items[nitems].disabled = cf->item.disabled;
+      items[nitems].ttl = cf->item.ttl;
+      items[nitems].confirm = cf->item.confirm;
+      items[nitems].lnr = cf->lnr;
+      nitems++;
+    }
+  close_control_file (cf);
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      /* Let search_control_file handle and report the error.  */
+      xfree (items);
+      return 0;
+    }
+
+  /* Sort by keygrip and line number so that a lookup finds the first
+   * entry for a keygrip like search_control_file does.  */
+  qsort (items, nitems, sizeof *items, cmp_control_index_items);
+
+  /* Note that reading the file might have switched threads; thus we
+   * replace the index only now and without yielding.  */
+  xfree (control_index.items);
+  control_index.items = items;
+  control_index.nitems = nitems;
+  control_index.ino = st.st_ino;
+  control_index.size = st.st_size;
+  control_index.mtime = st.st_mtime;
+  control_index.valid = 1;
+  return 1;
+}
+
+
+/* Same as search_control_file but use the index if possible.  If CF
+ * is NULL and the index can't be used the control file is opened.  */
+static gpg_error_t
+lookup_control_file (ssh_control_file_t cf, const char *hexgrip,
+                     int *r_disabled, int *r_ttl, int *r_confirm, int *r_lnr)
+{
+  gpg_error_t err;
+  size_t lo, hi, mid;
+  struct control_index_item_s *item;
+  int cmp;
+
+  if (!update_control_index ())
+    {
+      if (cf)
+        return search_control_file (cf, hexgrip, r_disabled, r_ttl,
+                                    r_confirm, r_lnr);
+      err = open_control_file (&cf, 0);
+      if (!err)
+        {
+          err = search_control_file (cf, hexgrip, r_disabled, r_ttl,
+                                     r_confirm, r_lnr);
+          close_control_file (cf);
+        }
+      return err;
+    }
+
+  if (r_disabled)
+    *r_disabled = 0;
+  if (r_ttl)
+    *r_ttl = 0;
+  if (r_confirm)
+    *r_confirm = 0;
+  if (r_lnr)
+    *r_lnr = -1;
+
+  /* Find the first item for HEXGRIP.  */
+  item = NULL;
+  lo = 0;
+  hi = control_index.nitems;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      cmp = strcmp (control_index.items[mid].hexgrip, hexgrip);
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        {
+          if (!cmp)
+            item = control_index.items + mid;
+          hi = mid;
+        }
+    }
+  if (!item)
+    return gpg_error (GPG_ERR_EOF);
+
+  if (r_disabled)
+    *r_disabled = item->disabled;
+  if (r_ttl)
+    *r_ttl = item->ttl;
+  if (r_confirm)
+    *r_confirm = item->confirm;
+  if (r_lnr)
+    *r_lnr = item->lnr;
+  return 0;
+}
+
+
 
 /* Add an entry to the control file to mark the key with the keygrip
    HEXGRIP as usable for SSH; i.e. it will be returned when ssh asks
@@ -1153,20 +1343,15 @@ add_control_entry (ctrl_t ctrl, ssh_key_type_spec_t *spec,
 static int
 ttl_from_sshcontrol (const char *hexgrip)
 {
-  ssh_control_file_t cf;
   int disabled, ttl;
 
   if (!hexgrip || strlen (hexgrip) != 40)
     return 0;  /* Wrong input: Use global default.  */
 
-  if (open_control_file (&cf, 0))
-    return 0; /* Error: Use the global default TTL.  */
-
-  if (search_control_file (cf, hexgrip, &disabled, &ttl, NULL, NULL)
+  if (lookup_control_file (NULL, hexgrip, &disabled, &ttl, NULL, NULL)
       || disabled)
-    ttl = 0;  /* Use the global default if not found or disabled.  */
-
-  close_control_file (cf);
+    ttl = 0;  /* Use the global default if not found, disabled or on
+                 error.  */
 
   return ttl;
 }
@@ -1176,22 +1361,20 @@ ttl_from_sshcontrol (const char *hexgrip)
 static int
 confirm_flag_from_sshcontrol (const char *hexgrip)
 {
-  ssh_control_file_t cf;
+  gpg_error_t err;
   int disabled, confirm;
 
   if (!hexgrip || strlen (hexgrip) != 40)
     return 1;  /* Wrong input: Better ask for confirmation.  */
 
-  if (open_control_file (&cf, 0))
+  err = lookup_control_file (NULL, hexgrip, &disabled, NULL, &confirm, NULL);
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
     return 1; /* Error: Better ask for confirmation.  */
 
-  if (search_control_file (cf, hexgrip, &disabled, NULL, &confirm, NULL)
-      || disabled)
+  if (err || disabled)
     confirm = 0;  /* If not found or disabled, there is no reason to
                      ask for confirmation.  */
 
-  close_control_file (cf);
-
   return confirm;
 }
 
@@ -1271,7 +1454,7 @@ ssh_search_control_file (ssh_control_file_t cf,
   if (i != 40)
     err = gpg_error (GPG_ERR_INV_LENGTH);
   else
-    err = search_control_file (cf, uphexgrip, r_disabled, r_ttl, r_confirm,
+    err = lookup_control_file (cf, uphexgrip, r_disabled, r_ttl, r_confirm,
                                NULL);
   if (gpg_err_code (err) == GPG_ERR_EOF)
     err = gpg_error (GPG_ERR_NOT_FOUND);
@@ -2635,7 +2818,7 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
 
       /* Check if it's listed in "ssh_control" file.  */
       disabled = is_ssh = 0;
-      err = search_control_file (cf, hexgrip, &disabled, NULL, NULL, &lnr);
+      err = lookup_control_file (cf, hexgrip, &disabled, NULL, NULL, &lnr);
       if (!err)
         {
           if (!disabled)
@@ -2764,6 +2947,108 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
 }
 
 
+/* The answer to REQUEST_IDENTITIES requires to scan all key files,
+ * to parse the sshcontrol file and to ask the cards.  Because SSH
+ * clients send this request for each connection we cache the
+ * serialized list of identities.  The cache is valid as long as the
+ * sshcontrol file and the private key directory have not been
+ * modified, no key has been added, changed or removed by us and no
+ * card event has been seen.  Card events are only reported by a running
+ * scdaemon and thus the cache is not used without it.  */
+struct identity_cache_stamp_s
+{
+  unsigned int key_events;
+  unsigned int card_events;
+  int have_cf;
+  ino_t cf_ino;
+  off_t cf_size;
+  time_t cf_mtime;
+  ino_t dir_ino;
+  time_t dir_mtime;
+};
+
+static struct
+{
+  int valid;
+  struct identity_cache_stamp_s stamp;
+  u32 count;
+  unsigned char *blobs;
+  size_t blobslen;
+} identity_cache;
+
+
+/* Fill STAMP with the current state of the sources for the list of
+ * identities.  */
+static void
+get_identity_cache_stamp (struct identity_cache_stamp_s *stamp)
+{
+  char *fname;
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  get_agent_eventcounters (&stamp->key_events, &stamp->card_events);
+
+  fname = make_filename_try (gnupg_homedir (), SSH_CONTROL_FILE_NAME, NULL);
+  if (fname && !gnupg_stat (fname, &st))
+    {
+      stamp->have_cf = 1;
+      stamp->cf_ino = st.st_ino;
+      stamp->cf_size = st.st_size;
+      stamp->cf_mtime = st.st_mtime;
+    }
+  xfree (fname);
+
+  fname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (fname && !gnupg_stat (fname, &st))
+    {
+      stamp->dir_ino = st.st_ino;
+      stamp->dir_mtime = st.st_mtime;
+    }
+  xfree (fname);
+}
+
+
+/* Return true if the cached list of identities may be used for the
+ * state described by STAMP.  */
+static int
+identity_cache_is_valid (const struct identity_cache_stamp_s *stamp)
+{
+  if (!identity_cache.valid
+      || memcmp (&identity_cache.stamp, stamp, sizeof *stamp))
+    return 0;
+  if (!opt.disable_daemon[DAEMON_SCD]
+      && !agent_daemon_check_running (DAEMON_SCD))
+    return 0;
+  return 1;
+}
+
+
+/* Store COUNT identities with the serialized public keys BLOBS of
+ * length BLOBSLEN for the state described by STAMP.  BLOBS is taken
+ * over.  */
+static void
+identity_cache_put (const struct identity_cache_stamp_s *stamp,
+                    u32 count, unsigned char *blobs, size_t blobslen)
+{
+  xfree (identity_cache.blobs);
+  identity_cache.stamp = *stamp;
+  identity_cache.count = count;
+  identity_cache.blobs = blobs;
+  identity_cache.blobslen = blobslen;
+  identity_cache.valid = 1;
+}
+
+
+/* Flush the cached list of identities and the index of the control
+ * file.  */
+void
+ssh_flush_identity_cache (void)
+{
+  identity_cache.valid = 0;
+  control_index.valid = 0;
+}
+
+
 /*
 
   Request handler.  Each handler is provided with a CTRL context, a
@@ -2779,13 +3064,44 @@ ssh_handler_request_identities (ctrl_t ctrl,
                                 estream_t request, estream_t response)
 {
   u32 key_counter;
-  estream_t key_blobs;
+  estream_t key_blobs = NULL;
+  struct identity_cache_stamp_s stamp;
+  unsigned char *blobs = NULL;
+  size_t blobslen = 0;
   gpg_error_t err;
-  int ret;
   gpg_error_t ret_err;
 
   (void)request;
 
+  /* Note that the stamp needs to be taken before the keys are
+   * collected so that changes done meanwhile invalidate the cache.  */
+  get_identity_cache_stamp (&stamp);
+  if (identity_cache_is_valid (&stamp))
+    {
+      if (DBG_CACHE)
+        log_debug ("ssh request identities: using cached list\n");
+      /* Take a copy because writing to the stream may yield and
+       * another connection may then replace the cached list.  */
+      key_counter = identity_cache.count;
+      blobslen = identity_cache.blobslen;
+      blobs = xtrymalloc (blobslen? blobslen : 1);
+      if (!blobs)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("ssh request identities failed: %s\n",
+                     gpg_strerror (err));
+          return stream_write_byte (response, SSH_RESPONSE_FAILURE);
+        }
+      memcpy (blobs, identity_cache.blobs, blobslen);
+      ret_err = stream_write_byte (response, SSH_RESPONSE_IDENTITIES_ANSWER);
+      if (!ret_err)
+        ret_err = stream_write_uint32 (response, key_counter);
+      if (!ret_err)
+        ret_err = stream_write_data (response, blobs, blobslen);
+      xfree (blobs);
+      return ret_err;
+    }
+
   /* Prepare buffer stream.  */
 
   key_counter = 0;
@@ -2798,12 +3114,10 @@ ssh_handler_request_identities (ctrl_t ctrl,
     }
 
   err = ssh_send_available_keys (ctrl, key_blobs, &key_counter);
-  if (!err)
-    {
-      ret = es_fseek (key_blobs, 0, SEEK_SET);
-      if (ret)
-        err = gpg_error_from_syserror ();
-    }
+  if (!err && es_fclose_snatch (key_blobs, (void **)&blobs, &blobslen))
+    err = gpg_error_from_syserror ();
+  else if (!err)
+    key_blobs = NULL;
 
  out:
   /* Send response.  */
@@ -2814,7 +3128,8 @@ ssh_handler_request_identities (ctrl_t ctrl,
       if (!ret_err)
         ret_err = stream_write_uint32 (response, key_counter);
       if (!ret_err)
-        ret_err = stream_copy (response, key_blobs);
+        ret_err = stream_write_data (response, blobs, blobslen);
+      identity_cache_put (&stamp, key_counter, blobs, blobslen);
     }
   else
     {
@@ -3655,6 +3970,18 @@ request_spec_lookup (int type)
   return spec;
 }
 
+/* Return the metric used to record the latency of requests of SPEC.  */
+static enum agent_metric
+request_spec_metric (const ssh_request_spec_t *spec)
+{
+  switch (spec->type)
+    {
+    case SSH_REQUEST_REQUEST_IDENTITIES: return METRIC_SSH_REQUEST_IDENTITIES;
+    case SSH_REQUEST_SIGN_REQUEST:       return METRIC_SSH_SIGN;
+    default:                             return METRIC_SSH_OTHER;
+    }
+}
+
 /* Process a single request.  The request is read from and the
    response is written to STREAM_SOCK.  Uses CTRL as context.  Returns
    zero in case of success, non zero in case of failure.  */
@@ -3671,6 +3998,7 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
   unsigned char *request_data = NULL;
   u32 request_data_size;
   u32 response_size;
+  uint64_t started;
 
   /* Create memory streams for request/response data.  The entire
      request will be stored in secure memory, since it might contain
@@ -3740,7 +4068,9 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
     log_info ("ssh request handler for %s (%u) started\n",
 	       spec->identifier, spec->type);
 
+  started = agent_metric_start ();
   err = (*spec->handler) (ctrl, request, response);
+  agent_metric_stop (request_spec_metric (spec), started);
 
   if (opt.verbose)
     {
@@ -3973,6 +4303,7 @@ serve_mmapped_ssh_request (ctrl_t ctrl,
   const ssh_request_spec_t *spec;
   u32 msglen;
   estream_t request_stream, response_stream;
+  uint64_t started;
 
   if (agent_copy_startup_env (ctrl))
     goto leave; /* Error setting up the environment.  */
@@ -4028,7 +4359,9 @@ serve_mmapped_ssh_request (ctrl_t ctrl,
     log_info ("ssh request handler for %s (%u) started\n",
 	       spec->identifier, spec->type);
 
+  started = agent_metric_start ();
   err = (*spec->handler) (ctrl, request_stream, response_stream);
+  agent_metric_stop (request_spec_metric (spec), started);
 
   if (opt.verbose)
     {
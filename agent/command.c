@@ -51,6 +51,8 @@
 #define MAXLEN_KEYDATA 8192
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
+/* Maximum number of digests to sign with one PKSIGN --multi.  */
+#define PKSIGN_MULTI_MAX 4096
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -101,6 +103,9 @@ struct server_local_s
   /* Malloced KEK (Key-Encryption-Key) for the import_key command.  */
   void *import_key;
 
+  /* Set if the key writes of this connection are batched.  */
+  int key_write_batch;
+
   /* Malloced KEK for the export_key command.  */
   void *export_key;
 
@@ -526,6 +531,18 @@ bump_card_eventcounter (void)
 }
 
 
+/* Store the current values of the key and card related event
+   counters at R_KEY and R_CARD.  R_CARD also changes with possible
+   changes to keys on a card.  This function is assured not to do any
+   context switches. */
+void
+get_agent_eventcounters (unsigned int *r_key, unsigned int *r_card)
+{
+  *r_key = eventcounter.key;
+  *r_card = eventcounter.card + eventcounter.maybe_key_change;
+}
+
+
 
 
 static const char hlp_istrusted[] =
@@ -647,10 +664,8 @@ cmd_havekey (assuan_context_t ctx, char *line)
   char *p;
   int list_mode;  /* Less than 0 for no limit.  */
   int counter;
-  char *dirname;
-  gnupg_dir_t dir;
-  gnupg_dirent_t dir_entry;
-  char hexgrip[41];
+  unsigned char *grips = NULL;
+  size_t ngrips, n;
   struct card_key_info_s *keyinfo_on_cards, *l;
 
   if (has_option_name (line, "--list"))
@@ -688,8 +703,6 @@ cmd_havekey (assuan_context_t ctx, char *line)
     }
 
   /* List mode.  */
-  dir = NULL;
-  dirname = NULL;
   ctrl = assuan_get_pointer (ctx);
 
   if (ctrl->restricted)
@@ -698,39 +711,20 @@ cmd_havekey (assuan_context_t ctx, char *line)
       goto leave;
     }
 
-  dirname = make_filename_try (gnupg_homedir (),
-                               GNUPG_PRIVATE_KEYS_DIR, NULL);
-  if (!dirname)
-    {
-      err = gpg_error_from_syserror ();
-      goto leave;
-    }
-  dir = gnupg_opendir (dirname);
-  if (!dir)
-    {
-      err = gpg_error_from_syserror ();
-      goto leave;
-    }
+  err = agent_list_keygrips (&grips, &ngrips);
+  if (err)
+    goto leave;
 
   counter = 0;
-  while ((dir_entry = gnupg_readdir (dir)))
+  for (n=0; n < ngrips; n++)
     {
-      if (strlen (dir_entry->d_name) != 44
-          || strcmp (dir_entry->d_name + 40, ".key"))
-        continue;
-      strncpy (hexgrip, dir_entry->d_name, 40);
-      hexgrip[40] = 0;
-
-      if ( hex2bin (hexgrip, grip, 20) < 0 )
-        continue; /* Bad hex string.  */
-
       if (list_mode > 0 && ++counter > list_mode)
         {
           err = gpg_error (GPG_ERR_TRUNCATED);
           goto leave;
         }
 
-      err = assuan_send_data (ctx, grip, 20);
+      err = assuan_send_data (ctx, grips + 20 * n, 20);
       if (err)
         goto leave;
     }
@@ -756,8 +750,7 @@ cmd_havekey (assuan_context_t ctx, char *line)
   err = 0;
 
  leave:
-  gnupg_closedir (dir);
-  xfree (dirname);
+  xfree (grips);
   return leave_cmd (ctx, err);
 }
 
@@ -969,7 +962,13 @@ static const char hlp_pksign[] =
   "PKSIGN [<options>] [<cache_nonce>]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With option --multi the digests to sign are inquired using the\n"
+  "keyword DIGESTS.  The data is a concatenation of digests of the\n"
+  "algorithm and length set by SETHASH.  The key is unlocked only once\n"
+  "and the signatures are returned one after the other as canonical\n"
+  "S-expressions.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -979,7 +978,12 @@ cmd_pksign (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   char *cache_nonce = NULL;
   char *p;
+  int opt_multi;
+  unsigned char *digests = NULL;
+  size_t n;
+  uint64_t started;
 
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
 
   for (p=line; *p && *p != ' ' && *p != '\t'; p++)
@@ -993,15 +997,47 @@ cmd_pksign (assuan_context_t ctx, char *line)
   else if (!ctrl->server_local->use_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
 
-  init_membuf (&outbuf, 512);
+  if (opt_multi)
+    {
+      size_t dlen = ctrl->digest.valuelen;
+      size_t maxlen = dlen * PKSIGN_MULTI_MAX;
 
-  err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
-                      &outbuf, cache_mode);
+      if (!dlen || ctrl->digest.data)
+        {
+          err = set_error (GPG_ERR_MISSING_VALUE, "no hash set by SETHASH");
+          goto leave;
+        }
+      err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%zu", maxlen);
+      if (!err)
+        err = assuan_inquire (ctx, "DIGESTS", &digests, &n, maxlen);
+      if (err)
+        goto leave;
+      if (!n || (n % dlen))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid length of digests");
+          goto leave;
+        }
+      init_membuf (&outbuf, 512 * (n / dlen));
+      started = agent_metric_start ();
+      err = agent_pksign_multi (ctrl, cache_nonce,
+                                ctrl->server_local->keydesc,
+                                digests, n / dlen, &outbuf, cache_mode);
+    }
+  else
+    {
+      init_membuf (&outbuf, 512);
+      started = agent_metric_start ();
+      err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                          &outbuf, cache_mode);
+    }
+  agent_metric_stop (METRIC_PKSIGN, started);
   if (err)
     clear_outbuf (&outbuf);
   else
     err = write_and_clear_outbuf (ctx, &outbuf);
 
+ leave:
+  xfree (digests);
   xfree (cache_nonce);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
@@ -1023,6 +1059,7 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
   size_t valuelen;
   membuf_t outbuf;
   int padding;
+  uint64_t started;
 
   (void)line;
 
@@ -1036,8 +1073,10 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
 
   init_membuf (&outbuf, 512);
 
+  started = agent_metric_start ();
   rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
                         value, valuelen, &outbuf, &padding);
+  agent_metric_stop (METRIC_PKDECRYPT, started);
   xfree (value);
   if (rc)
     clear_outbuf (&outbuf);
@@ -1679,7 +1718,8 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int err;
   unsigned char grip[20];
-  gnupg_dir_t dir = NULL;
+  unsigned char *grips = NULL;
+  size_t ngrips;
   int list_mode;
   int opt_data, opt_ssh_fpr, opt_with_ssh;
   ssh_control_file_t cf = NULL;
@@ -1765,35 +1805,14 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
     }
   else if (list_mode)
     {
-      char *dirname;
-      gnupg_dirent_t dir_entry;
-
-      dirname = make_filename_try (gnupg_homedir (),
-                                   GNUPG_PRIVATE_KEYS_DIR, NULL);
-      if (!dirname)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
-      dir = gnupg_opendir (dirname);
-      if (!dir)
-        {
-          err = gpg_error_from_syserror ();
-          xfree (dirname);
-          goto leave;
-        }
-      xfree (dirname);
+      err = agent_list_keygrips (&grips, &ngrips);
+      if (err)
+        goto leave;
 
-      while ( (dir_entry = gnupg_readdir (dir)) )
+      for (n=0; n < ngrips; n++)
         {
-          if (strlen (dir_entry->d_name) != 44
-              || strcmp (dir_entry->d_name + 40, ".key"))
-            continue;
-          strncpy (hexgrip, dir_entry->d_name, 40);
-          hexgrip[40] = 0;
-
-          if ( hex2bin (hexgrip, grip, 20) < 0 )
-            continue; /* Bad hex string.  */
+          memcpy (grip, grips + 20 * n, 20);
+          bin2hex (grip, 20, hexgrip);
 
           disabled = ttl = confirm = is_ssh = 0;
           if (opt_with_ssh)
@@ -1849,8 +1868,8 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
 
  leave:
   xfree (need_attr);
+  xfree (grips);
   ssh_close_control_file (cf);
-  gnupg_closedir (dir);
   if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
     leave_cmd (ctx, err);
   return err;
@@ -1949,6 +1968,7 @@ cmd_get_passphrase (assuan_context_t ctx, char *line)
   struct pin_entry_info_s *pi = NULL;
   struct pin_entry_info_s *pi2 = NULL;
   int is_generated;
+  uint64_t started = agent_metric_start ();
 
   if (ctrl->restricted)
     return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
@@ -2197,6 +2217,7 @@ cmd_get_passphrase (assuan_context_t ctx, char *line)
   xfree (entry_errtext);
   xfree (pi2);
   xfree (pi);
+  agent_metric_stop (METRIC_GET_PASSPHRASE, started);
   return leave_cmd (ctx, rc);
 }
 
@@ -2758,6 +2779,14 @@ cmd_import_key (assuan_context_t ctx, char *line)
       goto leave;
     }
 
+  /* A client usually imports all keys using one connection; thus we
+   * sync the key directory only when the connection ends.  */
+  if (!ctrl->server_local->key_write_batch)
+    {
+      agent_begin_key_writes ();
+      ctrl->server_local->key_write_batch = 1;
+    }
+
   opt_unattended = has_option (line, "--unattended");
   force = has_option (line, "--force");
   if ((s=has_option_name (line, "--timestamp")))
@@ -3713,6 +3742,43 @@ cmd_updatestartuptty (assuan_context_t ctx, char *line)
 
 
 
+static const char hlp_metrics[] =
+  "METRICS [--reset]\n"
+  "\n"
+  "Return latency histograms and counters as colon delimited data\n"
+  "lines.  The first field gives the type of the line:\n"
+  "\n"
+  "  since:<time>:\n"
+  "  metric:<name>:<count>:<total>:<max>:<histogram>:\n"
+  "  counter:<name>:<value>:\n"
+  "\n"
+  "TIME is the time the values were last reset.  TOTAL and MAX are\n"
+  "given in microseconds.  HISTOGRAM is a comma delimited list with\n"
+  "the number of operations which took less than 1, 2, 4, 8, ...\n"
+  "microseconds but not less than the previous limit; the last item\n"
+  "counts all longer operations.  With --reset all values are cleared\n"
+  "after they have been returned.";
+static gpg_error_t
+cmd_metrics (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  membuf_t mb;
+  int opt_reset;
+
+  opt_reset = has_option (line, "--reset");
+  if (opt_reset && ctrl->restricted)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
+
+  init_membuf (&mb, 2048);
+  agent_format_metrics (&mb);
+  if (opt_reset)
+    agent_reset_metrics ();
+  err = write_and_clear_outbuf (ctx, &mb);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_killagent[] =
   "KILLAGENT\n"
   "\n"
@@ -4216,6 +4282,7 @@ register_commands (assuan_context_t ctx)
     { "KILLAGENT",      cmd_killagent,  hlp_killagent },
     { "RELOADAGENT",    cmd_reloadagent,hlp_reloadagent },
     { "GETINFO",        cmd_getinfo,   hlp_getinfo },
+    { "METRICS",        cmd_metrics,   hlp_metrics },
     { "KEYTOCARD",      cmd_keytocard, hlp_keytocard },
     { "KEYTOTPM",       cmd_keytotpm, hlp_keytotpm },
     { "KEYATTR",        cmd_keyattr, hlp_keyattr },
@@ -4369,6 +4436,10 @@ start_command_handler (ctrl_t ctrl, gnupg_fd_t listen_fd, gnupg_fd_t fd)
   /* Reset the pinentry (in case of popup messages). */
   agent_reset_query (ctrl);
 
+  /* Sync the keys imported by this connection.  */
+  if (ctrl->server_local->key_write_batch)
+    agent_end_key_writes ();
+
   /* Cleanup.  */
   assuan_release (ctx);
   xfree (ctrl->server_local->keydesc);
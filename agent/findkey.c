@@ -49,6 +49,467 @@ struct try_unprotect_arg_s
 };
 
 
+/* An index of the keys in the private key directory.  gpg calls
+ * HAVEKEY and KEYINFO for many keygrips and with thousands of keys
+ * reading the directory or opening each key file takes a long time.
+ * The index is a sorted array of the keygrips which is rebuilt when
+ * the inode or the mtime of the directory changes.  Because the mtime
+ * has only a resolution of a second, the index is not trusted for a
+ * directory modified in the second the index was built.  For
+ * KEYINFO the type of the key and the shadow info are stored along
+ * with the stat info of the key file when they are first needed.
+ *
+ * Neither the rebuild nor the lookup yields and thus no lock is
+ * required; callers must not keep pointers into the index across a
+ * function which may yield.  */
+struct key_index_item_s
+{
+  unsigned char grip[20];
+  int keytype;                 /* PRIVATE_KEY_xxx or -1 if not known.  */
+  unsigned char *shadow_info;  /* Malloced or NULL.  */
+  unsigned char *shadow_info_type;  /* Malloced or NULL.  */
+  ino_t ino;                   /* The stat info of the key file at the */
+  off_t size;                  /* time KEYTYPE was set.                */
+  time_t mtime;
+  time_t ctime;
+};
+
+static struct
+{
+  int valid;
+  ino_t dir_ino;
+  time_t dir_mtime;
+  time_t built;                    /* Time the index was built.  */
+  struct key_index_item_s *items;  /* Sorted by keygrip.  */
+  size_t nitems;
+} key_index;
+
+
+static void
+key_index_forget_info (struct key_index_item_s *item)
+{
+  item->keytype = -1;
+  xfree (item->shadow_info);
+  item->shadow_info = NULL;
+  xfree (item->shadow_info_type);
+  item->shadow_info_type = NULL;
+}
+
+
+static void
+key_index_release_items (struct key_index_item_s *items, size_t nitems)
+{
+  size_t n;
+
+  for (n=0; n < nitems; n++)
+    key_index_forget_info (items + n);
+  xfree (items);
+}
+
+
+/* Flush the index.  */
+static void
+key_index_flush (void)
+{
+  key_index_release_items (key_index.items, key_index.nitems);
+  key_index.items = NULL;
+  key_index.nitems = 0;
+  key_index.valid = 0;
+}
+
+
+static int
+cmp_key_index_items (const void *a, const void *b)
+{
+  const struct key_index_item_s *ia = a;
+  const struct key_index_item_s *ib = b;
+
+  return memcmp (ia->grip, ib->grip, 20);
+}
+
+
+/* Return the index item for GRIP or NULL.  */
+static struct key_index_item_s *
+key_index_find (const unsigned char *grip)
+{
+  struct key_index_item_s tmp;
+
+  if (!key_index.nitems)
+    return NULL;
+  memcpy (tmp.grip, grip, 20);
+  return bsearch (&tmp, key_index.items, key_index.nitems,
+                  sizeof *key_index.items, cmp_key_index_items);
+}
+
+
+/* Make sure that the index is up to date.  Returns false if the
+ * index can't be used; the caller needs to fall back to the files in
+ * this case.  */
+static int
+key_index_update (void)
+{
+  char *dirname;
+  struct stat st;
+  gnupg_dir_t dir;
+  gnupg_dirent_t dir_entry;
+  struct key_index_item_s *items = NULL;
+  struct key_index_item_s *tmpitems, *old;
+  size_t nitems = 0;
+  size_t size = 0;
+  size_t n;
+  time_t now;
+
+  dirname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    return 0;
+  if (gnupg_stat (dirname, &st))
+    {
+      xfree (dirname);
+      key_index_flush ();
+      return 0;
+    }
+  if (key_index.valid
+      && key_index.dir_ino == st.st_ino
+      && key_index.dir_mtime == st.st_mtime
+      && st.st_mtime < key_index.built)
+    {
+      xfree (dirname);
+      return 1;
+    }
+
+  /* We compare with file system times and thus can't use the
+   * possibly faked system time.  */
+  now = time (NULL);
+  dir = gnupg_opendir (dirname);
+  xfree (dirname);
+  if (!dir)
+    {
+      key_index_flush ();
+      return 0;
+    }
+  while ((dir_entry = gnupg_readdir (dir)))
+    {
+      if (strlen (dir_entry->d_name) != 44
+          || strcmp (dir_entry->d_name + 40, ".key"))
+        continue;
+      if (nitems == size)
+        {
+          size = size? size * 2 : 256;
+          tmpitems = xtryrealloc (items, size * sizeof *items);
+          if (!tmpitems)
+            {
+              gnupg_closedir (dir);
+              xfree (items);
+              key_index_flush ();
+              return 0;
+            }
+          items = tmpitems;
+        }
+      memset (items + nitems, 0, sizeof *items);
+      if (hex2bin (dir_entry->d_name, items[nitems].grip, 20) < 0)
+        continue; /* Bad hex string.  */
+      items[nitems].keytype = -1;
+      nitems++;
+    }
+  gnupg_closedir (dir);
+  if (nitems)
+    qsort (items, nitems, sizeof *items, cmp_key_index_items);
+
+  /* Take over the info of the keys we already know.  The stat info
+   * is checked before the info is used.  */
+  for (n=0; n < nitems; n++)
+    if ((old = key_index_find (items[n].grip)) && old->keytype != -1)
+      {
+        items[n] = *old;
+        old->shadow_info = NULL;
+        old->shadow_info_type = NULL;
+      }
+
+  key_index_release_items (key_index.items, key_index.nitems);
+  key_index.items = items;
+  key_index.nitems = nitems;
+  key_index.dir_ino = st.st_ino;
+  key_index.dir_mtime = st.st_mtime;
+  key_index.built = now;
+  key_index.valid = 1;
+  if (DBG_CACHE)
+    log_debug ("key index: %zu keys\n", nitems);
+  return 1;
+}
+
+
+/* Forget the info about the key GRIP because its file will change.  */
+static void
+key_index_forget (const unsigned char *grip)
+{
+  struct key_index_item_s *item;
+
+  if (key_index.valid && (item = key_index_find (grip)))
+    key_index_forget_info (item);
+}
+
+
+/* Return the keygrips of all keys in the private key directory as an
+ * array of 20 byte values sorted by keygrip.  The caller must xfree
+ * the array.  */
+gpg_error_t
+agent_list_keygrips (unsigned char **r_grips, size_t *r_ngrips)
+{
+  unsigned char *grips;
+  size_t n;
+
+  *r_grips = NULL;
+  *r_ngrips = 0;
+
+  if (!key_index_update ())
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  grips = xtrymalloc (20 * key_index.nitems + 1);
+  if (!grips)
+    return gpg_error_from_syserror ();
+  for (n=0; n < key_index.nitems; n++)
+    memcpy (grips + 20 * n, key_index.items[n].grip, 20);
+  *r_grips = grips;
+  *r_ngrips = key_index.nitems;
+  return 0;
+}
+
+
+
+/* A cache for the parsed key files.  Each PKSIGN or PKDECRYPT reads
+ * and parses the key file; with a cached passphrase this takes a
+ * considerable part of the time required for an operation.  Only the
+ * still protected S-expression is kept (in secure memory) along with
+ * the meta data.  An entry is used only if the file's inode, size,
+ * mtime and ctime are unchanged; our own updates invalidate the
+ * entry explicitly.  Note that allocating or releasing secure memory
+ * may yield and thus we need a lock.  */
+#define KEY_FILE_CACHE_SIZE 32
+
+struct key_file_cache_s
+{
+  unsigned char grip[20];
+  unsigned long seq;      /* Used for LRU replacement; 0 := unused.  */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+  unsigned char *key;     /* The canonical S-expression.  */
+  size_t keylen;
+  char *meta;             /* The meta data or NULL for the old format.  */
+  size_t metalen;
+};
+static struct key_file_cache_s key_file_cache[KEY_FILE_CACHE_SIZE];
+static unsigned long key_file_cache_seq;
+static npth_mutex_t key_file_cache_lock = NPTH_MUTEX_INITIALIZER;
+
+
+static void
+lock_key_file_cache (void)
+{
+  int res = npth_mutex_lock (&key_file_cache_lock);
+  if (res)
+    log_fatal ("failed to acquire key file cache mutex: %s\n",
+               strerror (res));
+}
+
+static void
+unlock_key_file_cache (void)
+{
+  int res = npth_mutex_unlock (&key_file_cache_lock);
+  if (res)
+    log_fatal ("failed to release key file cache mutex: %s\n",
+               strerror (res));
+}
+
+
+static void
+key_file_cache_release_item (struct key_file_cache_s *item)
+{
+  if (item->key)
+    {
+      wipememory (item->key, item->keylen);
+      xfree (item->key);
+    }
+  xfree (item->meta);
+  memset (item, 0, sizeof *item);
+}
+
+
+/* Remove the entry for GRIP from the key file cache.  */
+static void
+key_file_cache_invalidate (const unsigned char *grip)
+{
+  int i;
+
+  key_index_forget (grip);
+
+  lock_key_file_cache ();
+  for (i=0; i < KEY_FILE_CACHE_SIZE; i++)
+    if (key_file_cache[i].seq && !memcmp (key_file_cache[i].grip, grip, 20))
+      key_file_cache_release_item (key_file_cache + i);
+  unlock_key_file_cache ();
+}
+
+
+/* Flush the entire key file cache and the key index.  */
+void
+agent_flush_key_file_cache (void)
+{
+  int i;
+
+  key_index_flush ();
+
+  lock_key_file_cache ();
+  for (i=0; i < KEY_FILE_CACHE_SIZE; i++)
+    if (key_file_cache[i].seq)
+      key_file_cache_release_item (key_file_cache + i);
+  unlock_key_file_cache ();
+}
+
+
+/* Look up GRIP in the key file cache.  ST is the current stat info
+ * of the key file.  On a hit the key and, if R_KEYMETA is not NULL,
+ * the meta data are returned like read_key_file does; on a miss
+ * GPG_ERR_NOT_FOUND is returned.  */
+static gpg_error_t
+key_file_cache_get (const unsigned char *grip, const struct stat *st,
+                    gcry_sexp_t *result, nvc_t *r_keymeta)
+{
+  gpg_error_t err;
+  struct key_file_cache_s *item = NULL;
+  estream_t fp;
+  int i, line;
+
+  lock_key_file_cache ();
+  for (i=0; i < KEY_FILE_CACHE_SIZE; i++)
+    if (key_file_cache[i].seq && !memcmp (key_file_cache[i].grip, grip, 20))
+      {
+        item = key_file_cache + i;
+        break;
+      }
+  if (!item)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  if (item->dev != st->st_dev || item->ino != st->st_ino
+      || item->size != st->st_size || item->mtime != st->st_mtime
+      || item->ctime != st->st_ctime)
+    {
+      if (DBG_CACHE)
+        log_debug ("key file cache: entry for %02X%02X%02X%02X is stale\n",
+                   grip[0], grip[1], grip[2], grip[3]);
+      key_file_cache_release_item (item);
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  err = gcry_sexp_sscan (result, NULL, (char*)item->key, item->keylen);
+  if (err)
+    goto leave;
+
+  if (r_keymeta && item->meta)
+    {
+      fp = es_fopenmem_init (0, "rb", item->meta, item->metalen);
+      if (!fp)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = nvc_parse_private_key (r_keymeta, &line, fp);
+          es_fclose (fp);
+        }
+      if (err)
+        {
+          gcry_sexp_release (*result);
+          *result = NULL;
+          goto leave;
+        }
+    }
+
+  item->seq = ++key_file_cache_seq;
+  if (DBG_CACHE)
+    log_debug ("key file cache: hit for %02X%02X%02X%02X\n",
+               grip[0], grip[1], grip[2], grip[3]);
+
+ leave:
+  unlock_key_file_cache ();
+  agent_count (err? COUNTER_KEYFILE_CACHE_MISS : COUNTER_KEYFILE_CACHE_HIT);
+  return err;
+}
+
+
+/* Store the key KEY and its meta data KEYMETA (which may be NULL)
+ * read from the key file for GRIP with the stat info ST in the
+ * cache.  Errors are ignored.  */
+static void
+key_file_cache_put (const unsigned char *grip, const struct stat *st,
+                    gcry_sexp_t key, nvc_t keymeta)
+{
+  struct key_file_cache_s *item = NULL;
+  unsigned char *buf;
+  size_t len;
+  void *meta = NULL;
+  size_t metalen = 0;
+  estream_t fp;
+  int i;
+
+  len = gcry_sexp_sprint (key, GCRYSEXP_FMT_CANON, NULL, 0);
+  if (!len || !(buf = xtrymalloc_secure (len)))
+    return;
+  len = gcry_sexp_sprint (key, GCRYSEXP_FMT_CANON, buf, len);
+  if (!len)
+    {
+      xfree (buf);
+      return;
+    }
+
+  if (keymeta)
+    {
+      fp = es_fopenmem (0, "w+b");
+      if (!fp || nvc_write (keymeta, fp)
+          || es_fclose_snatch (fp, &meta, &metalen))
+        {
+          es_fclose (fp);
+          wipememory (buf, len);
+          xfree (buf);
+          return;
+        }
+    }
+
+  /* Replace an existing entry for GRIP or the least recently used
+   * one.  Unused entries have a SEQ of 0 and are thus taken first.  */
+  lock_key_file_cache ();
+  for (i=0; i < KEY_FILE_CACHE_SIZE; i++)
+    {
+      if (key_file_cache[i].seq && !memcmp (key_file_cache[i].grip, grip, 20))
+        {
+          item = key_file_cache + i;
+          break;
+        }
+      if (!item || key_file_cache[i].seq < item->seq)
+        item = key_file_cache + i;
+    }
+  key_file_cache_release_item (item);
+
+  memcpy (item->grip, grip, 20);
+  item->seq = ++key_file_cache_seq;
+  item->dev = st->st_dev;
+  item->ino = st->st_ino;
+  item->size = st->st_size;
+  item->mtime = st->st_mtime;
+  item->ctime = st->st_ctime;
+  item->key = buf;
+  item->keylen = len;
+  item->meta = meta;
+  item->metalen = metalen;
+  unlock_key_file_cache ();
+}
+
+
+
 /* Replace all linefeeds in STRING by "%0A" and return a new malloced
  * string.  May return NULL on memory error.  */
 static char *
@@ -79,17 +540,19 @@ linefeed_to_percent0A (const char *string)
 }
 
 
-/* Note: Ownership of FNAME and FP are moved to this function.  */
+/* Write the key BUF of length LEN in the extended format to OUTFP.
+ * If UPDATE is set the other items are taken from the key file FP.
+ * FNAME is only used for diagnostics.  */
 static gpg_error_t
-write_extended_private_key (char *fname, estream_t fp, int update, int newkey,
+write_extended_private_key (const char *fname, estream_t fp,
+                            int update, int newkey,
                             const void *buf, size_t len,
                             const char *serialno, const char *keyref,
-                            time_t timestamp)
+                            time_t timestamp, estream_t outfp)
 {
   gpg_error_t err;
   nvc_t pk = NULL;
   gcry_sexp_t key = NULL;
-  int remove = 0;
   char *token = NULL;
 
   if (update)
@@ -113,7 +576,6 @@ write_extended_private_key (char *fname, estream_t fp, int update, int newkey,
           goto leave;
         }
     }
-  es_clearerr (fp);
 
   err = gcry_sexp_sscan (&key, NULL, buf, len);
   if (err)
@@ -166,67 +628,149 @@ write_extended_private_key (char *fname, estream_t fp, int update, int newkey,
         goto leave;
     }
 
+  err = nvc_write (pk, outfp);
 
-  err = es_fseek (fp, 0, SEEK_SET);
-  if (err)
-    goto leave;
+ leave:
+  gcry_sexp_release (key);
+  nvc_release (pk);
+  xfree (token);
+  return err;
+}
 
-  err = nvc_write (pk, fp);
-  if (!err)
-    err = es_fflush (fp);
-  if (err)
-    {
-      log_error ("error writing '%s': %s\n", fname, gpg_strerror (err));
-      remove = 1;
-      goto leave;
-    }
 
-  if (ftruncate (es_fileno (fp), es_ftello (fp)))
-    {
-      err = gpg_error_from_syserror ();
-      log_error ("error truncating '%s': %s\n", fname, gpg_strerror (err));
-      remove = 1;
-      goto leave;
-    }
+/* Flush the stream FP and its file to the disk.  */
+static gpg_error_t
+sync_stream (estream_t fp)
+{
+#ifdef HAVE_FSYNC
+  int rc;
+#endif
 
-  if (es_fclose (fp))
+  if (es_fflush (fp))
+    return gpg_error_from_syserror ();
+#ifdef HAVE_FSYNC
+  npth_unprotect ();
+  rc = fsync (es_fileno (fp));
+  npth_protect ();
+  if (rc)
+    return gpg_error_from_syserror ();
+#endif
+  return 0;
+}
+
+
+/* Flush the directory SUBDIR of the home directory to the disk so
+ * that a rename done there is persistent.  Errors are ignored
+ * because the new file has already been synced.  */
+static void
+sync_directory (const char *subdir)
+{
+#if !defined(HAVE_W32_SYSTEM) && defined(HAVE_FSYNC)
+  char *dname;
+  int fd, rc;
+
+  dname = make_filename_try (gnupg_homedir (), subdir, NULL);
+  if (!dname)
+    return;
+  fd = open (dname, O_RDONLY);
+  if (fd != -1)
     {
-      err = gpg_error_from_syserror ();
-      log_error ("error closing '%s': %s\n", fname, gpg_strerror (err));
-      remove = 1;
-      goto leave;
+      npth_unprotect ();
+      rc = fsync (fd);
+      npth_protect ();
+      if (rc && opt.verbose)
+        log_info ("error syncing '%s': %s\n", dname, strerror (errno));
+      close (fd);
     }
+  xfree (dname);
+#else
+  (void)subdir;
+#endif
+}
+
+
+/* The number of active batches of key writes and a flag telling that
+ * the key directory needs to be synced.  */
+static int key_write_batches;
+static int key_dirsync_pending;
+
+
+/* Sync the private key directory after a key file has been created
+ * or renamed.  In batch mode the sync is deferred.  */
+static void
+sync_key_directory (void)
+{
+  if (key_write_batches)
+    key_dirsync_pending = 1;
   else
-    fp = NULL;
+    sync_directory (GNUPG_PRIVATE_KEYS_DIR);
+}
 
-  bump_key_eventcounter ();
 
- leave:
-  es_fclose (fp);
-  if (remove)
-    gnupg_remove (fname);
-  xfree (fname);
-  gcry_sexp_release (key);
-  nvc_release (pk);
-  xfree (token);
-  return err;
+/* Start a batch of key writes.  Until the matching call to
+ * agent_end_key_writes the directory is not synced after each written
+ * key but only once at the end or by agent_sync_key_directory.  The
+ * key files themselves are always synced before they are put into
+ * place and thus a crash leaves either the old or the new version of
+ * a key; only the most recent keys may be missing after a crash.  */
+void
+agent_begin_key_writes (void)
+{
+  key_write_batches++;
 }
 
+
+/* End a batch of key writes started with agent_begin_key_writes.  */
+void
+agent_end_key_writes (void)
+{
+  log_assert (key_write_batches > 0);
+  if (!--key_write_batches)
+    agent_sync_key_directory ();
+}
+
+
+/* Do a deferred sync of the private key directory.  This is also
+ * called by the housekeeping ticker to limit the time a batch may
+ * delay the sync.  */
+void
+agent_sync_key_directory (void)
+{
+  if (key_dirsync_pending)
+    {
+      key_dirsync_pending = 0;
+      sync_directory (GNUPG_PRIVATE_KEYS_DIR);
+    }
+}
+
+
 /* Write an S-expression formatted key to our key storage.  With FORCE
  * passed as true an existing key with the given GRIP will get
  * overwritten.  If SERIALNO and KEYREF are given a Token line is
  * added to the key if the extended format is used.  If TIMESTAMP is
  * not zero and the key doies not yet exists it will be recorded as
- * creation date.  */
+ * creation date.
+ *
+ * A new key is created exclusively.  To replace an existing key a
+ * temporary file is written, synced and then renamed so that a failed
+ * write or a crash leaves the old key intact.  See
+ * agent_begin_key_writes for the sync of the directory.  */
 int
 agent_write_private_key (const unsigned char *grip,
                          const void *buffer, size_t length, int force,
                          const char *serialno, const char *keyref,
                          time_t timestamp)
 {
+  gpg_error_t err;
   char *fname;
-  estream_t fp;
+  char *tmpfname = NULL;
+  estream_t fp = NULL;     /* The existing key file.  */
+  estream_t outfp = NULL;
   char hexgrip[40+4+1];
+  int update = 0;
+  int newkey = 1;
+  int extended = opt.enable_extended_key_format;
+  int remove = 0;
 
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
@@ -234,8 +778,7 @@ agent_write_private_key (const unsigned char *grip,
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
 
-  /* FIXME: Write to a temp file first so that write failures during
-     key updates won't lead to a key loss.  */
+  key_file_cache_invalidate (grip);
 
   if (!force && !gnupg_access (fname, F_OK))
     {
@@ -244,99 +787,130 @@ agent_write_private_key (const unsigned char *grip,
       return gpg_error (GPG_ERR_EEXIST);
     }
 
-  fp = es_fopen (fname, force? "rb+,mode=-rw" : "wbx,mode=-rw");
-  if (!fp)
+  if (force)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-
-      if (force && gpg_err_code (tmperr) == GPG_ERR_ENOENT)
-        {
-          fp = es_fopen (fname, "wbx,mode=-rw");
-          if (!fp)
-            tmperr = gpg_error_from_syserror ();
-        }
+      fp = es_fopen (fname, "rb");
       if (!fp)
         {
-          log_error ("can't create '%s': %s\n", fname, gpg_strerror (tmperr));
-          xfree (fname);
-          return tmperr;
+          err = gpg_error_from_syserror ();
+          if (gpg_err_code (err) != GPG_ERR_ENOENT)
+            {
+              log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
+              goto leave;
+            }
         }
-    }
-  else if (force)
-    {
-      gpg_error_t rc;
-      char first;
-
-      /* See if an existing key is in extended format.  */
-      if (es_fread (&first, 1, 1, fp) != 1)
+      else
         {
-          rc = gpg_error_from_syserror ();
-          log_error ("error reading first byte from '%s': %s\n",
-                     fname, strerror (errno));
-          xfree (fname);
-          es_fclose (fp);
-          return rc;
+          int first;
+
+          /* See if an existing key is in extended format.  */
+          first = es_getc (fp);
+          if (first == EOF)
+            {
+              err = es_ferror (fp)? gpg_error_from_syserror ()
+                /**/              : gpg_error (GPG_ERR_EOF);
+              log_error ("error reading first byte from '%s': %s\n",
+                         fname, gpg_strerror (err));
+              goto leave;
+            }
+          if (es_fseek (fp, 0, SEEK_SET))
+            {
+              err = gpg_error_from_syserror ();
+              log_error ("error seeking in '%s': %s\n",
+                         fname, gpg_strerror (err));
+              goto leave;
+            }
+
+          newkey = 0;
+          if (first != '(')
+            extended = update = 1;  /* Already in the extended format.  */
         }
 
-      rc = es_fseek (fp, 0, SEEK_SET);
-      if (rc)
+      /* Note that agent_update_private_key uses ".key.tmp".  */
+      tmpfname = strconcat (fname, ".new", NULL);
+      if (!tmpfname)
         {
-          log_error ("error seeking in '%s': %s\n", fname, strerror (errno));
-          xfree (fname);
-          es_fclose (fp);
-          return rc;
+          err = gpg_error_from_syserror ();
+          goto leave;
         }
-
-      if (first != '(')
+      outfp = es_fopen (tmpfname, "wb,mode=-rw");
+      if (!outfp)
         {
-          /* Key is already in the extended format.  */
-          return write_extended_private_key (fname, fp, 1, 0, buffer, length,
-                                             serialno, keyref, timestamp);
+          err = gpg_error_from_syserror ();
+          log_error ("can't create '%s': %s\n", tmpfname, gpg_strerror (err));
+          goto leave;
         }
-      if (first == '(' && opt.enable_extended_key_format)
+    }
+  else
+    {
+      outfp = es_fopen (fname, "wbx,mode=-rw");
+      if (!outfp)
         {
-          /* Key is in the old format - but we want the extended format.  */
-          return write_extended_private_key (fname, fp, 0, 0, buffer, length,
-                                             serialno, keyref, timestamp);
+          err = gpg_error_from_syserror ();
+          log_error ("can't create '%s': %s\n", fname, gpg_strerror (err));
+          goto leave;
         }
     }
+  remove = 1;
 
-  if (opt.enable_extended_key_format)
-    return write_extended_private_key (fname, fp, 0, 1, buffer, length,
-                                       serialno, keyref, timestamp);
+  if (extended)
+    err = write_extended_private_key (fname, fp, update, newkey,
+                                      buffer, length,
+                                      serialno, keyref, timestamp, outfp);
+  else if (es_fwrite (buffer, length, 1, outfp) != 1)
+    err = gpg_error_from_syserror ();
+  else
+    err = 0;
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n",
+                 tmpfname? tmpfname : fname, gpg_strerror (err));
+      goto leave;
+    }
 
-  if (es_fwrite (buffer, length, 1, fp) != 1)
+  if ((err = sync_stream (outfp)))
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error writing '%s': %s\n", fname, gpg_strerror (tmperr));
-      es_fclose (fp);
-      gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
+      log_error ("error flushing '%s': %s\n",
+                 tmpfname? tmpfname : fname, gpg_strerror (err));
+      goto leave;
     }
 
-  /* When force is given, the file might have to be truncated.  */
-  if (force && ftruncate (es_fileno (fp), es_ftello (fp)))
+  if (es_fclose (outfp))
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error truncating '%s': %s\n", fname, gpg_strerror (tmperr));
-      es_fclose (fp);
-      gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
+      outfp = NULL;
+      err = gpg_error_from_syserror ();
+      log_error ("error closing '%s': %s\n",
+                 tmpfname? tmpfname : fname, gpg_strerror (err));
+      goto leave;
     }
+  outfp = NULL;
 
-  if (es_fclose (fp))
+  if (tmpfname)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error closing '%s': %s\n", fname, gpg_strerror (tmperr));
-      gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
+      /* Close the old file first so that the rename works on W32.  */
+      es_fclose (fp);
+      fp = NULL;
+      err = gnupg_rename_file (tmpfname, fname, NULL);
+      if (err)
+        {
+          log_error (_("error renaming '%s' to '%s': %s\n"),
+                     tmpfname, fname, gpg_strerror (err));
+          goto leave;
+        }
     }
+  remove = 0;
+  sync_key_directory ();
+
   bump_key_eventcounter ();
+
+ leave:
+  es_fclose (fp);
+  es_fclose (outfp);
+  if (remove)
+    gnupg_remove (tmpfname? tmpfname : fname);
+  xfree (tmpfname);
   xfree (fname);
-  return 0;
+  return err;
 }
 
 
@@ -362,6 +936,8 @@ agent_update_private_key (const unsigned char *grip, nvc_t pk)
     }
   fname0[strlen (fname)-4] = 0;
 
+  key_file_cache_invalidate (grip);
+
   fp = es_fopen (fname, "wbx,mode=-rw");
   if (!fp)
     {
@@ -388,11 +964,29 @@ agent_update_private_key (const unsigned char *grip, nvc_t pk)
       log_error (_("error renaming '%s' to '%s': %s\n"),
                  fname, fname0, strerror (errno));
     }
+  else if (!err)
+    bump_key_eventcounter ();
 
   xfree (fname);
   return err;
 }
 
+/* Wrapper around agent_unprotect to record its latency.  */
+static gpg_error_t
+timed_unprotect (ctrl_t ctrl, const unsigned char *protectedkey,
+                 const char *passphrase, gnupg_isotime_t protected_at,
+                 unsigned char **result, size_t *resultlen)
+{
+  gpg_error_t err;
+  uint64_t started = agent_metric_start ();
+
+  err = agent_unprotect (ctrl, protectedkey, passphrase, protected_at,
+                         result, resultlen);
+  agent_metric_stop (METRIC_UNPROTECT, started);
+  return err;
+}
+
+
 /* Callback function to try the unprotection from the passphrase query
    code. */
 static gpg_error_t
@@ -408,7 +1002,7 @@ try_unprotect_cb (struct pin_entry_info_s *pi)
   log_assert (!arg->unprotected_key);
 
   arg->change_required = 0;
-  err = agent_unprotect (ctrl, arg->protected_key, pi->pin, protected_at,
+  err = timed_unprotect (ctrl, arg->protected_key, pi->pin, protected_at,
                          &arg->unprotected_key, &dummy);
   if (err)
     return err;
@@ -679,7 +1273,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
       pw = agent_get_cache (ctrl, cache_nonce, CACHE_MODE_NONCE);
       if (pw)
         {
-          rc = agent_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
+          rc = timed_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
           if (!rc)
             {
               if (r_passphrase)
@@ -704,7 +1298,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
       pw = agent_get_cache (ctrl, hexgrip, cache_mode);
       if (pw)
         {
-          rc = agent_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
+          rc = timed_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
           if (!rc)
             {
               if (cache_mode == CACHE_MODE_NORMAL)
@@ -742,7 +1336,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
           pw = agent_get_cache (ctrl, NULL, cache_mode);
           if (pw)
             {
-              rc = agent_unprotect (ctrl, *keybuf, pw, NULL,
+              rc = timed_unprotect (ctrl, *keybuf, pw, NULL,
                                     &result, &resultlen);
               if (!rc)
                 {
@@ -866,7 +1460,8 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
  * it.  On failure returns an error code and stores NULL at RESULT and
  * R_KEYMETA. */
 static gpg_error_t
-read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
+do_read_key_file (const unsigned char *grip, gcry_sexp_t *result,
+                  nvc_t *r_keymeta)
 {
   gpg_error_t err;
   char *fname;
@@ -887,6 +1482,14 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
 
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
+
+  if (!gnupg_stat (fname, &st)
+      && !key_file_cache_get (grip, &st, result, r_keymeta))
+    {
+      xfree (fname);
+      return 0;
+    }
+
   fp = es_fopen (fname, "rb");
   if (!fp)
     {
@@ -897,6 +1500,15 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
       return err;
     }
 
+  if (fstat (es_fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't stat '%s': %s\n", fname, gpg_strerror (err));
+      xfree (fname);
+      es_fclose (fp);
+      return err;
+    }
+
   if (es_fread (&first, 1, 1, fp) != 1)
     {
       err = gpg_error_from_syserror ();
@@ -935,7 +1547,10 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
             log_error ("error getting private key from '%s': %s\n",
                        fname, gpg_strerror (err));
           else
-            nvc_delete_named (pk, "Key:");
+            {
+              nvc_delete_named (pk, "Key:");
+              key_file_cache_put (grip, &st, *result, pk);
+            }
         }
 
       if (!err && r_keymeta)
@@ -946,15 +1561,6 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
       return err;
     }
 
-  if (fstat (es_fileno (fp), &st))
-    {
-      err = gpg_error_from_syserror ();
-      log_error ("can't stat '%s': %s\n", fname, gpg_strerror (err));
-      xfree (fname);
-      es_fclose (fp);
-      return err;
-    }
-
   buflen = st.st_size;
   buf = xtrymalloc (buflen+1);
   if (!buf)
@@ -991,11 +1597,25 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
                  (unsigned int)erroff, gpg_strerror (err));
       return err;
     }
+  key_file_cache_put (grip, &st, s_skey, NULL);
   *result = s_skey;
   return 0;
 }
 
 
+/* Same as do_read_key_file but record the latency.  */
+static gpg_error_t
+read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
+{
+  gpg_error_t err;
+  uint64_t started = agent_metric_start ();
+
+  err = do_read_key_file (grip, result, r_keymeta);
+  agent_metric_stop (METRIC_READ_KEY, started);
+  return err;
+}
+
+
 /* Remove the key identified by GRIP from the private key directory.  */
 static gpg_error_t
 remove_key_file (const unsigned char *grip)
@@ -1008,8 +1628,11 @@ remove_key_file (const unsigned char *grip)
   strcpy (hexgrip+40, ".key");
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
+  key_file_cache_invalidate (grip);
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
+  else
+    bump_key_eventcounter ();
   xfree (fname);
   return err;
 }
@@ -1600,6 +2223,9 @@ agent_key_available (const unsigned char *grip)
   char *fname;
   char hexgrip[40+4+1];
 
+  if (key_index_update ())
+    return key_index_find (grip)? 0 : -1;
+
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
 
@@ -1625,6 +2251,11 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
   unsigned char *buf;
   size_t len;
   int keytype;
+  struct key_index_item_s *item;
+  struct stat st;
+  int have_st = 0;
+  char hexgrip[40+4+1];
+  char *fname;
 
   (void)ctrl;
 
@@ -1633,6 +2264,49 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
   if (r_shadow_info)
     *r_shadow_info = NULL;
 
+  /* Try the key index first.  */
+  if (key_index_update ())
+    {
+      if (!(item = key_index_find (grip)))
+        return gpg_error (GPG_ERR_NOT_FOUND);
+
+      bin2hex (grip, 20, hexgrip);
+      strcpy (hexgrip+40, ".key");
+      fname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                                 hexgrip, NULL);
+      have_st = fname && !gnupg_stat (fname, &st);
+      xfree (fname);
+      /* ITEM is still valid because nothing above yields.  */
+      if (have_st && item->keytype != -1
+          && item->ino == st.st_ino && item->size == st.st_size
+          && item->mtime == st.st_mtime && item->ctime == st.st_ctime)
+        {
+          err = 0;
+          if (r_shadow_info && item->shadow_info)
+            {
+              len = gcry_sexp_canon_len (item->shadow_info, 0, NULL, NULL);
+              *r_shadow_info = xtrymalloc (len);
+              if (!*r_shadow_info)
+                err = gpg_error_from_syserror ();
+              else
+                memcpy (*r_shadow_info, item->shadow_info, len);
+              if (!err && r_shadow_info_type)
+                {
+                  *r_shadow_info_type = xtrystrdup (item->shadow_info_type);
+                  if (!*r_shadow_info_type)
+                    {
+                      err = gpg_error_from_syserror ();
+                      xfree (*r_shadow_info);
+                      *r_shadow_info = NULL;
+                    }
+                }
+            }
+          if (!err && r_keytype)
+            *r_keytype = item->keytype;
+          return err;
+        }
+    }
+
   {
     gcry_sexp_t sexp;
 
@@ -1687,6 +2361,36 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
   if (!err && r_keytype)
     *r_keytype = keytype;
 
+  /* Store the info in the index.  We need to look up the item again
+   * because reading the key may have yielded.  */
+  if (!err && have_st && key_index.valid && (item = key_index_find (grip)))
+    {
+      key_index_forget_info (item);
+      if (keytype == PRIVATE_KEY_SHADOWED)
+        {
+          const unsigned char *s;
+
+          if (!agent_get_shadow_info_type (buf, &s, &item->shadow_info_type))
+            {
+              len = gcry_sexp_canon_len (s, 0, NULL, NULL);
+              item->shadow_info = xtrymalloc (len);
+              if (item->shadow_info)
+                memcpy (item->shadow_info, s, len);
+            }
+          if (!item->shadow_info || !item->shadow_info_type)
+            {
+              key_index_forget_info (item);
+              goto leave;
+            }
+        }
+      item->keytype = keytype;
+      item->ino = st.st_ino;
+      item->size = st.st_size;
+      item->mtime = st.st_mtime;
+      item->ctime = st.st_ctime;
+    }
+
+ leave:
   xfree (buf);
   return err;
 }
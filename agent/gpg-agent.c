@@ -145,6 +145,9 @@ enum cmd_and_opt_values
   oDisableCheckOwnSocket,
   oS2KCount,
   oS2KCalibration,
+  oS2KArgon2,
+  oS2KArgon2Memory,
+  oS2KArgon2Lanes,
   oAutoExpandSecmem,
   oListenBacklog,
   oInactivityTimeout,
@@ -268,6 +271,9 @@ static gpgrt_opt_t opts[] = {
                 /* */                    N_("allow presetting passphrase")),
   ARGPARSE_s_u (oS2KCount, "s2k-count", "@"),
   ARGPARSE_s_u (oS2KCalibration, "s2k-calibration", "@"),
+  ARGPARSE_s_n (oS2KArgon2, "s2k-argon2", "@"),
+  ARGPARSE_s_u (oS2KArgon2Memory, "s2k-argon2-memory", "@"),
+  ARGPARSE_s_u (oS2KArgon2Lanes, "s2k-argon2-lanes", "@"),
 
   ARGPARSE_header ("Passphrase policy",
                    N_("Options enforcing a passphrase policy")),
@@ -343,6 +349,8 @@ static struct debug_flags_s debug_flags [] =
 #define MIN_PASSPHRASE_LEN    (8)
 #define MIN_PASSPHRASE_NONALPHA (1)
 #define MAX_PASSPHRASE_DAYS   (0)
+#define DEFAULT_ARGON2_MEMORY (64*1024) /* 64 MiB */
+#define DEFAULT_ARGON2_LANES  (4)
 
 /* The timer tick used for housekeeping stuff.  Note that on Windows
  * we use a SetWaitableTimer seems to signal earlier than about 2
@@ -897,6 +905,9 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       /* Note: When changing the next line, change also gpgconf_list.  */
       opt.ssh_fingerprint_digest = GCRY_MD_SHA256;
       opt.s2k_count = 0;
+      opt.s2k_argon2 = 0;
+      opt.s2k_argon2_memory = DEFAULT_ARGON2_MEMORY;
+      opt.s2k_argon2_lanes = DEFAULT_ARGON2_LANES;
       set_s2k_calibration_time (0);  /* Set to default.  */
       return 1;
     }
@@ -1016,6 +1027,25 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       set_s2k_calibration_time (pargs->r.ret_ulong);
       break;
 
+    case oS2KArgon2: opt.s2k_argon2 = 1; break;
+
+    case oS2KArgon2Memory:
+      /* Argon2 requires at least 8 KiB per lane; we cap at 4 GiB.  */
+      opt.s2k_argon2_memory = pargs->r.ret_ulong;
+      if (opt.s2k_argon2_memory < 1024)
+        opt.s2k_argon2_memory = 1024;
+      else if (opt.s2k_argon2_memory > 4*1024*1024)
+        opt.s2k_argon2_memory = 4*1024*1024;
+      break;
+
+    case oS2KArgon2Lanes:
+      opt.s2k_argon2_lanes = pargs->r.ret_ulong;
+      if (!opt.s2k_argon2_lanes)
+        opt.s2k_argon2_lanes = 1;
+      else if (opt.s2k_argon2_lanes > 64)
+        opt.s2k_argon2_lanes = 64;
+      break;
+
     case oNoop: break;
 
     default:
@@ -1070,6 +1100,8 @@ initialize_modules (void)
   initialize_module_call_pinentry ();
   initialize_module_daemon ();
   initialize_module_trustlist ();
+  agent_reset_metrics ();
+  enable_s2k_calibration_file ();
 }
 
 
@@ -2011,6 +2043,106 @@ agent_deinit_default_ctrl (ctrl_t ctrl)
 }
 
 
+#if GCRYPT_VERSION_NUMBER >= 0x010a00
+/* The maximum number of KDF jobs run in parallel.  */
+#define MAX_KDF_THREADS 16
+
+struct kdf_job_s
+{
+  gcry_kdf_job_fn_t fn;
+  void *priv;
+  npth_t thread;
+};
+
+struct kdf_jobs_s
+{
+  int njobs;
+  struct kdf_job_s jobs[MAX_KDF_THREADS];
+};
+
+
+/* The thread running a KDF job.  The job does not call into
+ * Libgcrypt and thus we can release the nPth lock.  */
+static void *
+kdf_job_thread (void *arg)
+{
+  struct kdf_job_s *job = arg;
+
+  npth_unprotect ();
+  job->fn (job->priv);
+  npth_protect ();
+  return NULL;
+}
+
+
+/* Libgcrypt callback to start the job JOB_FN with JOB_PRIV.  */
+static int
+kdf_dispatch_job (void *jobs_context, gcry_kdf_job_fn_t job_fn,
+                  void *job_priv)
+{
+  struct kdf_jobs_s *ctx = jobs_context;
+  struct kdf_job_s *job;
+  npth_attr_t tattr;
+  int rc = 1;
+
+  if (ctx->njobs < MAX_KDF_THREADS)
+    {
+      job = ctx->jobs + ctx->njobs;
+      job->fn = job_fn;
+      job->priv = job_priv;
+      npth_attr_init (&tattr);
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      rc = npth_create (&job->thread, &tattr, kdf_job_thread, job);
+      npth_attr_destroy (&tattr);
+      if (!rc)
+        ctx->njobs++;
+    }
+  if (rc)
+    {
+      /* Fall back to doing the work on this thread.  */
+      npth_unprotect ();
+      job_fn (job_priv);
+      npth_protect ();
+    }
+  return 0;
+}
+
+
+/* Libgcrypt callback to wait for all started jobs.  */
+static int
+kdf_wait_all_jobs (void *jobs_context)
+{
+  struct kdf_jobs_s *ctx = jobs_context;
+  int i, rc;
+
+  for (i=0; i < ctx->njobs; i++)
+    {
+      rc = npth_join (ctx->jobs[i].thread, NULL);
+      if (rc)
+        log_error ("error joining KDF thread: %s\n", strerror (rc));
+    }
+  ctx->njobs = 0;
+  return 0;
+}
+
+
+/* Compute the KDF for HD.  The jobs are run in separate threads
+ * without holding the nPth lock so that other connections are not
+ * blocked during a long running Argon2 computation.  */
+gpg_error_t
+agent_kdf_compute (gcry_kdf_hd_t hd)
+{
+  struct kdf_jobs_s jobs;
+  const gcry_kdf_thread_ops_t ops = {
+    &jobs, kdf_dispatch_job, kdf_wait_all_jobs
+  };
+
+  jobs.njobs = 0;
+  return gcry_kdf_compute (hd, &ops);
+}
+#endif /*Libgcrypt >= 1.10*/
+
+
 /* Because the ssh protocol does not send us information about the
    current TTY setting, we use this function to use those from startup
    or those explicitly set.  This is also used for the restricted mode
@@ -2475,6 +2607,9 @@ handle_tick (void)
   /* Need to check for expired cache entries.  */
   agent_cache_housekeeping ();
 
+  /* Do not delay the sync of batched key writes for too long.  */
+  agent_sync_key_directory ();
+
   /* Check whether the homedir is still available.  */
   if (!shutdown_pending
       && (!have_homedir_inotify || !reliable_homedir_inotify)
@@ -2495,6 +2630,8 @@ agent_sighup_action (void)
             "re-reading configuration and flushing cache\n");
 
   agent_flush_cache (0);
+  agent_flush_key_file_cache ();
+  ssh_flush_identity_cache ();
   reread_configuration ();
   agent_reload_trustlist ();
   /* We flush the module name cache so that after installing a
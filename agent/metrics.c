@@ -0,0 +1,170 @@
+/* metrics.c - Latency histograms and counters
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This module keeps a latency histogram for the main operations of
+ * the agent and for the phases of these operations as well as a few
+ * counters.  The data is returned by the METRICS command.
+ *
+ * The histograms use power-of-2 buckets: bucket I counts the
+ * durations below 2^I microseconds which did not fit into bucket I-1;
+ * the last bucket counts all larger durations.
+ *
+ * Under the non-preemptive thread model no lock is required as long
+ * as the updates do not call a function which may yield.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "agent.h"
+
+#define METRICS_BUCKETS 24  /* That is up to about 8 seconds.  */
+
+struct metric_s
+{
+  unsigned long count;
+  uint64_t total;  /* In microseconds.  */
+  uint64_t max;    /* Ditto.  */
+  unsigned long buckets[METRICS_BUCKETS];
+};
+
+/* The names of the metrics.  Must match enum agent_metric.  */
+static const char * const metric_names[METRIC_LAST] =
+  {
+    "pksign",
+    "pkdecrypt",
+    "get-passphrase",
+    "ssh-request-identities",
+    "ssh-sign",
+    "ssh-other",
+    "read-key",
+    "unprotect",
+    "scd",
+    "pinentry"
+  };
+
+/* The names of the counters.  Must match enum agent_counter.  */
+static const char * const counter_names[COUNTER_LAST] =
+  {
+    "cache-hit",
+    "cache-miss",
+    "keyfile-cache-hit",
+    "keyfile-cache-miss",
+    "kek-cache-hit",
+    "kek-cache-miss"
+  };
+
+static struct metric_s metrics[METRIC_LAST];
+static unsigned long counters[COUNTER_LAST];
+
+/* The time the metrics were last reset.  */
+static time_t metrics_since;
+
+
+/* Return a timestamp in microseconds to be passed to
+ * agent_metric_stop.  */
+uint64_t
+agent_metric_start (void)
+{
+  struct timespec ts;
+
+  npth_clock_gettime (&ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* Record the time since START for METRIC.  */
+void
+agent_metric_stop (enum agent_metric metric, uint64_t start)
+{
+  struct metric_s *m;
+  uint64_t now, usec;
+  int i;
+
+  if (metric < 0 || metric >= METRIC_LAST || !start)
+    return;
+
+  now = agent_metric_start ();
+  usec = now > start? now - start : 0;  /* The clock may go back.  */
+
+  m = metrics + metric;
+  m->count++;
+  m->total += usec;
+  if (usec > m->max)
+    m->max = usec;
+  for (i=0; i < METRICS_BUCKETS - 1 && (usec >> i); i++)
+    ;
+  m->buckets[i]++;
+}
+
+
+/* Bump the counter CNT.  */
+void
+agent_count (enum agent_counter cnt)
+{
+  if (cnt >= 0 && cnt < COUNTER_LAST)
+    counters[cnt]++;
+}
+
+
+/* Reset all metrics and counters.  */
+void
+agent_reset_metrics (void)
+{
+  memset (metrics, 0, sizeof metrics);
+  memset (counters, 0, sizeof counters);
+  metrics_since = gnupg_get_time ();
+}
+
+
+/* Put a description of the metrics into MB.  The format uses colon
+ * delimited lines similar to gpgconf:
+ *
+ *   since:<time>:
+ *   metric:<name>:<count>:<total>:<max>:<b0>,<b1>,...:
+ *   counter:<name>:<value>:
+ *
+ * TIME is the time in seconds since Epoch the metrics were last
+ * reset.  TOTAL and MAX are given in microseconds.  The bucket values
+ * are described above.  */
+void
+agent_format_metrics (membuf_t *mb)
+{
+  struct metric_s *m;
+  int i, j;
+
+  put_membuf_printf (mb, "since:%lu:\n", (unsigned long)metrics_since);
+  for (i=0; i < METRIC_LAST; i++)
+    {
+      m = metrics + i;
+      put_membuf_printf (mb, "metric:%s:%lu:%llu:%llu:",
+                         metric_names[i], m->count,
+                         (unsigned long long)m->total,
+                         (unsigned long long)m->max);
+      for (j=0; j < METRICS_BUCKETS; j++)
+        put_membuf_printf (mb, "%s%lu", j? ",":"", m->buckets[j]);
+      put_membuf_str (mb, ":\n");
+    }
+  for (i=0; i < COUNTER_LAST; i++)
+    put_membuf_printf (mb, "counter:%s:%lu:\n", counter_names[i], counters[i]);
+}
@@ -772,6 +772,25 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
   return NULL;
 }
 
+int
+agent_get_kek_cache (const unsigned char *tag,
+                     unsigned char *key, size_t keylen)
+{
+  (void)tag;
+  (void)key;
+  (void)keylen;
+  return 0;  /* Not cached.  */
+}
+
+void
+agent_put_kek_cache (const unsigned char *tag,
+                     const unsigned char *key, size_t keylen)
+{
+  (void)tag;
+  (void)key;
+  (void)keylen;
+}
+
 gpg_error_t
 agent_askpin (ctrl_t ctrl,
               const char *desc_text, const char *prompt_text,
@@ -841,3 +860,13 @@ agent_write_private_key (const unsigned char *grip,
 
   return 0;
 }
+
+
+#if GCRYPT_VERSION_NUMBER >= 0x010a00
+/* Stub function.  */
+gpg_error_t
+agent_kdf_compute (gcry_kdf_hd_t hd)
+{
+  return gcry_kdf_compute (hd, NULL);
+}
+#endif
@@ -35,6 +35,7 @@
 # include <windows.h>
 #else
 # include <sys/times.h>
+# include <sys/utsname.h>
 #endif
 
 #include "agent.h"
@@ -50,6 +51,32 @@
 #define PROT_CIPHER_STRING "aes"
 #define PROT_CIPHER_KEYLEN (128/8)
 
+/* The protection mode used with Argon2.  Argon2 is only available
+ * since Libgcrypt 1.10.  */
+#if GCRYPT_VERSION_NUMBER >= 0x010a00
+# define USE_ARGON2 1
+#endif
+#define PROT_ARGON2_STRING "argon2id-ocb-aes"
+#define ARGON2_SALTLEN     16
+#define ARGON2_MAX_PASSES  64
+
+/* The name of the file in the home directory used to store the
+ * results of the calibration.  */
+#define S2K_CALIBRATION_FILE "s2k-calibration"
+
+
+/* The parameters of the key derivation function.  */
+struct kdf_parm_s
+{
+  int algo;                   /* GCRY_KDF_ITERSALTED_S2K or
+                               * GCRY_KDF_ARGON2.  */
+  const unsigned char *salt;
+  size_t saltlen;             /* 8 for S2K and 16 for Argon2.  */
+  unsigned long count;        /* The S2K count or the Argon2 passes.  */
+  unsigned long memory;       /* The Argon2 memory in KiB.  */
+  unsigned long lanes;        /* The Argon2 parallelism.  */
+};
+
 
 /* A table containing the information needed to create a protected
    private key.  */
@@ -75,6 +102,14 @@ static const struct {
 static unsigned int s2k_calibration_time = AGENT_S2K_CALIBRATION;
 static unsigned long s2k_calibrated_count;
 
+/* The Argon2 passes calibrated for the given memory and lanes.  */
+static unsigned long argon2_calibrated_passes;
+static unsigned long argon2_calibrated_memory;
+static unsigned long argon2_calibrated_lanes;
+
+/* If set the calibration results are stored in S2K_CALIBRATION_FILE.  */
+static int use_calibration_file;
+
 
 /* A helper object for time measurement.  */
 struct calibrate_time_s
@@ -92,6 +127,17 @@ hash_passphrase (const char *passphrase, int hashalgo,
                  int s2kmode,
                  const unsigned char *s2ksalt, unsigned long s2kcount,
                  unsigned char *key, size_t keylen);
+#ifdef USE_ARGON2
+static gpg_error_t
+argon2_passphrase (const char *passphrase,
+                   const unsigned char *salt, size_t saltlen,
+                   unsigned long passes, unsigned long memory,
+                   unsigned long lanes,
+                   unsigned char *key, size_t keylen);
+#endif /*USE_ARGON2*/
+static gpg_error_t
+kdf_derive (const char *passphrase, const struct kdf_parm_s *kdf,
+            unsigned char *key, size_t keylen);
 
 
 
@@ -182,6 +228,134 @@ calibrate_s2k_count_one (unsigned long count)
 }
 
 
+/* Return the key used to store a calibration result of type KIND in
+ * the calibration file.  The key includes all values which have an
+ * effect on the result.  For Argon2 MEMORY and LANES are used.
+ * Returns NULL on error.  */
+static char *
+calibration_key (const char *kind, unsigned long memory, unsigned long lanes)
+{
+  const char *nodename = "localhost";
+#ifndef HAVE_W32_SYSTEM
+  struct utsname utsbuf;
+
+  if (!uname (&utsbuf) && *utsbuf.nodename)
+    nodename = utsbuf.nodename;
+#endif /*!HAVE_W32_SYSTEM*/
+
+  if (!strcmp (kind, "argon2"))
+    return xtryasprintf ("%s %s %s %u %lu %lu", kind, nodename,
+                         gcry_check_version (NULL), s2k_calibration_time,
+                         memory, lanes);
+  return xtryasprintf ("%s %s %s %u", kind, nodename,
+                       gcry_check_version (NULL), s2k_calibration_time);
+}
+
+
+/* Return the value stored for KEY in the calibration file or 0 if
+ * there is none.  Each line of the file has the KEY (as returned by
+ * calibration_key) followed by a space and the value.  */
+static unsigned long
+read_calibration (const char *key)
+{
+  char *fname;
+  estream_t fp;
+  char line[256];
+  size_t keylen = strlen (key);
+  unsigned long value = 0;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  if (!fname)
+    return 0;
+  fp = es_fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return 0;
+
+  while (es_fgets (line, sizeof line, fp))
+    if (!strncmp (line, key, keylen) && line[keylen] == ' ')
+      {
+        value = strtoul (line + keylen + 1, NULL, 10);
+        break;
+      }
+  es_fclose (fp);
+  return value;
+}
+
+
+/* Store VALUE for KEY in the calibration file.  Errors are only
+ * logged.  */
+static void
+write_calibration (const char *key, unsigned long value)
+{
+  static int writing;
+  gpg_error_t err;
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  estream_t fp = NULL;
+  estream_t outfp = NULL;
+  char line[256];
+  size_t keylen = strlen (key);
+
+  /* Do not let a second thread write the temporary file at the same
+   * time; the result will be written the next time.  */
+  if (writing)
+    return;
+  writing = 1;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  if (fname)
+    tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  outfp = es_fopen (tmpfname, "w,mode=-rw");
+  if (!outfp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_fputs ("# Results of the S2K calibration done by gpg-agent.\n"
+            "# This file is re-created as needed.\n", outfp);
+
+  /* Copy all other entries.  */
+  fp = es_fopen (fname, "r");
+  if (fp)
+    {
+      while (es_fgets (line, sizeof line, fp))
+        if (*line != '#' && strchr (line, '\n')
+            && !(!strncmp (line, key, keylen) && line[keylen] == ' '))
+          es_fputs (line, outfp);
+      es_fclose (fp);
+      fp = NULL;
+    }
+  es_fprintf (outfp, "%s %lu\n", key, value);
+
+  if (es_fclose (outfp))
+    {
+      outfp = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  outfp = NULL;
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+
+ leave:
+  if (err)
+    log_info ("error writing '%s': %s\n",
+              tmpfname? tmpfname : S2K_CALIBRATION_FILE, gpg_strerror (err));
+  es_fclose (outfp);
+  if (err && tmpfname)
+    gnupg_remove (tmpfname);
+  xfree (tmpfname);
+  xfree (fname);
+  writing = 0;
+}
+
+
 /* Measure the time we need to do the hash operations and deduce an
    S2K count which requires roughly some targeted amount of time.  */
 static unsigned long
@@ -215,6 +389,66 @@ calibrate_s2k_count (void)
 }
 
 
+#ifdef USE_ARGON2
+/* Run a test Argon2 computation with PASSES and the current memory
+ * and lanes parameters and return the time required in
+ * milliseconds.  */
+static unsigned long
+calibrate_argon2_one (unsigned long passes)
+{
+  gpg_error_t err;
+  unsigned char keybuf[PROT_CIPHER_KEYLEN];
+  struct calibrate_time_s starttime;
+
+  calibrate_get_time (&starttime);
+  err = argon2_passphrase ("123456789abcdef0",
+                           "saltsaltsaltsalt", ARGON2_SALTLEN,
+                           passes, opt.s2k_argon2_memory, opt.s2k_argon2_lanes,
+                           keybuf, sizeof keybuf);
+  if (err)
+    log_fatal ("Argon2 calibration failed: %s\n", gpg_strerror (err));
+  return calibrate_elapsed_time (&starttime);
+}
+
+
+/* Deduce the number of Argon2 passes which require roughly the
+ * targeted amount of time with the configured memory and lanes.  */
+static unsigned long
+calibrate_argon2_passes (void)
+{
+  unsigned long passes;
+  unsigned long ms;
+
+  ms = calibrate_argon2_one (1);
+  if (opt.verbose > 1)
+    log_info ("Argon2 calibration: 1 -> %lums\n", ms);
+  passes = ms? s2k_calibration_time / ms : ARGON2_MAX_PASSES;
+  if (passes < 1)
+    passes = 1;
+  else if (passes > ARGON2_MAX_PASSES)
+    passes = ARGON2_MAX_PASSES;
+
+  if (opt.verbose)
+    {
+      ms = calibrate_argon2_one (passes);
+      log_info ("Argon2 calibration: %lu -> %lums\n", passes, ms);
+    }
+
+  return passes;
+}
+#endif /*USE_ARGON2*/
+
+
+/* Store the calibration results in a file in the home directory so
+ * that the calibration needs to be done only once per host.  This is
+ * only called by gpg-agent.  */
+void
+enable_s2k_calibration_file (void)
+{
+  use_calibration_file = 1;
+}
+
+
 /* Set the calibration time.  This may be called early at startup or
  * at any time.  Thus it should one set variables.  */
 void
@@ -226,6 +460,7 @@ set_s2k_calibration_time (unsigned int milliseconds)
     milliseconds = 60 * 1000;  /* Cap at 60 seconds.  */
   s2k_calibration_time = milliseconds;
   s2k_calibrated_count = 0;  /* Force re-calibration.  */
+  argon2_calibrated_passes = 0;
 }
 
 
@@ -234,14 +469,63 @@ set_s2k_calibration_time (unsigned int milliseconds)
 unsigned long
 get_calibrated_s2k_count (void)
 {
+  char *key;
+
   if (!s2k_calibrated_count)
-    s2k_calibrated_count = calibrate_s2k_count ();
+    {
+      key = use_calibration_file? calibration_key ("s2k", 0, 0) : NULL;
+      if (key)
+        s2k_calibrated_count = read_calibration (key);
+      if (!s2k_calibrated_count)
+        {
+          s2k_calibrated_count = calibrate_s2k_count ();
+          if (key)
+            write_calibration (key, s2k_calibrated_count);
+        }
+      xfree (key);
+    }
 
   /* Enforce a lower limit.  */
   return s2k_calibrated_count < 65536 ? 65536 : s2k_calibrated_count;
 }
 
 
+#ifdef USE_ARGON2
+/* Return the calibrated number of Argon2 passes for the configured
+ * memory and lanes.  */
+static unsigned long
+get_calibrated_argon2_passes (void)
+{
+  char *key;
+
+  if (!argon2_calibrated_passes
+      || argon2_calibrated_memory != opt.s2k_argon2_memory
+      || argon2_calibrated_lanes != opt.s2k_argon2_lanes)
+    {
+      argon2_calibrated_passes = 0;
+      key = use_calibration_file? calibration_key ("argon2",
+                                                   opt.s2k_argon2_memory,
+                                                   opt.s2k_argon2_lanes)
+        /**/                    : NULL;
+      if (key)
+        argon2_calibrated_passes = read_calibration (key);
+      if (!argon2_calibrated_passes
+          || argon2_calibrated_passes > ARGON2_MAX_PASSES)
+        {
+          argon2_calibrated_passes = calibrate_argon2_passes ();
+          if (key)
+            write_calibration (key, argon2_calibrated_passes);
+        }
+      xfree (key);
+      argon2_calibrated_memory = opt.s2k_argon2_memory;
+      argon2_calibrated_lanes = opt.s2k_argon2_lanes;
+    }
+
+  return argon2_calibrated_passes;
+}
+#endif /*USE_ARGON2*/
+
+
 /* Return the standard S2K count.  */
 unsigned long
 get_standard_s2k_count (void)
@@ -388,6 +672,7 @@ do_encryption (const unsigned char *hashbegin, size_t hashlen,
   unsigned char *iv = NULL;
   unsigned int ivsize;  /* Size of the buffer allocated for IV.  */
   const unsigned char *s2ksalt; /* Points into IV.  */
+  struct kdf_parm_s kdf;
   int rc;
   char *outbuf = NULL;
   char *p;
@@ -398,8 +683,31 @@ do_encryption (const unsigned char *hashbegin, size_t hashlen,
   *resultlen = 0;
   *result = NULL;
 
-  modestr = (use_ocb? "openpgp-s2k3-ocb-aes"
-             /*   */: "openpgp-s2k3-sha1-" PROT_CIPHER_STRING "-cbc");
+  memset (&kdf, 0, sizeof kdf);
+#ifdef USE_ARGON2
+  if (use_ocb && !s2k_count && opt.s2k_argon2)
+    {
+      kdf.algo = GCRY_KDF_ARGON2;
+      kdf.saltlen = ARGON2_SALTLEN;
+      kdf.count = get_calibrated_argon2_passes ();
+      kdf.memory = opt.s2k_argon2_memory;
+      kdf.lanes = opt.s2k_argon2_lanes;
+    }
+  else
+#endif /*USE_ARGON2*/
+    {
+      kdf.algo = GCRY_KDF_ITERSALTED_S2K;
+      kdf.saltlen = 8;
+      kdf.count = s2k_count? s2k_count : get_standard_s2k_count ();
+    }
+
+#ifdef USE_ARGON2
+  if (kdf.algo == GCRY_KDF_ARGON2)
+    modestr = PROT_ARGON2_STRING;
+  else
+#endif /*USE_ARGON2*/
+    modestr = (use_ocb? "openpgp-s2k3-ocb-aes"
+               /*   */: "openpgp-s2k3-sha1-" PROT_CIPHER_STRING "-cbc");
 
   rc = gcry_cipher_open (&hd, PROT_CIPHER,
                          use_ocb? GCRY_CIPHER_MODE_OCB :
@@ -448,14 +756,15 @@ do_encryption (const unsigned char *hashbegin, size_t hashlen,
       /* Allocate random bytes to be used as IV, padding and s2k salt
        * or in OCB mode for a nonce and the s2k salt.  The IV/nonce is
        * set later because for OCB we need to set the key first.  */
-      ivsize = (use_ocb? 12 : (blklen*2)) + 8;
+      ivsize = (use_ocb? 12 : (blklen*2)) + kdf.saltlen;
       iv = xtrymalloc (ivsize);
       if (!iv)
         rc = gpg_error_from_syserror ();
       else
         {
           gcry_create_nonce (iv, ivsize);
-          s2ksalt = iv + ivsize - 8;
+          s2ksalt = iv + ivsize - kdf.saltlen;
+          kdf.salt = s2ksalt;
         }
     }
 
@@ -470,10 +779,7 @@ do_encryption (const unsigned char *hashbegin, size_t hashlen,
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, s2ksalt,
-				s2k_count? s2k_count:get_standard_s2k_count(),
-				key, keylen);
+          rc = kdf_derive (passphrase, &kdf, key, keylen);
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, keylen);
           xfree (key);
@@ -572,20 +878,46 @@ do_encryption (const unsigned char *hashbegin, size_t hashlen,
        ((sha1 salt no_of_iterations) 16byte_iv)
        encrypted_octet_string)
 
+     or with Argon2
+
+     (protected argon2id-ocb-aes
+       ((argon2id salt passes memory lanes) 12byte_nonce)
+       encrypted_octet_string)
+
      in canoncical format of course.  We use asprintf and %n modifier
      and dummy values as placeholders.  */
   {
     char countbuf[35];
 
-    snprintf (countbuf, sizeof countbuf, "%lu",
-	    s2k_count ? s2k_count : get_standard_s2k_count ());
-    p = xtryasprintf
-      ("(9:protected%d:%s((4:sha18:%n_8bytes_%u:%s)%d:%n%*s)%d:%n%*s)",
-       (int)strlen (modestr), modestr,
-       &saltpos,
-       (unsigned int)strlen (countbuf), countbuf,
-       use_ocb? 12 : blklen, &ivpos, use_ocb? 12 : blklen, "",
-       enclen, &encpos, enclen, "");
+    snprintf (countbuf, sizeof countbuf, "%lu", kdf.count);
+#ifdef USE_ARGON2
+    if (kdf.algo == GCRY_KDF_ARGON2)
+      {
+        char memorybuf[35];
+        char lanesbuf[35];
+
+        snprintf (memorybuf, sizeof memorybuf, "%lu", kdf.memory);
+        snprintf (lanesbuf, sizeof lanesbuf, "%lu", kdf.lanes);
+        p = xtryasprintf
+          ("(9:protected%d:%s((8:argon2id%d:%n%*s%u:%s%u:%s%u:%s)"
+           "12:%n%*s)%d:%n%*s)",
+           (int)strlen (modestr), modestr,
+           (int)kdf.saltlen, &saltpos, (int)kdf.saltlen, "",
+           (unsigned int)strlen (countbuf), countbuf,
+           (unsigned int)strlen (memorybuf), memorybuf,
+           (unsigned int)strlen (lanesbuf), lanesbuf,
+           &ivpos, 12, "",
+           enclen, &encpos, enclen, "");
+      }
+    else
+#endif /*USE_ARGON2*/
+      p = xtryasprintf
+        ("(9:protected%d:%s((4:sha18:%n_8bytes_%u:%s)%d:%n%*s)%d:%n%*s)",
+         (int)strlen (modestr), modestr,
+         &saltpos,
+         (unsigned int)strlen (countbuf), countbuf,
+         use_ocb? 12 : blklen, &ivpos, use_ocb? 12 : blklen, "",
+         enclen, &encpos, enclen, "");
     if (!p)
       {
         gpg_error_t tmperr = out_of_core ();
@@ -597,7 +929,7 @@ do_encryption (const unsigned char *hashbegin, size_t hashlen,
   }
   *resultlen = strlen (p);
   *result = (unsigned char*)p;
-  memcpy (p+saltpos, s2ksalt, 8);
+  memcpy (p+saltpos, s2ksalt, kdf.saltlen);
   memcpy (p+ivpos, iv, use_ocb? 12 : blklen);
   memcpy (p+encpos, outbuf, enclen);
   xfree (iv);
@@ -638,7 +970,7 @@ agent_protect (const unsigned char *plainkey, const char *passphrase,
   int have_curve = 0;
 
   if (use_ocb == -1)
-    use_ocb = !!opt.enable_extended_key_format;
+    use_ocb = opt.enable_extended_key_format || opt.s2k_argon2;
 
   /* Create an S-expression with the protected-at timestamp.  */
   memcpy (timestamp_exp, "(12:protected-at15:", 19);
@@ -783,13 +1115,114 @@ agent_protect (const unsigned char *plainkey, const char *passphrase,
 
 
 
+/* The HMAC key used to compute the tags for the KEK cache (see
+ * agent_get_kek_cache).  In secure memory.  */
+static unsigned char *kek_cache_hmackey;
+
+
+/* Compute the tag for the KEK cache into TAG.  */
+static gpg_error_t
+kek_cache_tag (const char *passphrase, const struct kdf_parm_s *kdf,
+               size_t keylen, unsigned char *tag)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  unsigned char buf[1+3*4];
+
+  if (!kek_cache_hmackey)
+    {
+      kek_cache_hmackey = gcry_random_bytes_secure (32, GCRY_STRONG_RANDOM);
+      if (!kek_cache_hmackey)
+        return gpg_error_from_syserror ();
+    }
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256,
+                      GCRY_MD_FLAG_HMAC | GCRY_MD_FLAG_SECURE);
+  if (!err)
+    err = gcry_md_setkey (md, kek_cache_hmackey, 32);
+  if (err)
+    {
+      gcry_md_close (md);
+      return err;
+    }
+  buf[0]  = kdf->algo;
+  buf[1]  = kdf->count >> 24;
+  buf[2]  = kdf->count >> 16;
+  buf[3]  = kdf->count >> 8;
+  buf[4]  = kdf->count;
+  buf[5]  = kdf->memory >> 24;
+  buf[6]  = kdf->memory >> 16;
+  buf[7]  = kdf->memory >> 8;
+  buf[8]  = kdf->memory;
+  buf[9]  = kdf->lanes >> 24;
+  buf[10] = kdf->lanes >> 16;
+  buf[11] = kdf->lanes >> 8;
+  buf[12] = kdf->lanes;
+  gcry_md_write (md, buf, sizeof buf);
+  gcry_md_putc (md, kdf->saltlen);
+  gcry_md_write (md, kdf->salt, kdf->saltlen);
+  gcry_md_putc (md, keylen);
+  gcry_md_write (md, passphrase, strlen (passphrase));
+  memcpy (tag, gcry_md_read (md, GCRY_MD_SHA256), 32);
+  gcry_md_close (md);
+  return 0;
+}
+
+
+/* Derive the key of length KEYLEN from PASSPHRASE using the
+ * parameters KDF and store it at KEY.  */
+static gpg_error_t
+kdf_derive (const char *passphrase, const struct kdf_parm_s *kdf,
+            unsigned char *key, size_t keylen)
+{
+#ifdef USE_ARGON2
+  if (kdf->algo == GCRY_KDF_ARGON2)
+    return argon2_passphrase (passphrase, kdf->salt, kdf->saltlen,
+                              kdf->count, kdf->memory, kdf->lanes,
+                              key, keylen);
+#else /*!USE_ARGON2*/
+  if (kdf->algo != GCRY_KDF_ITERSALTED_S2K)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!USE_ARGON2*/
+  return hash_passphrase (passphrase, GCRY_MD_SHA1, 3, kdf->salt, kdf->count,
+                          key, keylen);
+}
+
+
+/* Same as kdf_derive but first look into the KEK cache.  The cache
+ * is identified by an HMAC over the passphrase and the KDF parameters
+ * using a per-process random key; the passphrase itself is not
+ * stored.  */
+static gpg_error_t
+derive_kek (const char *passphrase, const struct kdf_parm_s *kdf,
+            unsigned char *key, size_t keylen)
+{
+  gpg_error_t err;
+  unsigned char tag[32];
+
+  if (!passphrase || !*passphrase
+      || kek_cache_tag (passphrase, kdf, keylen, tag))
+    return kdf_derive (passphrase, kdf, key, keylen);
+
+  if (agent_get_kek_cache (tag, key, keylen))
+    err = 0;
+  else
+    {
+      err = kdf_derive (passphrase, kdf, key, keylen);
+      if (!err)
+        agent_put_kek_cache (tag, key, keylen);
+    }
+  wipememory (tag, sizeof tag);
+  return err;
+}
+
+
 /* Do the actual decryption and check the return list for consistency.  */
 static gpg_error_t
 do_decryption (const unsigned char *aad_begin, size_t aad_len,
                const unsigned char *aadhole_begin, size_t aadhole_len,
                const unsigned char *protected, size_t protectedlen,
-               const char *passphrase,
-               const unsigned char *s2ksalt, unsigned long s2kcount,
+               const char *passphrase, const struct kdf_parm_s *kdf,
                const unsigned char *iv, size_t ivlen,
                int prot_cipher, int prot_cipher_keylen, int is_ocb,
                unsigned char **result)
@@ -836,8 +1269,7 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, s2ksalt, s2kcount, key, prot_cipher_keylen);
+          rc = derive_kek (passphrase, kdf, key, prot_cipher_keylen);
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, prot_cipher_keylen);
           xfree (key);
@@ -1072,6 +1504,69 @@ merge_lists (const unsigned char *protectedkey,
 
 
 
+/* Parse the Argon2 parameters of a protected key.  *SP points to
+ * the name of the KDF with length N; on success *SP is updated to
+ * point to the closing parenthesis of the parameter list and KDF is
+ * filled.  Note that KDF->SALT points into the parsed buffer.  */
+static gpg_error_t
+parse_argon2_parms (const unsigned char **sp, size_t n,
+                    struct kdf_parm_s *kdf)
+{
+#ifdef USE_ARGON2
+  const unsigned char *s = *sp;
+  unsigned long *values[3];
+  int i;
+  size_t j;
+
+  if (!smatch (&s, n, "argon2id"))
+    return gpg_error (GPG_ERR_UNSUPPORTED_PROTECTION);
+  n = snext (&s);
+  if (n != ARGON2_SALTLEN)
+    return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
+  kdf->algo = GCRY_KDF_ARGON2;
+  kdf->salt = s;
+  kdf->saltlen = n;
+  s += n;
+
+  values[0] = &kdf->count;
+  values[1] = &kdf->memory;
+  values[2] = &kdf->lanes;
+  for (i=0; i < DIM (values); i++)
+    {
+      n = snext (&s);
+      if (!n || n > 9)
+        return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
+      /* Note that we can't use strtoul because the next atom directly
+       * follows the value.  */
+      *values[i] = 0;
+      for (j=0; j < n; j++, s++)
+        {
+          if (!digitp (s))
+            return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
+          *values[i] = *values[i] * 10 + atoi_1 (s);
+        }
+    }
+  if (*s != ')')
+    return gpg_error (GPG_ERR_INV_SEXP);
+
+  /* Do not allow values which would let us run for a very long time
+   * or take all memory.  */
+  if (!kdf->count || kdf->count > ARGON2_MAX_PASSES
+      || !kdf->lanes || kdf->lanes > 64
+      || kdf->memory < 8 * kdf->lanes || kdf->memory > 4*1024*1024)
+    return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
+
+  *sp = s;
+  return 0;
+#else /*!USE_ARGON2*/
+  (void)sp;
+  (void)n;
+  (void)kdf;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!USE_ARGON2*/
+}
+
+
 /* Unprotect the key encoded in canonical format.  We assume a valid
    S-Exp here.  If a protected-at item is available, its value will
    be stored at protected_at unless this is NULL.  */
@@ -1086,10 +1581,12 @@ agent_unprotect (ctrl_t ctrl,
     int algo;         /* (A zero indicates the "openpgp-native" hack.)  */
     int keylen;       /* Used key length in bytes.  */
     unsigned int is_ocb:1;
+    unsigned int is_argon2:1;
   } algotable[] = {
     { "openpgp-s2k3-sha1-aes-cbc",    GCRY_CIPHER_AES128, (128/8)},
     { "openpgp-s2k3-sha1-aes256-cbc", GCRY_CIPHER_AES256, (256/8)},
     { "openpgp-s2k3-ocb-aes",         GCRY_CIPHER_AES128, (128/8), 1},
+    { PROT_ARGON2_STRING,             GCRY_CIPHER_AES128, (128/8), 1, 1},
     { "openpgp-native", 0, 0 }
   };
   int rc;
@@ -1098,11 +1595,10 @@ agent_unprotect (ctrl_t ctrl,
   size_t n;
   int infidx, i;
   unsigned char sha1hash[20], sha1hash2[20];
-  const unsigned char *s2ksalt;
-  unsigned long s2kcount;
+  struct kdf_parm_s kdf;
   const unsigned char *iv;
   int prot_cipher, prot_cipher_keylen;
-  int is_ocb;
+  int is_ocb, is_argon2;
   const unsigned char *aad_begin, *aad_end, *aadhole_begin, *aadhole_end;
   const unsigned char *prot_begin;
   unsigned char *cleartext;
@@ -1214,13 +1710,14 @@ agent_unprotect (ctrl_t ctrl,
   /* Lookup the protection algo.  */
   prot_cipher = 0;        /* (avoid gcc warning) */
   prot_cipher_keylen = 0; /* (avoid gcc warning) */
-  is_ocb = 0;
+  is_ocb = is_argon2 = 0;
   for (i=0; i < DIM (algotable); i++)
     if (smatch (&s, n, algotable[i].name))
       {
         prot_cipher = algotable[i].algo;
         prot_cipher_keylen = algotable[i].keylen;
         is_ocb = algotable[i].is_ocb;
+        is_argon2 = algotable[i].is_argon2;
         break;
       }
   if (i == DIM (algotable))
@@ -1252,12 +1749,22 @@ agent_unprotect (ctrl_t ctrl,
   n = snext (&s);
   if (!n)
     return gpg_error (GPG_ERR_INV_SEXP);
+  memset (&kdf, 0, sizeof kdf);
+  if (is_argon2)
+    {
+      rc = parse_argon2_parms (&s, n, &kdf);
+      if (rc)
+        return rc;
+      goto parms_done;
+    }
   if (!smatch (&s, n, "sha1"))
     return gpg_error (GPG_ERR_UNSUPPORTED_PROTECTION);
   n = snext (&s);
   if (n != 8)
     return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
-  s2ksalt = s;
+  kdf.algo = GCRY_KDF_ITERSALTED_S2K;
+  kdf.salt = s;
+  kdf.saltlen = n;
   s += n;
   n = snext (&s);
   if (!n)
@@ -1276,15 +1783,16 @@ agent_unprotect (ctrl_t ctrl,
      plain integers.  In any case we check that they are at least
      65536 because we never used a lower value in the past and we
      should have a lower limit.  */
-  s2kcount = strtoul ((const char*)s, NULL, 10);
-  if (!s2kcount)
+  kdf.count = strtoul ((const char*)s, NULL, 10);
+  if (!kdf.count)
     return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
-  if (s2kcount < 256)
-    s2kcount = (16ul + (s2kcount & 15)) << ((s2kcount >> 4) + 6);
-  if (s2kcount < 65536)
+  if (kdf.count < 256)
+    kdf.count = (16ul + (kdf.count & 15)) << ((kdf.count >> 4) + 6);
+  if (kdf.count < 65536)
     return gpg_error (GPG_ERR_CORRUPTED_PROTECTION);
 
   s += n;
+ parms_done:
   s++; /* skip list end */
 
   n = snext (&s);
@@ -1311,7 +1819,7 @@ agent_unprotect (ctrl_t ctrl,
   rc = do_decryption (aad_begin, aad_end - aad_begin,
                       aadhole_begin, aadhole_end - aadhole_begin,
                       s, n,
-                      passphrase, s2ksalt, s2kcount,
+                      passphrase, &kdf,
                       iv, is_ocb? 12:16,
                       prot_cipher, prot_cipher_keylen, is_ocb,
                       &cleartext);
@@ -1483,6 +1991,44 @@ hash_passphrase (const char *passphrase, int hashalgo,
 }
 
 
+#ifdef USE_ARGON2
+/* Transform PASSPHRASE into a key of length KEYLEN using Argon2id
+ * with the given SALT, number of PASSES, MEMORY in KiB and LANES and
+ * store it in the caller provided buffer KEY.  The actual computation
+ * is done by agent_kdf_compute which runs the lanes in parallel.  */
+static gpg_error_t
+argon2_passphrase (const char *passphrase,
+                   const unsigned char *salt, size_t saltlen,
+                   unsigned long passes, unsigned long memory,
+                   unsigned long lanes,
+                   unsigned char *key, size_t keylen)
+{
+  gpg_error_t err;
+  gcry_kdf_hd_t hd;
+  unsigned long param[4];
+
+  if (!passphrase || !*passphrase)
+    return gpg_error (GPG_ERR_NO_PASSPHRASE);
+
+  param[0] = keylen;
+  param[1] = passes;
+  param[2] = memory;
+  param[3] = lanes;
+  err = gcry_kdf_open (&hd, GCRY_KDF_ARGON2, GCRY_KDF_ARGON2ID,
+                       param, DIM (param),
+                       passphrase, strlen (passphrase),
+                       salt, saltlen, NULL, 0, NULL, 0);
+  if (err)
+    return err;
+  err = agent_kdf_compute (hd);
+  if (!err)
+    err = gcry_kdf_final (hd, keylen, key);
+  gcry_kdf_close (hd);
+  return err;
+}
+#endif /*USE_ARGON2*/
+
+
 gpg_error_t
 s2k_hash_passphrase (const char *passphrase, int hashalgo,
                      int s2kmode,
@@ -0,0 +1,354 @@
+/* t-cache.c - Module tests for cache.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+/* We need access to the cache items.  */
+#include "cache.c"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+
+/* Return the cache item for KEY.  */
+static ITEM
+find_item (const char *key)
+{
+  ITEM r;
+
+  for (r = thecache[hash_key (key)]; r; r = r->next)
+    if (!strcmp (r->key, key))
+      return r;
+  return NULL;
+}
+
+
+/* Check that a max-cache-ttl of 0 is not taken as "no limit".  */
+static void
+test_max_ttl_zero (void)
+{
+  time_t now = gnupg_get_time ();
+  ITEM r;
+  char *value;
+
+  gnupg_set_time (now, 1);
+  opt.max_cache_ttl = 0;
+
+  if (agent_put_cache (NULL, "t-cache-normal", CACHE_MODE_NORMAL, "abc", 600))
+    fail ();
+  r = find_item ("t-cache-normal");
+  if (!r || !r->pw)
+    fail ();
+  if (r->deadline != r->created + 1)
+    fail ();
+  if (!item_expired (r, r->created + 1))
+    fail ();
+
+  gnupg_set_time (now + 1, 1);
+  value = agent_get_cache (NULL, "t-cache-normal", CACHE_MODE_NORMAL);
+  if (value)
+    fail ();
+
+  /* DATA items have no max TTL at all.  */
+  if (agent_put_cache (NULL, "t-cache-data", CACHE_MODE_DATA, "abc", 600))
+    fail ();
+  r = find_item ("t-cache-data");
+  if (!r || item_expired (r, r->created + 1))
+    fail ();
+  if (r->deadline != r->created + 600 + 1)
+    fail ();
+
+  gnupg_set_time ((time_t)(-1), 0);
+}
+
+
+/* Check that the default max TTL limits the TTL.  */
+static void
+test_max_ttl (void)
+{
+  ITEM r;
+
+  opt.max_cache_ttl = 300;
+  if (agent_put_cache (NULL, "t-cache-max", CACHE_MODE_NORMAL, "abc", 600))
+    fail ();
+  r = find_item ("t-cache-max");
+  if (!r || item_expired (r, r->created + 300))
+    fail ();
+  if (!item_expired (r, r->created + 301))
+    fail ();
+}
+
+
+/* The number of keys used by test_many_keys.  This is larger than
+ * the hash table so that the buckets need to chain items.  */
+#define NKEYS 3000
+
+/* The TTL used for the Ith key of test_many_keys.  The deadlines
+ * span more than two rounds of the timer wheel.  */
+static int
+key_ttl (int i)
+{
+  return 1 + (i * 7) % 1100;
+}
+
+
+/* Check the hash buckets and return the number of items in the
+ * cache.  If R_CHAINED is not NULL the number of buckets with more
+ * than one item is stored there.  */
+static int
+check_buckets (int *r_chained)
+{
+  ITEM r;
+  int i, n, total, chained;
+
+  total = chained = 0;
+  for (i = 0; i < CACHE_HASH_SIZE; i++)
+    {
+      for (n = 0, r = thecache[i]; r; r = r->next, n++)
+        if (hash_key (r->key) != i)
+          fail ();
+      total += n;
+      if (n > 1)
+        chained++;
+    }
+  if (r_chained)
+    *r_chained = chained;
+  return total;
+}
+
+
+/* Check the links of the timer wheel and return the number of items
+ * in it.  */
+static int
+check_wheel (void)
+{
+  ITEM r;
+  ITEM *prevp;
+  int i, total;
+
+  total = 0;
+  for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+    for (prevp = timer_wheel + i; (r = *prevp); prevp = &r->wnext)
+      {
+        if (r->wprevp != prevp || !r->deadline)
+          fail ();
+        if (r->deadline > wheel_time && r->deadline % TIMER_WHEEL_SIZE != i)
+          fail ();
+        total++;
+      }
+  return total;
+}
+
+
+/* Remove all items from the cache by flushing it and running the
+ * housekeeping after the empty items are due.  Returns the faked
+ * time which is never before the time already processed.  */
+static time_t
+clear_cache (time_t now)
+{
+  agent_flush_cache (0);
+  if (now < wheel_time)
+    now = wheel_time;
+  now += 60*30 + 2 * TIMER_WHEEL_SIZE;
+  gnupg_set_time (now, 1);
+  agent_cache_housekeeping ();
+  if (check_buckets (NULL) || check_wheel ())
+    fail ();
+  return now;
+}
+
+
+/* Put, get and expire many keys spread over all buckets and many
+ * timer wheel slots.  */
+static void
+test_many_keys (void)
+{
+  time_t base;
+  char key[40], value[40];
+  char *p;
+  ITEM r;
+  int i, k, chained;
+
+  opt.max_cache_ttl = 7200;
+  base = clear_cache (gnupg_get_time ());
+
+  for (i = 0; i < NKEYS; i++)
+    {
+      snprintf (key, sizeof key, "t-cache-%d", i);
+      snprintf (value, sizeof value, "value-%d", i);
+      if (agent_put_cache (NULL, key, CACHE_MODE_NORMAL, value, key_ttl (i)))
+        fail ();
+    }
+  if (check_buckets (&chained) != NKEYS || !chained)
+    fail ();
+  if (check_wheel () != NKEYS)
+    fail ();
+
+  /* Replace every tenth value; this must not add items.  */
+  for (i = 0; i < NKEYS; i += 10)
+    {
+      snprintf (key, sizeof key, "t-cache-%d", i);
+      snprintf (value, sizeof value, "new-%d", i);
+      if (agent_put_cache (NULL, key, CACHE_MODE_NORMAL, value, key_ttl (i)))
+        fail ();
+    }
+  if (check_buckets (NULL) != NKEYS || check_wheel () != NKEYS)
+    fail ();
+
+  for (i = 0; i < NKEYS; i++)
+    {
+      snprintf (key, sizeof key, "t-cache-%d", i);
+      snprintf (value, sizeof value, (i % 10)? "value-%d" : "new-%d", i);
+      r = find_item (key);
+      if (!r || r->deadline != base + key_ttl (i) + 1)
+        fail ();
+      p = agent_get_cache (NULL, key, CACHE_MODE_NORMAL);
+      if (!p || strcmp (p, value))
+        fail ();
+      xfree (p);
+    }
+  if (agent_get_cache (NULL, "t-cache-none", CACHE_MODE_NORMAL))
+    fail ();
+
+  /* Advance the time second by second for more than a round of the
+   * wheel.  Exactly the items whose TTL passed must have expired.  */
+  for (k = 1; k <= TIMER_WHEEL_SIZE + 88; k++)
+    {
+      gnupg_set_time (base + k, 1);
+      agent_cache_housekeeping ();
+      for (i = 0; i < NKEYS; i++)
+        {
+          snprintf (key, sizeof key, "t-cache-%d", i);
+          r = find_item (key);
+          if (!r)
+            fail ();
+          if (key_ttl (i) + 1 <= k)
+            {
+              if (r->pw)
+                fail ();
+              if (!(i % 97)
+                  && agent_get_cache (NULL, key, CACHE_MODE_NORMAL))
+                fail ();
+            }
+          else if (!r->pw)
+            fail ();
+        }
+    }
+  if (check_buckets (NULL) != NKEYS || check_wheel () != NKEYS)
+    fail ();
+
+  /* Skip more than a full round; all slots must be processed.  */
+  k += 2 * TIMER_WHEEL_SIZE;
+  gnupg_set_time (base + k, 1);
+  agent_cache_housekeeping ();
+  for (i = 0; i < NKEYS; i++)
+    {
+      snprintf (key, sizeof key, "t-cache-%d", i);
+      r = find_item (key);
+      if (!r || r->pw)
+        fail ();
+    }
+  if (check_wheel () != NKEYS)
+    fail ();
+
+  /* The empty items are removed after 30 minutes.  */
+  gnupg_set_time (base + k + 60*30 + 1, 1);
+  agent_cache_housekeeping ();
+  if (check_buckets (NULL) || check_wheel ())
+    fail ();
+
+  gnupg_set_time ((time_t)(-1), 0);
+}
+
+
+/* Check that an access extends the lifetime although the item is not
+ * moved in the timer wheel.  */
+static void
+test_access (void)
+{
+  time_t base;
+  char *p;
+  ITEM r;
+
+  opt.max_cache_ttl = 7200;
+  base = clear_cache (gnupg_get_time ());
+
+  if (agent_put_cache (NULL, "t-cache-access", CACHE_MODE_NORMAL, "abc", 10))
+    fail ();
+  gnupg_set_time (base + 5, 1);
+  p = agent_get_cache (NULL, "t-cache-access", CACHE_MODE_NORMAL);
+  if (!p || strcmp (p, "abc"))
+    fail ();
+  xfree (p);
+  r = find_item ("t-cache-access");
+  if (!r || r->deadline != base + 11)
+    fail ();
+
+  gnupg_set_time (base + 15, 1);
+  agent_cache_housekeeping ();
+  r = find_item ("t-cache-access");
+  if (!r || !r->pw || r->deadline != base + 16)
+    fail ();
+
+  gnupg_set_time (base + 16, 1);
+  agent_cache_housekeeping ();
+  r = find_item ("t-cache-access");
+  if (!r || r->pw)
+    fail ();
+  if (agent_get_cache (NULL, "t-cache-access", CACHE_MODE_NORMAL))
+    fail ();
+
+  clear_cache (base + 16);
+  gnupg_set_time ((time_t)(-1), 0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argv;
+
+  opt.verbose = argc - 1;
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+  initialize_module_cache ();
+
+  test_max_ttl_zero ();
+  test_max_ttl ();
+  test_many_keys ();
+  test_access ();
+
+  agent_flush_cache (0);
+  return 0;
+}
+
+/* Stub function.  */
+void
+agent_count (enum agent_counter cnt)
+{
+  (void)cnt;
+}
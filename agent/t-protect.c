@@ -349,3 +349,34 @@ convert_from_openpgp_native (gcry_sexp_t s_pgp, const char *passphrase,
   (void)r_key;
   return gpg_error (GPG_ERR_BUG);
 }
+
+
+/* Stub functions for the KEK cache.  */
+int
+agent_get_kek_cache (const unsigned char *tag,
+                     unsigned char *key, size_t keylen)
+{
+  (void)tag;
+  (void)key;
+  (void)keylen;
+  return 0;
+}
+
+void
+agent_put_kek_cache (const unsigned char *tag,
+                     const unsigned char *key, size_t keylen)
+{
+  (void)tag;
+  (void)key;
+  (void)keylen;
+}
+
+
+#if GCRYPT_VERSION_NUMBER >= 0x010a00
+/* Stub function.  */
+gpg_error_t
+agent_kdf_compute (gcry_kdf_hd_t hd)
+{
+  return gcry_kdf_compute (hd, NULL);
+}
+#endif
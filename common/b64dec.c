@@ -106,6 +106,34 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
 
   for (s=d=buffer; length && !state->stop_seen; length--, s++)
     {
+      if (ds == s_b64_0)
+        {
+          /* Fast path: Decode complete groups of four valid
+             characters directly.  Anything else (white space, pad
+             characters, the END line) falls back to the FSM.  */
+          while (length >= 4)
+            {
+              const unsigned char *u = (const unsigned char *)s;
+              unsigned int c0, c1, c2, c3;
+
+              if (((u[0] | u[1] | u[2] | u[3]) & 0x80))
+                break;
+              c0 = asctobin[u[0]];
+              c1 = asctobin[u[1]];
+              c2 = asctobin[u[2]];
+              c3 = asctobin[u[3]];
+              if (((c0 | c1 | c2 | c3) & 0x80))
+                break;
+              *d++ = (unsigned char)((c0 << 2) | (c1 >> 4));
+              *d++ = (unsigned char)((c1 << 4) | (c2 >> 2));
+              *d++ = (unsigned char)((c2 << 6) | c3);
+              s += 4;
+              length -= 4;
+            }
+          if (!length)
+            break;
+        }
+
     again:
       switch (ds)
         {
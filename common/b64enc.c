@@ -138,6 +138,109 @@ static const u32 crc_table[256] = {
   0x56d11cce, 0x56575035, 0x575bc9c3, 0x57dd8538
 };
 
+/* To process three octets at once (which matches the grouping used by
+   the base-64 encoding) we use two more tables: crc_table_x[0][i] is
+   the CRC of the octet I followed by one zero octet and
+   crc_table_x[1][i] is the CRC of I followed by two zero octets.  They
+   have been derived from crc_table using
+
+     crc_table_x[0][i] = ((crc_table[i] << 8) & 0xffffff)
+                         ^ (crc_table[(crc_table[i] >> 16) & 0xff] & 0xffffff)
+
+   and likewise for crc_table_x[1] from crc_table_x[0].  */
+static const u32 crc_table_x[2][256] = {
+  {
+    0x00000000, 0x00668f48, 0x00cd1e90, 0x00ab91d8, 0x001c71db, 0x007afe93,
+    0x00d16f4b, 0x00b7e003, 0x0038e3b6, 0x005e6cfe, 0x00f5fd26, 0x0093726e,
+    0x0024926d, 0x00421d25, 0x00e98cfd, 0x008f03b5, 0x0071c76c, 0x00174824,
+    0x00bcd9fc, 0x00da56b4, 0x006db6b7, 0x000b39ff, 0x00a0a827, 0x00c6276f,
+    0x004924da, 0x002fab92, 0x00843a4a, 0x00e2b502, 0x00555501, 0x0033da49,
+    0x00984b91, 0x00fec4d9, 0x00e38ed8, 0x00850190, 0x002e9048, 0x00481f00,
+    0x00ffff03, 0x0099704b, 0x0032e193, 0x00546edb, 0x00db6d6e, 0x00bde226,
+    0x001673fe, 0x0070fcb6, 0x00c71cb5, 0x00a193fd, 0x000a0225, 0x006c8d6d,
+    0x009249b4, 0x00f4c6fc, 0x005f5724, 0x0039d86c, 0x008e386f, 0x00e8b727,
+    0x004326ff, 0x0025a9b7, 0x00aaaa02, 0x00cc254a, 0x0067b492, 0x00013bda,
+    0x00b6dbd9, 0x00d05491, 0x007bc549, 0x001d4a01, 0x0041514b, 0x0027de03,
+    0x008c4fdb, 0x00eac093, 0x005d2090, 0x003bafd8, 0x00903e00, 0x00f6b148,
+    0x0079b2fd, 0x001f3db5, 0x00b4ac6d, 0x00d22325, 0x0065c326, 0x00034c6e,
+    0x00a8ddb6, 0x00ce52fe, 0x00309627, 0x0056196f, 0x00fd88b7, 0x009b07ff,
+    0x002ce7fc, 0x004a68b4, 0x00e1f96c, 0x00877624, 0x00087591, 0x006efad9,
+    0x00c56b01, 0x00a3e449, 0x0014044a, 0x00728b02, 0x00d91ada, 0x00bf9592,
+    0x00a2df93, 0x00c450db, 0x006fc103, 0x00094e4b, 0x00beae48, 0x00d82100,
+    0x0073b0d8, 0x00153f90, 0x009a3c25, 0x00fcb36d, 0x005722b5, 0x0031adfd,
+    0x00864dfe, 0x00e0c2b6, 0x004b536e, 0x002ddc26, 0x00d318ff, 0x00b597b7,
+    0x001e066f, 0x00788927, 0x00cf6924, 0x00a9e66c, 0x000277b4, 0x0064f8fc,
+    0x00ebfb49, 0x008d7401, 0x0026e5d9, 0x00406a91, 0x00f78a92, 0x009105da,
+    0x003a9402, 0x005c1b4a, 0x0082a296, 0x00e42dde, 0x004fbc06, 0x0029334e,
+    0x009ed34d, 0x00f85c05, 0x0053cddd, 0x00354295, 0x00ba4120, 0x00dcce68,
+    0x00775fb0, 0x0011d0f8, 0x00a630fb, 0x00c0bfb3, 0x006b2e6b, 0x000da123,
+    0x00f365fa, 0x0095eab2, 0x003e7b6a, 0x0058f422, 0x00ef1421, 0x00899b69,
+    0x00220ab1, 0x004485f9, 0x00cb864c, 0x00ad0904, 0x000698dc, 0x00601794,
+    0x00d7f797, 0x00b178df, 0x001ae907, 0x007c664f, 0x00612c4e, 0x0007a306,
+    0x00ac32de, 0x00cabd96, 0x007d5d95, 0x001bd2dd, 0x00b04305, 0x00d6cc4d,
+    0x0059cff8, 0x003f40b0, 0x0094d168, 0x00f25e20, 0x0045be23, 0x0023316b,
+    0x0088a0b3, 0x00ee2ffb, 0x0010eb22, 0x0076646a, 0x00ddf5b2, 0x00bb7afa,
+    0x000c9af9, 0x006a15b1, 0x00c18469, 0x00a70b21, 0x00280894, 0x004e87dc,
+    0x00e51604, 0x0083994c, 0x0034794f, 0x0052f607, 0x00f967df, 0x009fe897,
+    0x00c3f3dd, 0x00a57c95, 0x000eed4d, 0x00686205, 0x00df8206, 0x00b90d4e,
+    0x00129c96, 0x007413de, 0x00fb106b, 0x009d9f23, 0x00360efb, 0x005081b3,
+    0x00e761b0, 0x0081eef8, 0x002a7f20, 0x004cf068, 0x00b234b1, 0x00d4bbf9,
+    0x007f2a21, 0x0019a569, 0x00ae456a, 0x00c8ca22, 0x00635bfa, 0x0005d4b2,
+    0x008ad707, 0x00ec584f, 0x0047c997, 0x002146df, 0x0096a6dc, 0x00f02994,
+    0x005bb84c, 0x003d3704, 0x00207d05, 0x0046f24d, 0x00ed6395, 0x008becdd,
+    0x003c0cde, 0x005a8396, 0x00f1124e, 0x00979d06, 0x00189eb3, 0x007e11fb,
+    0x00d58023, 0x00b30f6b, 0x0004ef68, 0x00626020, 0x00c9f1f8, 0x00af7eb0,
+    0x0051ba69, 0x00373521, 0x009ca4f9, 0x00fa2bb1, 0x004dcbb2, 0x002b44fa,
+    0x0080d522, 0x00e65a6a, 0x006959df, 0x000fd697, 0x00a4474f, 0x00c2c807,
+    0x00752804, 0x0013a74c, 0x00b83694, 0x00deb9dc
+  },
+  {
+    0x00000000, 0x008309d7, 0x00805f55, 0x00035682, 0x0086f251, 0x0005fb86,
+    0x0006ad04, 0x0085a4d3, 0x008ba859, 0x0008a18e, 0x000bf70c, 0x0088fedb,
+    0x000d5a08, 0x008e53df, 0x008d055d, 0x000e0c8a, 0x00911c49, 0x0012159e,
+    0x0011431c, 0x00924acb, 0x0017ee18, 0x0094e7cf, 0x0097b14d, 0x0014b89a,
+    0x001ab410, 0x0099bdc7, 0x009aeb45, 0x0019e292, 0x009c4641, 0x001f4f96,
+    0x001c1914, 0x009f10c3, 0x00a47469, 0x00277dbe, 0x00242b3c, 0x00a722eb,
+    0x00228638, 0x00a18fef, 0x00a2d96d, 0x0021d0ba, 0x002fdc30, 0x00acd5e7,
+    0x00af8365, 0x002c8ab2, 0x00a92e61, 0x002a27b6, 0x00297134, 0x00aa78e3,
+    0x00356820, 0x00b661f7, 0x00b53775, 0x00363ea2, 0x00b39a71, 0x003093a6,
+    0x0033c524, 0x00b0ccf3, 0x00bec079, 0x003dc9ae, 0x003e9f2c, 0x00bd96fb,
+    0x00383228, 0x00bb3bff, 0x00b86d7d, 0x003b64aa, 0x00cea429, 0x004dadfe,
+    0x004efb7c, 0x00cdf2ab, 0x00485678, 0x00cb5faf, 0x00c8092d, 0x004b00fa,
+    0x00450c70, 0x00c605a7, 0x00c55325, 0x00465af2, 0x00c3fe21, 0x0040f7f6,
+    0x0043a174, 0x00c0a8a3, 0x005fb860, 0x00dcb1b7, 0x00dfe735, 0x005ceee2,
+    0x00d94a31, 0x005a43e6, 0x00591564, 0x00da1cb3, 0x00d41039, 0x005719ee,
+    0x00544f6c, 0x00d746bb, 0x0052e268, 0x00d1ebbf, 0x00d2bd3d, 0x0051b4ea,
+    0x006ad040, 0x00e9d997, 0x00ea8f15, 0x006986c2, 0x00ec2211, 0x006f2bc6,
+    0x006c7d44, 0x00ef7493, 0x00e17819, 0x006271ce, 0x0061274c, 0x00e22e9b,
+    0x00678a48, 0x00e4839f, 0x00e7d51d, 0x0064dcca, 0x00fbcc09, 0x0078c5de,
+    0x007b935c, 0x00f89a8b, 0x007d3e58, 0x00fe378f, 0x00fd610d, 0x007e68da,
+    0x00706450, 0x00f36d87, 0x00f03b05, 0x007332d2, 0x00f69601, 0x00759fd6,
+    0x0076c954, 0x00f5c083, 0x001b04a9, 0x00980d7e, 0x009b5bfc, 0x0018522b,
+    0x009df6f8, 0x001eff2f, 0x001da9ad, 0x009ea07a, 0x0090acf0, 0x0013a527,
+    0x0010f3a5, 0x0093fa72, 0x00165ea1, 0x00955776, 0x009601f4, 0x00150823,
+    0x008a18e0, 0x00091137, 0x000a47b5, 0x00894e62, 0x000ceab1, 0x008fe366,
+    0x008cb5e4, 0x000fbc33, 0x0001b0b9, 0x0082b96e, 0x0081efec, 0x0002e63b,
+    0x008742e8, 0x00044b3f, 0x00071dbd, 0x0084146a, 0x00bf70c0, 0x003c7917,
+    0x003f2f95, 0x00bc2642, 0x00398291, 0x00ba8b46, 0x00b9ddc4, 0x003ad413,
+    0x0034d899, 0x00b7d14e, 0x00b487cc, 0x00378e1b, 0x00b22ac8, 0x0031231f,
+    0x0032759d, 0x00b17c4a, 0x002e6c89, 0x00ad655e, 0x00ae33dc, 0x002d3a0b,
+    0x00a89ed8, 0x002b970f, 0x0028c18d, 0x00abc85a, 0x00a5c4d0, 0x0026cd07,
+    0x00259b85, 0x00a69252, 0x00233681, 0x00a03f56, 0x00a369d4, 0x00206003,
+    0x00d5a080, 0x0056a957, 0x0055ffd5, 0x00d6f602, 0x005352d1, 0x00d05b06,
+    0x00d30d84, 0x00500453, 0x005e08d9, 0x00dd010e, 0x00de578c, 0x005d5e5b,
+    0x00d8fa88, 0x005bf35f, 0x0058a5dd, 0x00dbac0a, 0x0044bcc9, 0x00c7b51e,
+    0x00c4e39c, 0x0047ea4b, 0x00c24e98, 0x0041474f, 0x004211cd, 0x00c1181a,
+    0x00cf1490, 0x004c1d47, 0x004f4bc5, 0x00cc4212, 0x0049e6c1, 0x00caef16,
+    0x00c9b994, 0x004ab043, 0x0071d4e9, 0x00f2dd3e, 0x00f18bbc, 0x0072826b,
+    0x00f726b8, 0x00742f6f, 0x007779ed, 0x00f4703a, 0x00fa7cb0, 0x00797567,
+    0x007a23e5, 0x00f92a32, 0x007c8ee1, 0x00ff8736, 0x00fcd1b4, 0x007fd863,
+    0x00e0c8a0, 0x0063c177, 0x006097f5, 0x00e39e22, 0x00663af1, 0x00e53326,
+    0x00e665a4, 0x00656c73, 0x006b60f9, 0x00e8692e, 0x00eb3fac, 0x0068367b,
+    0x00ed92a8, 0x006e9b7f, 0x006dcdfd, 0x00eec42a
+  }
+};
+
 
 static gpg_error_t
 enc_start (struct b64state *state, FILE *fp, estream_t stream,
@@ -197,6 +300,27 @@ my_fputs (const char *string, struct b64state *state)
 }
 
 
+static int
+my_write (const char *buffer, size_t length, struct b64state *state)
+{
+  if (state->stream)
+    return es_write (state->stream, buffer, length, NULL);
+  else
+    return fwrite (buffer, 1, length, state->fp) != length? -1 : 0;
+}
+
+
+/* Encode the three octets at S into the four characters at D.  */
+static inline void
+enc_quad (char *d, const unsigned char *s)
+{
+  d[0] = bintoasc[(s[0] >> 2) & 077];
+  d[1] = bintoasc[(((s[0] << 4) & 060) | ((s[1] >> 4) & 017)) & 077];
+  d[2] = bintoasc[(((s[1] << 2) & 074) | ((s[2] >> 6) & 03)) & 077];
+  d[3] = bintoasc[s[2] & 077];
+}
+
+
 /* Write NBYTES from BUFFER to the Base 64 stream identified by
    STATE. With BUFFER and NBYTES being 0, merely do a fflush on the
    stream. */
@@ -206,6 +330,8 @@ b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
   unsigned char radbuf[4];
   int idx, quad_count;
   const unsigned char *p;
+  char outbuf[1024];
+  size_t outlen;
 
   if (state->lasterr)
     return state->lasterr;
@@ -243,48 +369,61 @@ b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
     {
       size_t n;
       u32 crc = state->crc;
+      u32 x;
 
-      for (p=buffer, n=nbytes; n; p++, n-- )
+      /* Process three octets per round; the remaining ones are
+         handled octet by octet.  */
+      for (p=buffer, n=nbytes; n >= 3; p += 3, n -= 3)
+        {
+          x = crc ^ (((u32)p[0] << 16) | ((u32)p[1] << 8) | p[2]);
+          crc = (crc_table_x[1][(x >> 16) & 0xff]
+                 ^ crc_table_x[0][(x >> 8) & 0xff]
+                 ^ crc_table[x & 0xff]);
+        }
+      for (; n; p++, n-- )
         crc = ((u32)crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ *p];
       state->crc = (crc & 0x00ffffff);
     }
 
-  for (p=buffer; nbytes; p++, nbytes--)
+  /* The encoded characters are collected in OUTBUF so that we need
+     only one write call for about 1k of output instead of one putc
+     per character.  */
+  outlen = 0;
+  p = buffer;
+  while (nbytes)
     {
-      radbuf[idx++] = *p;
-      if (idx > 2)
+      if (!idx && nbytes >= 3)
+        {
+          enc_quad (outbuf + outlen, p);
+          p += 3;
+          nbytes -= 3;
+        }
+      else
+        {
+          radbuf[idx++] = *p++;
+          nbytes--;
+          if (idx < 3)
+            continue;
+          enc_quad (outbuf + outlen, radbuf);
+          idx = 0;
+        }
+      outlen += 4;
+      if (++quad_count >= (64/4))
         {
-          char tmp[4];
-
-          tmp[0] = bintoasc[(*radbuf >> 2) & 077];
-          tmp[1] = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-          tmp[2] = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-          tmp[3] = bintoasc[radbuf[2]&077];
-          if (state->stream)
-            {
-              for (idx=0; idx < 4; idx++)
-                es_putc (tmp[idx], state->stream);
-              idx = 0;
-              if (es_ferror (state->stream))
-                goto write_error;
-            }
-          else
-            {
-              for (idx=0; idx < 4; idx++)
-                putc (tmp[idx], state->fp);
-              idx = 0;
-              if (ferror (state->fp))
-                goto write_error;
-            }
-          if (++quad_count >= (64/4))
-            {
-              quad_count = 0;
-              if (!(state->flags & B64ENC_NO_LINEFEEDS)
-                  && my_fputs ("\n", state) == EOF)
-                goto write_error;
-            }
+          quad_count = 0;
+          if (!(state->flags & B64ENC_NO_LINEFEEDS))
+            outbuf[outlen++] = '\n';
+        }
+      if (outlen > sizeof outbuf - 5)
+        {
+          if (my_write (outbuf, outlen, state))
+            goto write_error;
+          outlen = 0;
         }
     }
+  if (outlen && my_write (outbuf, outlen, state))
+    goto write_error;
+
   memcpy (state->radbuf, radbuf, idx);
   state->idx = idx;
   state->quad_count = quad_count;
@@ -373,10 +512,7 @@ b64enc_finish (struct b64state *state)
       radbuf[0] = state->crc >>16;
       radbuf[1] = state->crc >> 8;
       radbuf[2] = state->crc;
-      tmp[0] = bintoasc[(*radbuf>>2)&077];
-      tmp[1] = bintoasc[(((*radbuf<<4)&060)|((radbuf[1]>>4)&017))&077];
-      tmp[2] = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-      tmp[3] = bintoasc[radbuf[2]&077];
+      enc_quad (tmp, radbuf);
       if (state->stream)
         {
           for (idx=0; idx < 4; idx++)
@@ -40,6 +40,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_IOBUF_MMAP 1
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -76,6 +80,11 @@
  * iobuf_set_buffer_size function.  */
 static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 
+/* Regular files of at least this size are memory mapped by
+ * iobuf_open instead of being read with read(2).  0 disables this.
+ * This can be changed using the iobuf_set_mmap_threshold function.  */
+static size_t iobuf_mmap_threshold;
+
 
 #ifdef HAVE_W32_SYSTEM
 # define FD_FOR_STDIN  (GetStdHandle (STD_INPUT_HANDLE))
@@ -98,6 +107,9 @@ typedef struct
   char peeked[32];     /* Read ahead buffer.  */
   byte npeeked;        /* Number of bytes valid in peeked.  */
   byte upeeked;        /* Number of bytes used from peeked.  */
+  byte *map;           /* If not NULL the file is memory mapped.  */
+  size_t maplen;       /* Length of MAP.  */
+  size_t mappos;       /* Offset of the next unread byte in MAP.  */
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -446,6 +458,68 @@ fd_cache_open (const char *fname, const char *mode)
 }
 
 
+#ifdef USE_IOBUF_MMAP
+/* Try to memory map the input file described by A.  This is only
+ * done for regular files of at least IOBUF_MMAP_THRESHOLD bytes.  On
+ * failure we silently fall back to read(2).  */
+static void
+file_filter_map (file_filter_ctx_t *a)
+{
+  struct stat st;
+  off_t pos;
+  void *p;
+
+  if (!iobuf_mmap_threshold || a->print_only_name)
+    return;
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode))
+    return;
+  if ((uintmax_t)st.st_size < iobuf_mmap_threshold
+      || (uintmax_t)st.st_size > (uintmax_t)(size_t)(-1))
+    return;
+  pos = lseek (a->fp, 0, SEEK_CUR);
+  if (pos == (off_t)(-1) || pos > st.st_size)
+    return;
+
+  p = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, a->fp, 0);
+  if (p == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("%s: mmap failed: %s\n", a->fname, strerror (errno));
+      return;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+  a->map = p;
+  a->maplen = (size_t)st.st_size;
+  a->mappos = (size_t)pos;
+  if (DBG_IOBUF)
+    log_debug ("%s: mapped %zu bytes\n", a->fname, a->maplen);
+}
+
+
+/* Release the mapping of A.  The file position is set to the end of
+ * the consumed data so that reading can continue with read(2); this
+ * makes sure that data appended after the mapping was created is not
+ * lost.  */
+static void
+file_filter_unmap (file_filter_ctx_t *a)
+{
+  if (!a->map)
+    return;
+  munmap (a->map, a->maplen);
+  a->map = NULL;
+  if (lseek (a->fp, (off_t)a->mappos, SEEK_SET) == (off_t)(-1))
+    {
+      a->delayed_rc = gpg_error_from_syserror ();
+      log_error ("%s: can't lseek: %s\n",
+                 a->fname, gpg_strerror (a->delayed_rc));
+    }
+  a->maplen = a->mappos = 0;
+}
+#endif /*USE_IOBUF_MMAP*/
+
+
 static int
 file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	     size_t * ret_len)
@@ -470,6 +544,22 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
           a->upeeked += nbytes;
           *ret_len = nbytes;
         }
+#ifdef USE_IOBUF_MMAP
+      else if (a->map && a->mappos < a->maplen)
+        {
+          /* Serve directly from the mapping.  No syscall is required
+           * and if the caller provided an external drain buffer the
+           * data is copied only once.  */
+          nbytes = a->maplen - a->mappos;
+          if (nbytes > size)
+            nbytes = size;
+          memcpy (buf, a->map + a->mappos, nbytes);
+          a->mappos += nbytes;
+          if (a->mappos == a->maplen)
+            file_filter_unmap (a);
+          *ret_len = nbytes;
+        }
+#endif /*USE_IOBUF_MMAP*/
       else if (a->eof_seen)
 	{
 	  rc = -1;
@@ -610,7 +700,21 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->no_cache = 0;
       a->npeeked = 0;
       a->upeeked = 0;
+      a->map = NULL;
+      a->maplen = 0;
+      a->mappos = 0;
+    }
+#ifdef USE_IOBUF_MMAP
+  else if (control == IOBUFCTRL_PEEK && a->map)
+    {
+      /* Peek on the mapping; this does not consume anything.  */
+      nbytes = a->maplen - a->mappos;
+      if (nbytes > size)
+        nbytes = size;
+      memcpy (buf, a->map + a->mappos, nbytes);
+      *ret_len = nbytes;
     }
+#endif /*USE_IOBUF_MMAP*/
   else if (control == IOBUFCTRL_PEEK)
     {
       /* Peek on the input.  */
@@ -682,6 +786,13 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#ifdef USE_IOBUF_MMAP
+      if (a->map)
+        {
+          munmap (a->map, a->maplen);
+          a->map = NULL;
+        }
+#endif /*USE_IOBUF_MMAP*/
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -1215,6 +1326,20 @@ iobuf_set_buffer_size (unsigned int kilobyte)
 }
 
 
+/* Memory map regular input files of at least KILOBYTE size instead
+ * of reading them.  Using 0 disables the use of mmap, which is also
+ * the default.  This affects only files opened after this call.
+ * Returns the previous value.  */
+unsigned int
+iobuf_set_mmap_threshold (unsigned int kilobyte)
+{
+  unsigned int old = iobuf_mmap_threshold / 1024;
+
+  iobuf_mmap_threshold = (size_t)kilobyte * 1024;
+  return old;
+}
+
+
 #define MAX_IOBUF_DESC 32
 /*
  * Fill the buffer by the description of iobuf A.
@@ -1458,6 +1583,10 @@ do_open (const char *fname, int special_filenames,
   a->filter = file_filter;
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+#ifdef USE_IOBUF_MMAP
+  if (use == IOBUF_INPUT)
+    file_filter_map (fcx);
+#endif
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: open '%s' desc=%s fd=%d\n",
 	       a->no, a->subno, fname, iobuf_desc (a, desc), FD2INT (fcx->fp));
@@ -2744,6 +2873,24 @@ iobuf_seek (iobuf_t a, off_t newpos)
 
       b = a->filter_ov;
 
+#ifdef USE_IOBUF_MMAP
+      if (b->map && newpos >= 0 && (uintmax_t)newpos <= b->maplen)
+        {
+          /* No need to seek the file; the position is only updated
+           * when the mapping is released.  */
+          b->mappos = (size_t)newpos;
+          b->npeeked = b->upeeked = 0;
+          b->eof_seen = 0;
+          goto seek_done;
+        }
+      else if (b->map)
+        {
+          munmap (b->map, b->maplen);
+          b->map = NULL;
+          b->maplen = b->mappos = 0;
+        }
+#endif /*USE_IOBUF_MMAP*/
+
 #ifdef HAVE_W32_SYSTEM
       if (SetFilePointer (b->fp, newpos, NULL, FILE_BEGIN) == 0xffffffff)
 	{
@@ -2757,6 +2904,9 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	  log_error ("can't lseek: %s\n", strerror (errno));
 	  return -1;
 	}
+#endif
+#ifdef USE_IOBUF_MMAP
+    seek_done:
 #endif
       /* Discard the buffer it is not a temp stream.  */
       a->d.len = 0;
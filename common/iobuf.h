@@ -280,6 +280,12 @@ extern int iobuf_debug_mode;
  * returning the current value.  */
 unsigned int iobuf_set_buffer_size (unsigned int kilobyte);
 
+/* Memory map regular input files opened with iobuf_open which are at
+ * least KILOBYTE in size instead of reading them with read(2).  Using
+ * 0 disables this (the default).  Returns the previous value.  Note
+ * that truncating a mapped file while it is read may raise SIGBUS.  */
+unsigned int iobuf_set_mmap_threshold (unsigned int kilobyte);
+
 /* Returns whether the specified filename corresponds to a pipe.  In
    particular, this function checks if FNAME is "-" and, if special
    filenames are enabled (see check_special_filename), whether
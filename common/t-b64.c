@@ -19,7 +19,8 @@
 
 /*
 
-   As of now this is only a test program for manual tests.
+   Without arguments this checks the armor and its CRC against known
+   vectors; the other modes are for manual tests.
 
  */
 
@@ -28,6 +29,7 @@
 #include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "util.h"
 
@@ -65,6 +67,118 @@ test_b64enc_pgp (const char *string)
 }
 
 
+/* Encode DATA of length DATALEN, handing it to b64enc_write in
+   chunks of CHUNK octets, and return the armor as a malloced string.
+   Returns NULL on error.  */
+static char *
+enc_pgp_armor (const unsigned char *data, size_t datalen, size_t chunk)
+{
+  gpg_error_t err;
+  struct b64state state;
+  estream_t fp;
+  void *armor;
+  size_t armorlen, off, n;
+  char *result;
+
+  fp = es_fopenmem (0, "w+b");
+  if (!fp)
+    return NULL;
+
+  err = b64enc_start_es (&state, fp, "PGP MESSAGE");
+  for (off = 0; !err && off < datalen; off += n)
+    {
+      n = datalen - off < chunk? datalen - off : chunk;
+      err = b64enc_write (&state, data + off, n);
+    }
+  if (!err)
+    err = b64enc_finish (&state);
+
+  if (es_fclose_snatch (fp, &armor, &armorlen) || err)
+    return NULL;
+
+  result = xmalloc (armorlen + 1);
+  if (armorlen)
+    memcpy (result, armor, armorlen);
+  result[armorlen] = 0;
+  gpgrt_free (armor);
+  return result;
+}
+
+
+/* Compare the armor and the OpenPGP CRC against known vectors.  The
+   long vector is written in chunks of all sizes up to 13 so that the
+   writes straddle the 3-octet boundaries of the sliced CRC code.  */
+static void
+test_b64enc_crc (void)
+{
+  static const unsigned char short_data[] =
+    { 0x00, 0xff, 0x5a, 0xa5, 0xc3, 0xe7, 0x18 };
+  static struct {
+    const char *body;
+    const char *crc;
+  } short_tv[] = {
+    { NULL,           NULL    },
+    { "AA==",         "=YWnT" },
+    { "AP8=",         "=J2j4" },
+    { "AP9a",         "=DO+R" },
+    { "AP9apQ==",     "=98qP" },
+    { "AP9apcM=",     "=kPaB" },
+    { "AP9apcPn",     "=ucKl" },
+    { "AP9apcPnGA==", "=e3+2" }
+  };
+  static const char long_expected[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "CzBVep/E6Q4zWH2ix+wRNluApcrvFDleg6jN8hc8YYar0PUaP2SJrtP4HUJnjLHW\n"
+    "+yBFao+02f4jSG2St9wBJktwlbrfBClOc5i94gcsUXabwOUKL1R5nsPoDTJXfKHG\n"
+    "6xA1Wg==\n"
+    "=z6pb\n"
+    "-----END PGP MESSAGE-----\n";
+  unsigned char long_data[100];
+  char *armor, *expected;
+  int n, chunk;
+
+  for (n = 0; n < DIM (short_tv); n++)
+    {
+      armor = enc_pgp_armor (short_data, n, 1 + n % 3);
+      if (!armor)
+        {
+          fail (n);
+          continue;
+        }
+      if (!short_tv[n].body)
+        expected = xstrdup ("");  /* Nothing is written for no data.  */
+      else
+        expected = xstrconcat ("-----BEGIN PGP MESSAGE-----\n\n",
+                               short_tv[n].body, "\n",
+                               short_tv[n].crc, "\n",
+                               "-----END PGP MESSAGE-----\n", NULL);
+      if (strcmp (armor, expected))
+        {
+          if (verbose)
+            fprintf (stderr, "got:\n%s\nexpected:\n%s\n", armor, expected);
+          fail (n);
+        }
+      xfree (expected);
+      xfree (armor);
+    }
+
+  for (n = 0; n < sizeof long_data; n++)
+    long_data[n] = n * 37 + 11;
+  for (chunk = 1; chunk <= 13; chunk++)
+    {
+      armor = enc_pgp_armor (long_data, sizeof long_data, chunk);
+      if (!armor || strcmp (armor, long_expected))
+        {
+          if (verbose && armor)
+            fprintf (stderr, "chunk %d: got:\n%s\n", chunk, armor);
+          fail (100 + chunk);
+        }
+      xfree (armor);
+    }
+}
+
+
 static void
 test_b64enc_file (const char *fname)
 {
@@ -144,12 +258,106 @@ test_b64dec_file (const char *fname)
 }
 
 
+/* Encode and decode MIB mebibytes of pseudo random data and print
+   the throughput.  This is a micro-benchmark for the encoder and the
+   decoder; it also checks that the round trip yields the input.  */
+static void
+test_b64_bench (const char *mib)
+{
+  gpg_error_t err;
+  struct b64state state;
+  estream_t fp;
+  unsigned char *data;
+  void *armor;
+  size_t datalen, armorlen, n, nbytes, off, decoff;
+  unsigned int rnd;
+  clock_t t0, t1, t2;
+
+  datalen = (mib? atoi (mib) : 16) * 1024 * 1024;
+  data = xmalloc (datalen);
+  for (rnd = 42, n = 0; n < datalen; n++)
+    {
+      rnd = rnd * 1103515245 + 12345;
+      data[n] = rnd >> 16;
+    }
+
+  fp = es_fopenmem (0, "w+b");
+  if (!fp)
+    {
+      fail (0);
+      xfree (data);
+      return;
+    }
+
+  t0 = clock ();
+  err = b64enc_start_es (&state, fp, "PGP MESSAGE");
+  if (err)
+    fail (1);
+  for (off = 0; off < datalen; off += n)
+    {
+      n = datalen - off < 8192? datalen - off : 8192;
+      err = b64enc_write (&state, data + off, n);
+      if (err)
+        fail (2);
+    }
+  err = b64enc_finish (&state);
+  if (err)
+    fail (3);
+  t1 = clock ();
+
+  if (es_fclose_snatch (fp, &armor, &armorlen))
+    {
+      fail (4);
+      xfree (data);
+      return;
+    }
+
+  err = b64dec_start (&state, "");
+  if (err)
+    fail (5);
+  for (off = decoff = 0; off < armorlen; off += n)
+    {
+      n = armorlen - off < 8192? armorlen - off : 8192;
+      err = b64dec_proc (&state, (char *)armor + off, n, &nbytes);
+      if (err)
+        {
+          if (gpg_err_code (err) == GPG_ERR_EOF)
+            break;
+          fail (6);
+          break;
+        }
+      if (decoff + nbytes > datalen
+          || memcmp ((char *)armor + off, data + decoff, nbytes))
+        {
+          fail (7);
+          break;
+        }
+      decoff += nbytes;
+    }
+  err = b64dec_finish (&state);
+  if (err)
+    fail (8);
+  if (decoff != datalen)
+    fail (9);
+  t2 = clock ();
+
+  printf ("encode: %7.1f MiB/s\n"
+          "decode: %7.1f MiB/s\n",
+          datalen / 1048576.0 / ((double)(t1 - t0 + 1) / CLOCKS_PER_SEC),
+          datalen / 1048576.0 / ((double)(t2 - t1 + 1) / CLOCKS_PER_SEC));
+
+  gpgrt_free (armor);
+  xfree (data);
+}
+
+
 
 int
 main (int argc, char **argv)
 {
   int do_encode = 0;
   int do_decode = 0;
+  int do_bench = 0;
 
   if (argc)
     { argc--; argv++; }
@@ -169,13 +377,22 @@ main (int argc, char **argv)
       do_decode = 1;
       argc--; argv++;
     }
+  else if (argc && !strcmp (argv[0], "--bench"))
+    {
+      do_bench = 1;
+      argc--; argv++;
+    }
 
   if (do_encode)
     test_b64enc_file (argc? *argv: NULL);
   else if (do_decode)
     test_b64dec_file (argc? *argv: NULL);
+  else if (do_bench)
+    test_b64_bench (argc? *argv: NULL);
+  else if (argc)
+    test_b64enc_pgp (*argv);
   else
-    test_b64enc_pgp (argc? *argv: NULL);
+    test_b64enc_crc ();
 
   return !!errcount;
 }
@@ -390,5 +390,62 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that reading a memory mapped file returns the same data
+     as reading it the standard way.  Mix peeks, single byte reads,
+     large reads (which use the external drain) and a seek.  */
+  {
+    const char *fname = "t-iobuf-mmap.tmp";
+    size_t filelen = 200 * 1024 + 17;
+    unsigned char *buffer;
+    unsigned char peekbuf[16];
+    FILE *fp;
+    iobuf_t iobuf;
+    size_t i, n;
+    int c;
+
+    fp = fopen (fname, "wb");
+    assert (fp);
+    for (i = 0; i < filelen; i ++)
+      putc ((int)((i * 7) & 0xff), fp);
+    assert (!fclose (fp));
+
+    iobuf_set_mmap_threshold (1);
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    iobuf_set_mmap_threshold (0);
+
+    assert (iobuf_peek (iobuf, peekbuf, sizeof peekbuf) == sizeof peekbuf);
+    for (i = 0; i < sizeof peekbuf; i ++)
+      assert (peekbuf[i] == ((i * 7) & 0xff));
+
+    n = 0;
+    c = iobuf_readbyte (iobuf);
+    assert (c == 0);
+    n ++;
+
+    buffer = malloc (filelen);
+    assert (buffer);
+    assert (iobuf_read (iobuf, buffer, 100000) == 100000);
+    for (i = 0; i < 100000; i ++)
+      assert (buffer[i] == (((n + i) * 7) & 0xff));
+    n += 100000;
+
+    assert (!iobuf_seek (iobuf, 4096));
+    assert (iobuf_readbyte (iobuf) == ((4096 * 7) & 0xff));
+    assert (!iobuf_seek (iobuf, n));
+
+    while ((c = iobuf_read (iobuf, buffer, 1000)) != -1)
+      {
+        for (i = 0; i < (size_t)c; i ++)
+          assert (buffer[i] == (((n + i) * 7) & 0xff));
+        n += c;
+      }
+    assert (n == filelen);
+
+    iobuf_close (iobuf);
+    free (buffer);
+    remove (fname);
+  }
+
   return 0;
 }
@@ -863,3 +863,262 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     log_clock ("%s leave (%sfound)", __func__, err? "not ":"");
   return err;
 }
+
+
+
+/* The maximum number of patterns we send with one LOOKUP command.
+ * This is the limit of keyboxd.  */
+#define MAX_LOOKUP_PATTERNS 1000
+
+/* Communication object for LOOKUP commands.  */
+struct lookup_parm_s
+{
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC *desc;  /* The patterns to send.  */
+  size_t ndesc;             /* Number of patterns in DESC.  */
+  struct {
+    int uid_no;
+    int pk_no;
+  } *info;                  /* The values from the PUBKEY_INFO lines.  */
+  size_t ninfo;             /* Number of used items in INFO.  */
+  size_t infosize;          /* Number of allocated items in INFO.  */
+  int truncated;            /* The keyboxd did not return all keys.  */
+};
+
+
+/* Handle the inquiries from the LOOKUP command.  */
+static gpg_error_t
+lookup_inq_cb (void *opaque, const char *line)
+{
+  struct lookup_parm_s *parm = opaque;
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC *desc;
+  membuf_t mb;
+  char hexbuf[2 * MAX_FINGERPRINT_LEN + 1];
+  char *data;
+  size_t datalen, n;
+
+  if (!has_leading_keyword (line, "PATTERNS"))
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  init_membuf (&mb, 64 * parm->ndesc);
+  for (n = 0; n < parm->ndesc; n++)
+    {
+      desc = parm->desc + n;
+      switch (desc->mode)
+        {
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          put_membuf_printf (&mb, "0x%08lX\n", (ulong)desc->u.kid[1]);
+          break;
+
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          put_membuf_printf (&mb, "0x%08lX%08lX\n",
+                             (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
+          break;
+
+        case KEYDB_SEARCH_MODE_FPR:
+          log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
+          bin2hex (desc->u.fpr, desc->fprlen, hexbuf);
+          put_membuf_printf (&mb, "0x%s\n", hexbuf);
+          break;
+
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          bin2hex (desc->u.grip, KEYGRIP_LEN, hexbuf);
+          put_membuf_printf (&mb, "&%s\n", hexbuf);
+          break;
+
+        case KEYDB_SEARCH_MODE_UBID:
+          bin2hex (desc->u.ubid, UBID_LEN, hexbuf);
+          put_membuf_printf (&mb, "^%s\n", hexbuf);
+          break;
+
+        default:
+          xfree (get_membuf (&mb, NULL));
+          return gpg_error (GPG_ERR_INV_ARG);
+        }
+    }
+
+  data = get_membuf (&mb, &datalen);
+  if (!data)
+    return gpg_error_from_syserror ();
+  err = assuan_send_data (parm->hd->kbl->ctx, data, datalen);
+  xfree (data);
+  return err;
+}
+
+
+/* Status callback for LOOKUP.  */
+static gpg_error_t
+lookup_status_cb (void *opaque, const char *line)
+{
+  struct lookup_parm_s *parm = opaque;
+  KEYDB_HANDLE hd = parm->hd;
+  gpg_error_t err;
+  void *tmp;
+
+  if (has_leading_keyword (line, "TRUNCATED"))
+    {
+      parm->truncated = 1;
+      return 0;
+    }
+
+  hd->last_ubid_valid = 0;
+  err = search_status_cb (hd, line);
+  if (err || !hd->last_ubid_valid)
+    return err;
+
+  if (parm->ninfo == parm->infosize)
+    {
+      parm->infosize += 64;
+      tmp = xtryrealloc (parm->info, parm->infosize * sizeof *parm->info);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      parm->info = tmp;
+    }
+  parm->info[parm->ninfo].uid_no = hd->last_uid_no;
+  parm->info[parm->ninfo].pk_no = hd->last_pk_no;
+  parm->ninfo++;
+  return 0;
+}
+
+
+/* Send one LOOKUP command for the up to 1000 search descriptions
+ * (DESC,NDESC) and call CB for each keyblock found.  If the keyboxd
+ * could not return all keys at once the descriptions are split and
+ * looked up again.  R_ANY is set if a keyblock was found.  */
+static gpg_error_t
+lookup_keyblocks_batch (KEYDB_HANDLE hd, struct lookup_parm_s *parm,
+                        KEYDB_SEARCH_DESC *desc, size_t ndesc,
+                        gpg_error_t (*cb)(void *opaque, kbnode_t keyblock),
+                        void *cb_value, int *r_any)
+{
+  gpg_error_t err;
+  char *buffer = NULL;
+  size_t len, reclen, n;
+  const unsigned char *p;
+  iobuf_t iobuf;
+  kbnode_t keyblock;
+
+  parm->desc = desc;
+  parm->ndesc = ndesc;
+  parm->ninfo = 0;
+  parm->truncated = 0;
+
+  err = kbx_client_data_cmd2 (hd->kbl->kcd, "LOOKUP --openpgp",
+                              lookup_inq_cb, parm,
+                              lookup_status_cb, parm);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    return 0;
+  if (!err)
+    err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len);
+  if (err)
+    goto leave;
+
+  /* The data is a sequence of keyblocks each prefixed by its
+   * length; they are in the order of the status lines.  */
+  p = buffer;
+  for (n = 0; n < parm->ninfo; n++)
+    {
+      if (len < 4 || (reclen = buf32_to_size_t (p)) > len - 4)
+        {
+          err = gpg_error (GPG_ERR_INV_RESPONSE);
+          goto leave;
+        }
+      p += 4;
+      len -= 4;
+      iobuf = iobuf_temp_with_content ((const char *)p, reclen);
+      err = keydb_parse_keyblock (iobuf, parm->info[n].pk_no,
+                                  parm->info[n].uid_no, &keyblock);
+      iobuf_close (iobuf);
+      p += reclen;
+      len -= reclen;
+      if (err)
+        goto leave;
+      *r_any = 1;
+      err = cb (cb_value, keyblock);
+      release_kbnode (keyblock);
+      if (err)
+        goto leave;
+    }
+
+  if (parm->truncated)
+    {
+      /* Keyblocks already passed to CB may be passed again.  */
+      if (ndesc < 2)
+        {
+          log_info ("keyboxd: result of a lookup truncated\n");
+          goto leave;
+        }
+      n = ndesc / 2;
+      err = lookup_keyblocks_batch (hd, parm, desc, n, cb, cb_value, r_any);
+      if (!err)
+        err = lookup_keyblocks_batch (hd, parm, desc + n, ndesc - n,
+                                      cb, cb_value, r_any);
+    }
+
+ leave:
+  xfree (buffer);
+  return err;
+}
+
+
+/* Look up the keyblocks for all the search descriptions (DESC,NDESC)
+ * using one request to the keyboxd for up to 1000 descriptions.
+ * Only the modes SHORT_KID, LONG_KID, FPR, KEYGRIP and UBID are
+ * supported.  For each keyblock found CB is called with CB_VALUE and
+ * the keyblock; the keyblock is released after CB returns.  The order
+ * of the keyblocks is not defined and a keyblock may be passed more
+ * than once.  As with keydb_get_keyblock flag bit 0 is set for the
+ * public key node used to locate the keyblock.
+ *
+ * Returns GPG_ERR_NOT_FOUND if no key was found and
+ * GPG_ERR_NOT_SUPPORTED if the keyboxd is not used.  This function
+ * ends a search started by keydb_search; thus the next keydb_search
+ * starts again at the beginning.  */
+gpg_error_t
+keydb_lookup_keyblocks (KEYDB_HANDLE hd,
+                        KEYDB_SEARCH_DESC *desc, size_t ndesc,
+                        gpg_error_t (*cb)(void *opaque, kbnode_t keyblock),
+                        void *cb_value)
+{
+  gpg_error_t err = 0;
+  struct lookup_parm_s parm = {NULL};
+  size_t n;
+  int any = 0;
+
+  if (!hd || !ndesc)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (!hd->use_keyboxd)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (DBG_CLOCK)
+    log_clock ("%s enter (%zu patterns)", __func__, ndesc);
+
+  /* Clear the result objects.  */
+  if (hd->kbl->search_result)
+    {
+      iobuf_close (hd->kbl->search_result);
+      hd->kbl->search_result = NULL;
+    }
+  hd->kbl->need_search_reset = 1;
+
+  parm.hd = hd;
+  for (; ndesc; desc += n, ndesc -= n)
+    {
+      n = ndesc > MAX_LOOKUP_PATTERNS? MAX_LOOKUP_PATTERNS : ndesc;
+      err = lookup_keyblocks_batch (hd, &parm, desc, n, cb, cb_value, &any);
+      if (err)
+        goto leave;
+    }
+
+  if (!any)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+
+ leave:
+  hd->last_ubid_valid = 0;
+  xfree (parm.info);
+  if (DBG_CLOCK)
+    log_clock ("%s leave (%sfound)", __func__, any? "":"not ");
+  return err;
+}
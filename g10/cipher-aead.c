@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -38,6 +39,24 @@
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* The largest chunk size for which we encrypt chunks in parallel.
+ * Each job slot needs a buffer of the chunk size.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (16*1024*1024)
+
+
+/* A slot to encrypt one complete chunk on a separate thread.  */
+struct aead_enc_job_s
+{
+  gcry_cipher_hd_t cipher_hd;  /* The cipher handle used by this slot.  */
+  npth_t thread;               /* The thread processing this slot.  */
+  unsigned int running:1;      /* THREAD has been started.  */
+  unsigned int pending:1;      /* The result has not yet been written.  */
+  char *buffer;                /* Plaintext; ciphertext after encryption.  */
+  size_t buflen;               /* Used length of BUFFER.  */
+  byte tag[16];                /* The computed authentication tag.  */
+  gpg_error_t err;             /* The result of the encryption.  */
+};
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -55,12 +74,13 @@ my_iobuf_write (iobuf_t a, const void *buffer, size_t buflen)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  If
- * FINAL is set the final AEAD chunk is processed.  This also reset
- * the encryption machinery so that the handle can be used for a new
- * chunk.  */
+/* Set the nonce and the additional data for chunk CHUNKINDEX on the
+ * cipher handle HD.  If FINAL is set the final AEAD chunk is
+ * processed.  This also reset the encryption machinery so that the
+ * handle can be used for a new chunk.  */
 static gpg_error_t
-set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+set_nonce_and_ad_hd (cipher_filter_context_t *cfx, gcry_cipher_hd_t hd,
+                     uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char nonce[16];
@@ -83,18 +103,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
       BUG ();
     }
 
-  nonce[i++] ^= cfx->chunkindex >> 56;
-  nonce[i++] ^= cfx->chunkindex >> 48;
-  nonce[i++] ^= cfx->chunkindex >> 40;
-  nonce[i++] ^= cfx->chunkindex >> 32;
-  nonce[i++] ^= cfx->chunkindex >> 24;
-  nonce[i++] ^= cfx->chunkindex >> 16;
-  nonce[i++] ^= cfx->chunkindex >>  8;
-  nonce[i++] ^= cfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, 15, "nonce:");
-  err = gcry_cipher_setiv (cfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -103,14 +123,14 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
   ad[2] = cfx->dek->algo;
   ad[3] = cfx->dek->use_aead;
   ad[4] = cfx->chunkbyte;
-  ad[5] = cfx->chunkindex >> 56;
-  ad[6] = cfx->chunkindex >> 48;
-  ad[7] = cfx->chunkindex >> 40;
-  ad[8] = cfx->chunkindex >> 32;
-  ad[9] = cfx->chunkindex >> 24;
-  ad[10]= cfx->chunkindex >> 16;
-  ad[11]= cfx->chunkindex >>  8;
-  ad[12]= cfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = cfx->total >> 56;
@@ -124,7 +144,85 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (cfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Set the nonce and the additional data for the current chunk using
+ * the main cipher handle.  */
+static gpg_error_t
+set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+{
+  return set_nonce_and_ad_hd (cfx, cfx->cipher_hd, cfx->chunkindex, final);
+}
+
+
+/* Release the job slots of CFX.  Running threads are joined first.  */
+static void
+release_jobs (cipher_filter_context_t *cfx)
+{
+  unsigned int i;
+  int rc;
+
+  if (!cfx->jobs)
+    return;
+
+  for (i = 0; i < cfx->njobs; i++)
+    {
+      struct aead_enc_job_s *job = cfx->jobs + i;
+
+      if (job->running)
+        {
+          rc = npth_join (job->thread, NULL);
+          if (rc)
+            log_error ("error joining AEAD thread: %s\n", strerror (rc));
+        }
+      gcry_cipher_close (job->cipher_hd);
+      xfree (job->buffer);
+    }
+  xfree (cfx->jobs);
+  cfx->jobs = NULL;
+  cfx->njobs = 0;
+}
+
+
+/* Create the job slots used to encrypt chunks in parallel.  Each
+ * slot gets its own cipher handle using the key of the main handle
+ * and the mode CIPHERMODE.  */
+static gpg_error_t
+setup_jobs (cipher_filter_context_t *cfx, enum gcry_cipher_modes ciphermode)
+{
+  gpg_error_t err = 0;
+  unsigned int i;
+
+  cfx->jobs = xtrycalloc (opt.aead_threads, sizeof *cfx->jobs);
+  if (!cfx->jobs)
+    return gpg_error_from_syserror ();
+  cfx->njobs = opt.aead_threads;
+  cfx->curjob = 0;
+
+  for (i = 0; i < cfx->njobs && !err; i++)
+    {
+      struct aead_enc_job_s *job = cfx->jobs + i;
+
+      job->buffer = xtrymalloc (cfx->chunksize);
+      if (!job->buffer)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      err = openpgp_cipher_open (&job->cipher_hd, cfx->dek->algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (!err)
+        err = gcry_cipher_setkey (job->cipher_hd,
+                                  cfx->dek->key, cfx->dek->keylen);
+    }
+  if (err)
+    release_jobs (cfx);
+  else if (DBG_FILTER)
+    log_debug ("using %u threads for AEAD encryption\n", cfx->njobs);
+
+  return err;
 }
 
 
@@ -200,6 +298,13 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  if (opt.aead_threads > 1 && cfx->chunksize <= AEAD_MAX_PARALLEL_CHUNKSIZE)
+    {
+      err = setup_jobs (cfx, ciphermode);
+      if (err)
+        goto leave;
+    }
+
   cfx->wrote_header = 1;
 
  leave:
@@ -253,6 +358,153 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
 }
 
 
+/* Encrypt the chunk in JOB and compute its tag.  The nonce and the
+ * additional data have already been set.  */
+static void
+encrypt_job (struct aead_enc_job_s *job)
+{
+  job->err = gcry_cipher_final (job->cipher_hd);
+  if (!job->err)
+    job->err = gcry_cipher_encrypt (job->cipher_hd, job->buffer, job->buflen,
+                                    NULL, 0);
+  if (!job->err)
+    job->err = gcry_cipher_gettag (job->cipher_hd, job->tag, 16);
+}
+
+
+/* Thread function to encrypt one chunk.  Only Libgcrypt is called
+ * and thus we can run it without holding the nPth lock.  */
+static void *
+encrypt_job_thread (void *arg)
+{
+  struct aead_enc_job_s *job = arg;
+
+  npth_unprotect ();
+  encrypt_job (job);
+  npth_protect ();
+  return NULL;
+}
+
+
+/* Wait for the job in the current slot to finish and write its
+ * ciphertext and tag to A.  Does nothing if the slot has no pending
+ * result.  */
+static gpg_error_t
+finish_job (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  struct aead_enc_job_s *job = cfx->jobs + cfx->curjob;
+  gpg_error_t err;
+  int rc;
+
+  if (!job->pending)
+    return 0;
+
+  job->pending = 0;
+  if (job->running)
+    {
+      rc = npth_join (job->thread, NULL);
+      job->running = 0;
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          log_error ("error joining AEAD thread: %s\n", gpg_strerror (err));
+          return err;
+        }
+    }
+  err = job->err;
+  if (!err)
+    err = my_iobuf_write (a, job->buffer, job->buflen);
+  if (!err)
+    err = my_iobuf_write (a, job->tag, 16);
+  job->buflen = 0;
+  return err;
+}
+
+
+/* Start encrypting the chunk collected in the current slot and
+ * advance to the next slot.  If that slot is still busy its result is
+ * written to A first so that the chunks are emitted in order.  */
+static gpg_error_t
+submit_job (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  struct aead_enc_job_s *job = cfx->jobs + cfx->curjob;
+  gpg_error_t err;
+  npth_attr_t tattr;
+  int rc;
+
+  err = set_nonce_and_ad_hd (cfx, job->cipher_hd, cfx->chunkindex, 0);
+  if (err)
+    return err;
+  if (DBG_FILTER)
+    log_debug ("submitting chunk %ju (%zu bytes) to slot %u\n",
+               (uintmax_t)cfx->chunkindex, job->buflen, cfx->curjob);
+  cfx->total += job->buflen;
+  cfx->chunkindex++;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&job->thread, &tattr, encrypt_job_thread, job);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    encrypt_job (job);  /* Fall back to doing the work on this thread.  */
+  else
+    job->running = 1;
+  job->pending = 1;
+
+  cfx->curjob = (cfx->curjob + 1) % cfx->njobs;
+  return finish_job (cfx, a);
+}
+
+
+/* Flush and finish all jobs in order.  */
+static gpg_error_t
+finish_all_jobs (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  gpg_error_t err = 0;
+  unsigned int i;
+
+  for (i = 0; i < cfx->njobs && !err; i++)
+    {
+      err = finish_job (cfx, a);
+      cfx->curjob = (cfx->curjob + 1) % cfx->njobs;
+    }
+  return err;
+}
+
+
+/* The flush sub-function of cipher_filter_aead used if chunks are
+ * encrypted in parallel.  Complete chunks are collected in the job
+ * slots and handed to a thread.  */
+static gpg_error_t
+do_flush_parallel (cipher_filter_context_t *cfx, iobuf_t a,
+                   byte *buf, size_t size)
+{
+  gpg_error_t err = 0;
+  struct aead_enc_job_s *job;
+  size_t n;
+
+  while (size)
+    {
+      job = cfx->jobs + cfx->curjob;
+      n = cfx->chunksize - job->buflen;
+      if (n > size)
+        n = size;
+      memcpy (job->buffer + job->buflen, buf, n);
+      job->buflen += n;
+      buf += n;
+      size -= n;
+      if (job->buflen == cfx->chunksize)
+        {
+          err = submit_job (cfx, a);
+          if (err)
+            break;
+        }
+    }
+
+  return err;
+}
+
+
 /* The core of the flush sub-function of cipher_filter_aead.   */
 static gpg_error_t
 do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
@@ -407,7 +659,18 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   if (DBG_FILTER)
     log_debug ("do_free: buflen=%zu\n", cfx->buflen);
 
-  if (cfx->chunklen || cfx->buflen)
+  if (cfx->jobs)
+    {
+      /* Encrypt the last partial chunk and write out all pending
+       * chunks.  */
+      if (cfx->jobs[cfx->curjob].buflen)
+        err = submit_job (cfx, a);
+      if (!err)
+        err = finish_all_jobs (cfx, a);
+      if (err)
+        goto leave;
+    }
+  else if (cfx->chunklen || cfx->buflen)
     {
       if (DBG_FILTER)
         log_debug ("encrypting last %zu bytes of the last chunk\n",cfx->buflen);
@@ -450,6 +713,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   err = write_final_chunk (cfx, a);
 
  leave:
+  release_jobs (cfx);
   xfree (cfx->buffer);
   cfx->buffer = NULL;
   gcry_cipher_close (cfx->cipher_hd);
@@ -477,6 +741,8 @@ cipher_filter_aead (void *opaque, int control,
     {
       if (!cfx->wrote_header && (rc=write_header (cfx, a)))
         ;
+      else if (cfx->jobs)
+        rc = do_flush_parallel (cfx, a, buf, size);
       else
         rc = do_flush (cfx, a, buf, size);
     }
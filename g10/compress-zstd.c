@@ -0,0 +1,297 @@
+/* compress-zstd.c - zstd compress filter
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This implements the experimental COMPRESS_ALGO_ZSTD, which uses a
+ * private algorithm id.  It is meant for data exchanged between
+ * installations which have been configured with --enable-zstd, for
+ * example backups made with gpgtar.  The code follows the structure
+ * of compress-bz2.c.  */
+
+#include <config.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include <zstd.h>
+
+#include "packet.h"
+#include "filter.h"
+#include "main.h"
+#include "options.h"
+
+
+/* The state used for the zstd filter.  It is stored at the OPAQUE
+   field of the compress filter context.  */
+struct zstd_state_s
+{
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer in;
+  int eofseen;
+  int framedone;  /* The last call to ZSTD_decompressStream
+                     completed a frame.  */
+};
+typedef struct zstd_state_s *zstd_state_t;
+
+
+static void
+init_compress (compress_filter_context_t *zfx, zstd_state_t zst)
+{
+  size_t rc;
+  int level;
+
+  if (opt.compress_level >= 1 && opt.compress_level <= ZSTD_maxCLevel ())
+    level = opt.compress_level;
+  else if (opt.compress_level == -1)
+    level = ZSTD_CLEVEL_DEFAULT;
+  else
+    {
+      log_error ("invalid compression level; using default level\n");
+      level = ZSTD_CLEVEL_DEFAULT;
+    }
+
+  zst->cctx = ZSTD_createCCtx ();
+  if (!zst->cctx)
+    log_fatal ("zstd problem: %s\n", "out of core");
+  rc = ZSTD_CCtx_setParameter (zst->cctx, ZSTD_c_compressionLevel, level);
+  if (ZSTD_isError (rc))
+    log_fatal ("zstd problem: %s\n", ZSTD_getErrorName (rc));
+  rc = ZSTD_CCtx_setParameter (zst->cctx, ZSTD_c_checksumFlag, 1);
+  if (ZSTD_isError (rc))
+    log_fatal ("zstd problem: %s\n", ZSTD_getErrorName (rc));
+
+  /* Multi-threaded compression requires a libzstd built with
+     ZSTD_MULTITHREAD; if this is not the case we silently fall back
+     to the single threaded mode.  */
+  if (opt.compress_threads > 1)
+    {
+      rc = ZSTD_CCtx_setParameter (zst->cctx, ZSTD_c_nbWorkers,
+                                   opt.compress_threads);
+      if (ZSTD_isError (rc) && opt.verbose)
+        log_info ("zstd: multi-threading not supported: %s\n",
+                  ZSTD_getErrorName (rc));
+    }
+
+  zfx->outbufsize = ZSTD_CStreamOutSize ();
+  zfx->outbuf = xmalloc (zfx->outbufsize);
+}
+
+
+static int
+do_compress (compress_filter_context_t *zfx, zstd_state_t zst,
+             ZSTD_EndDirective mode, IOBUF a)
+{
+  int rc;
+  size_t zrc;
+  ZSTD_outBuffer out;
+
+  if (mode == ZSTD_e_continue && zst->in.pos == zst->in.size)
+    return 0;
+
+  do
+    {
+      out.dst = zfx->outbuf;
+      out.size = zfx->outbufsize;
+      out.pos = 0;
+      if (DBG_FILTER)
+        log_debug ("enter ZSTD_compressStream2: avail_in=%u, mode=%d\n",
+                   (unsigned)(zst->in.size - zst->in.pos), mode);
+      zrc = ZSTD_compressStream2 (zst->cctx, &out, &zst->in, mode);
+      if (ZSTD_isError (zrc))
+        log_fatal ("zstd compress problem: %s\n", ZSTD_getErrorName (zrc));
+      if (DBG_FILTER)
+        log_debug ("leave ZSTD_compressStream2:"
+                   " avail_in=%u, n=%u, remaining=%u\n",
+                   (unsigned)(zst->in.size - zst->in.pos),
+                   (unsigned)out.pos, (unsigned)zrc);
+
+      if (out.pos && (rc = iobuf_write (a, zfx->outbuf, out.pos)))
+        {
+          log_debug ("ZSTD_compressStream2: iobuf_write failed\n");
+          return rc;
+        }
+    }
+  while (zst->in.pos < zst->in.size || (mode == ZSTD_e_end && zrc));
+
+  return 0;
+}
+
+
+static void
+init_uncompress (compress_filter_context_t *zfx, zstd_state_t zst)
+{
+  zst->dctx = ZSTD_createDCtx ();
+  if (!zst->dctx)
+    log_fatal ("zstd problem: %s\n", "out of core");
+
+  zfx->inbufsize = ZSTD_DStreamInSize ();
+  zfx->inbuf = xmalloc (zfx->inbufsize);
+  zst->in.src = zfx->inbuf;
+  zst->in.size = 0;
+  zst->in.pos = 0;
+}
+
+
+static int
+do_uncompress (compress_filter_context_t *zfx, zstd_state_t zst,
+               IOBUF a, byte *buf, size_t size, size_t *ret_len)
+{
+  int rc = 0;
+  size_t zrc;
+  int nread;
+  ZSTD_outBuffer out;
+
+  out.dst = buf;
+  out.size = size;
+  out.pos = 0;
+
+  do
+    {
+      if (zst->in.pos == zst->in.size && !zst->eofseen)
+        {
+          nread = iobuf_read (a, zfx->inbuf, zfx->inbufsize);
+          if (nread == -1)
+            {
+              zst->eofseen = 1;
+              nread = 0;
+            }
+          zst->in.size = nread;
+          zst->in.pos = 0;
+        }
+
+      /* After the end of a frame libzstd returns the size of the next
+         frame header and not 0; thus we need to remember whether the
+         input ended right at a frame boundary.  */
+      if (zst->in.pos == zst->in.size && zst->eofseen && zst->framedone)
+        {
+          rc = -1; /* eof */
+          break;
+        }
+
+      if (DBG_FILTER)
+        log_debug ("enter ZSTD_decompressStream: avail_in=%u, avail_out=%u\n",
+                   (unsigned)(zst->in.size - zst->in.pos),
+                   (unsigned)(out.size - out.pos));
+      zrc = ZSTD_decompressStream (zst->dctx, &out, &zst->in);
+      if (DBG_FILTER)
+        log_debug ("leave ZSTD_decompressStream: avail_in=%u, avail_out=%u,"
+                   " zrc=%u\n",
+                   (unsigned)(zst->in.size - zst->in.pos),
+                   (unsigned)(out.size - out.pos), (unsigned)zrc);
+      if (ZSTD_isError (zrc))
+        {
+          log_error ("zstd decompress problem: %s\n",
+                     ZSTD_getErrorName (zrc));
+          rc = GPG_ERR_BAD_DATA;
+          break;
+        }
+      zst->framedone = !zrc;
+      if (zrc && zst->eofseen && zst->in.pos == zst->in.size
+          && out.pos < out.size)
+        {
+          log_error ("unexpected EOF in zstd\n");
+          rc = GPG_ERR_BAD_DATA;
+          break;
+        }
+    }
+  while (out.pos < out.size);
+
+  *ret_len = out.pos;
+  if (DBG_FILTER)
+    log_debug ("do_uncompress: returning %u bytes\n", (unsigned)*ret_len);
+  return rc;
+}
+
+
+int
+compress_filter_zstd (void *opaque, int control,
+                      IOBUF a, byte *buf, size_t *ret_len)
+{
+  size_t size = *ret_len;
+  compress_filter_context_t *zfx = opaque;
+  zstd_state_t zst = zfx->opaque;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      if (!zfx->status)
+        {
+          zst = zfx->opaque = xmalloc_clear (sizeof *zst);
+          init_uncompress (zfx, zst);
+          zfx->status = 1;
+        }
+
+      rc = do_uncompress (zfx, zst, a, buf, size, ret_len);
+    }
+  else if (control == IOBUFCTRL_FLUSH)
+    {
+      if (!zfx->status)
+        {
+          PACKET pkt;
+          PKT_compressed cd;
+
+          if (zfx->algo != COMPRESS_ALGO_ZSTD)
+            BUG ();
+          memset (&cd, 0, sizeof cd);
+          cd.len = 0;
+          cd.algorithm = zfx->algo;
+          init_packet (&pkt);
+          pkt.pkttype = PKT_COMPRESSED;
+          pkt.pkt.compressed = &cd;
+          if (build_packet (a, &pkt))
+            log_bug ("build_packet(PKT_COMPRESSED) failed\n");
+          zst = zfx->opaque = xmalloc_clear (sizeof *zst);
+          init_compress (zfx, zst);
+          zfx->status = 2;
+        }
+
+      zst->in.src = buf;
+      zst->in.size = size;
+      zst->in.pos = 0;
+      rc = do_compress (zfx, zst, ZSTD_e_continue, a);
+    }
+  else if (control == IOBUFCTRL_FREE)
+    {
+      if (zfx->status == 1)
+        {
+          ZSTD_freeDCtx (zst->dctx);
+          xfree (zst);
+          zfx->opaque = NULL;
+          xfree (zfx->inbuf); zfx->inbuf = NULL;
+        }
+      else if (zfx->status == 2)
+        {
+          zst->in.src = buf;
+          zst->in.size = 0;
+          zst->in.pos = 0;
+          do_compress (zfx, zst, ZSTD_e_end, a);
+          ZSTD_freeCCtx (zst->cctx);
+          xfree (zst);
+          zfx->opaque = NULL;
+          xfree (zfx->outbuf); zfx->outbuf = NULL;
+        }
+      if (zfx->release)
+        zfx->release (zfx);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "compress_filter", *ret_len);
+  return rc;
+}
@@ -33,6 +33,7 @@
 #ifdef HAVE_ZIP
 # include <zlib.h>
 #endif
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -52,22 +53,74 @@
 
 int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
+int compress_filter_zstd (void *opaque, int control,
+                          IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
-static void
-init_compress( compress_filter_context_t *zfx, z_stream *zs )
+
+/* The size of the blocks deflated in parallel.  This is the default
+ * block size of pigz.  */
+#define PAR_BLOCKSIZE (128*1024)
+
+/* The amount of preceding data used to prime the compressor of each
+ * block.  This is the largest deflate window.  */
+#define PAR_DICTSIZE  (32*1024)
+
+
+/* A slot to deflate one block on a separate thread.  */
+struct deflate_job_s
 {
-    int rc;
-    int level;
+  npth_t thread;             /* The thread processing this slot.  */
+  unsigned int running:1;    /* THREAD has been started.  */
+  unsigned int pending:1;    /* The output has not yet been written.  */
+  unsigned int last:1;       /* This is the final block.  */
+  int algo;                  /* COMPRESS_ALGO_ZIP or COMPRESS_ALGO_ZLIB.  */
+  int level;                 /* The compression level.  */
+  byte *inbuf;               /* The data to compress.  */
+  size_t inlen;              /* Used length of INBUF.  */
+  byte *dict;                /* The data preceding INBUF.  */
+  size_t dictlen;            /* Used length of DICT.  */
+  byte *outbuf;              /* The deflated data.  */
+  size_t outsize;            /* Allocated size of OUTBUF.  */
+  size_t outlen;             /* Used length of OUTBUF.  */
+  uLong adler;               /* The Adler-32 checksum of INBUF.  */
+  int zrc;                   /* The zlib return code.  */
+};
+
+
+/* The state of the parallel compressor.  It is stored at the OPAQUE
+ * field of the compress filter context with STATUS set to 3.  */
+struct deflate_par_s
+{
+  struct deflate_job_s *jobs;
+  unsigned int njobs;
+  unsigned int curjob;
+  byte *dict;                /* The tail of the last submitted block.  */
+  size_t dictlen;
+  uLong adler;               /* The running Adler-32 checksum.  */
+};
+
 
+/* Return the zlib compression level to use.  */
+static int
+get_compress_level (void)
+{
     if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
+	return opt.compress_level;
     else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
+	return Z_DEFAULT_COMPRESSION;
     else {
 	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
+	return Z_DEFAULT_COMPRESSION;
     }
+}
+
+
+static void
+init_compress( compress_filter_context_t *zfx, z_stream *zs )
+{
+    int rc;
+    int level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -212,6 +265,285 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
     return rc;
 }
 
+/* Deflate the block in JOB.  This creates a raw deflate stream which
+ * is primed with the preceding data.  All but the last block end with
+ * a sync flush so that the blocks can simply be concatenated; the
+ * last one terminates the deflate stream.  This is the approach used
+ * by pigz.  */
+static void
+deflate_job (struct deflate_job_s *job)
+{
+  z_stream zs;
+  int zrc;
+
+  memset (&zs, 0, sizeof zs);
+  zrc = deflateInit2 (&zs, job->level, Z_DEFLATED,
+                      job->algo == COMPRESS_ALGO_ZIP? -13 : -15,
+                      8, Z_DEFAULT_STRATEGY);
+  if (zrc != Z_OK)
+    {
+      job->zrc = zrc;
+      return;
+    }
+  if (job->dictlen)
+    zrc = deflateSetDictionary (&zs, job->dict, job->dictlen);
+  if (zrc == Z_OK)
+    {
+      zs.next_in = BYTEF_CAST (job->inbuf);
+      zs.avail_in = job->inlen;
+      zs.next_out = BYTEF_CAST (job->outbuf);
+      zs.avail_out = job->outsize;
+      /* OUTBUF has been sized so that one call is sufficient.  */
+      zrc = deflate (&zs, job->last? Z_FINISH : Z_SYNC_FLUSH);
+      if (job->last)
+        zrc = zrc == Z_STREAM_END? Z_OK : Z_BUF_ERROR;
+      else if (zrc == Z_OK && (zs.avail_in || !zs.avail_out))
+        zrc = Z_BUF_ERROR;
+      job->outlen = job->outsize - zs.avail_out;
+    }
+  deflateEnd (&zs);
+
+  if (job->algo == COMPRESS_ALGO_ZLIB)
+    job->adler = adler32 (adler32 (0, NULL, 0),
+                          BYTEF_CAST (job->inbuf), job->inlen);
+  job->zrc = zrc;
+}
+
+
+/* Thread function to deflate one block.  Only zlib is called and
+ * thus we can run it without holding the nPth lock.  */
+static void *
+deflate_job_thread (void *arg)
+{
+  struct deflate_job_s *job = arg;
+
+  npth_unprotect ();
+  deflate_job (job);
+  npth_protect ();
+  return NULL;
+}
+
+
+/* Release the parallel compressor PAR.  Running threads are joined
+ * first.  */
+static void
+release_deflate_par (struct deflate_par_s *par)
+{
+  unsigned int i;
+
+  if (!par)
+    return;
+
+  for (i = 0; i < par->njobs; i++)
+    {
+      struct deflate_job_s *job = par->jobs + i;
+
+      if (job->running)
+        npth_join (job->thread, NULL);
+      xfree (job->inbuf);
+      xfree (job->dict);
+      xfree (job->outbuf);
+    }
+  xfree (par->jobs);
+  xfree (par->dict);
+  xfree (par);
+}
+
+
+/* Create the parallel compressor for ZFX and write the zlib header
+ * to A if required.  */
+static struct deflate_par_s *
+init_compress_parallel (compress_filter_context_t *zfx, IOBUF a)
+{
+  struct deflate_par_s *par;
+  unsigned int i;
+  int level = get_compress_level ();
+
+  par = xmalloc_clear (sizeof *par);
+  par->njobs = opt.compress_threads;
+  par->jobs = xcalloc (par->njobs, sizeof *par->jobs);
+  par->dict = xmalloc (PAR_DICTSIZE);
+  for (i = 0; i < par->njobs; i++)
+    {
+      struct deflate_job_s *job = par->jobs + i;
+
+      job->algo = zfx->algo;
+      job->level = level;
+      job->inbuf = xmalloc (PAR_BLOCKSIZE);
+      job->dict = xmalloc (PAR_DICTSIZE);
+      /* The bound is for a zlib stream and thus also covers the 5
+       * bytes of the sync flush marker.  */
+      job->outsize = compressBound (PAR_BLOCKSIZE) + 64;
+      job->outbuf = xmalloc (job->outsize);
+    }
+
+  if (zfx->algo == COMPRESS_ALGO_ZLIB)
+    {
+      unsigned int header;
+      byte hdr[2];
+
+      /* Same as the header written by deflateInit.  */
+      header = (Z_DEFLATED + ((15 - 8) << 4)) << 8;
+      if (level == Z_DEFAULT_COMPRESSION)
+        level = 6;
+      if (level < 2)
+        ;
+      else if (level < 6)
+        header |= 1 << 6;
+      else if (level == 6)
+        header |= 2 << 6;
+      else
+        header |= 3 << 6;
+      header += 31 - (header % 31);
+      hdr[0] = header >> 8;
+      hdr[1] = header;
+      if (iobuf_write (a, hdr, 2))
+        log_bug ("iobuf_write failed for the zlib header\n");
+      par->adler = adler32 (0, NULL, 0);
+    }
+
+  if (DBG_FILTER)
+    log_debug ("using %u threads for deflate\n", par->njobs);
+  return par;
+}
+
+
+/* Wait for the job in the current slot to finish and write its
+ * output to A.  Does nothing if the slot has no pending output.  */
+static int
+finish_deflate_job (struct deflate_par_s *par, IOBUF a)
+{
+  struct deflate_job_s *job = par->jobs + par->curjob;
+  int rc;
+
+  if (!job->pending)
+    return 0;
+
+  if (job->running)
+    {
+      rc = npth_join (job->thread, NULL);
+      job->running = 0;
+      if (rc)
+        log_fatal ("error joining deflate thread: %s\n", strerror (rc));
+    }
+  job->pending = 0;
+  if (job->zrc != Z_OK)
+    log_fatal ("zlib deflate problem: rc=%d\n", job->zrc);
+
+  if (job->algo == COMPRESS_ALGO_ZLIB)
+    par->adler = adler32_combine (par->adler, job->adler, job->inlen);
+  job->inlen = 0;
+  if ((rc = iobuf_write (a, job->outbuf, job->outlen)))
+    {
+      log_debug ("deflate: iobuf_write failed\n");
+      return rc;
+    }
+  return 0;
+}
+
+
+/* Start deflating the block collected in the current slot and
+ * advance to the next slot.  If that slot is still busy its result
+ * is written to A first so that the blocks are emitted in order.  */
+static int
+submit_deflate_job (struct deflate_par_s *par, IOBUF a, int last)
+{
+  struct deflate_job_s *job = par->jobs + par->curjob;
+  npth_attr_t tattr;
+  size_t n;
+  int rc;
+
+  job->last = last;
+  memcpy (job->dict, par->dict, par->dictlen);
+  job->dictlen = par->dictlen;
+  n = job->inlen < PAR_DICTSIZE? job->inlen : PAR_DICTSIZE;
+  if (par->dictlen + n > PAR_DICTSIZE)
+    {
+      size_t keep = PAR_DICTSIZE - n;
+
+      memmove (par->dict, par->dict + par->dictlen - keep, keep);
+      par->dictlen = keep;
+    }
+  memcpy (par->dict + par->dictlen, job->inbuf + job->inlen - n, n);
+  par->dictlen += n;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&job->thread, &tattr, deflate_job_thread, job);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    deflate_job (job);  /* Fall back to doing the work on this thread.  */
+  else
+    job->running = 1;
+  job->pending = 1;
+
+  par->curjob = (par->curjob + 1) % par->njobs;
+  return finish_deflate_job (par, a);
+}
+
+
+/* The flush function used if blocks are deflated in parallel.  */
+static int
+do_compress_parallel (struct deflate_par_s *par, byte *buf, size_t size,
+                      IOBUF a)
+{
+  struct deflate_job_s *job;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      job = par->jobs + par->curjob;
+      n = PAR_BLOCKSIZE - job->inlen;
+      if (n > size)
+        n = size;
+      memcpy (job->inbuf + job->inlen, buf, n);
+      job->inlen += n;
+      buf += n;
+      size -= n;
+      if (job->inlen == PAR_BLOCKSIZE)
+        {
+          if ((rc = submit_deflate_job (par, a, 0)))
+            return rc;
+        }
+    }
+  return 0;
+}
+
+
+/* Deflate the last block, write all pending blocks and the zlib
+ * trailer if required.  */
+static int
+finish_compress_parallel (compress_filter_context_t *zfx,
+                          struct deflate_par_s *par, IOBUF a)
+{
+  unsigned int i;
+  int rc;
+
+  if ((rc = submit_deflate_job (par, a, 1)))
+    return rc;
+  for (i = 0; i < par->njobs; i++)
+    {
+      if ((rc = finish_deflate_job (par, a)))
+        return rc;
+      par->curjob = (par->curjob + 1) % par->njobs;
+    }
+
+  if (zfx->algo == COMPRESS_ALGO_ZLIB)
+    {
+      byte trailer[4];
+
+      trailer[0] = par->adler >> 24;
+      trailer[1] = par->adler >> 16;
+      trailer[2] = par->adler >> 8;
+      trailer[3] = par->adler;
+      if ((rc = iobuf_write (a, trailer, 4)))
+        return rc;
+    }
+  return 0;
+}
+
+
 static int
 compress_filter( void *opaque, int control,
 		 IOBUF a, byte *buf, size_t *ret_len)
@@ -251,14 +583,24 @@ compress_filter( void *opaque, int control,
 	    pkt.pkt.compressed = &cd;
 	    if( build_packet( a, &pkt ))
 		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+	    if (opt.compress_threads > 1) {
+		zfx->opaque = init_compress_parallel (zfx, a);
+		zfx->status = 3;
+	    }
+	    else {
+		zs = zfx->opaque = xmalloc_clear( sizeof *zs );
+		init_compress( zfx, zs );
+		zfx->status = 2;
+	    }
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if (zfx->status == 3)
+	    rc = do_compress_parallel (zfx->opaque, buf, size, a);
+	else {
+	    zs->next_in = BYTEF_CAST (buf);
+	    zs->avail_in = size;
+	    rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	}
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( zfx->status == 1 ) {
@@ -276,6 +618,11 @@ compress_filter( void *opaque, int control,
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 3 ) {
+	    rc = finish_compress_parallel (zfx, zfx->opaque, a);
+	    release_deflate_par (zfx->opaque);
+	    zfx->opaque = NULL;
+	}
         if (zfx->release)
           zfx->release (zfx);
     }
@@ -362,6 +709,13 @@ push_compress_filter2(IOBUF out,compress_filter_context_t *zfx,
       break;
 #endif
 
+#ifdef HAVE_ZSTD
+    case COMPRESS_ALGO_ZSTD:
+      iobuf_push_filter2(out,compress_filter_zstd,zfx,rel);
+      err = 0;
+      break;
+#endif
+
     default:
       BUG();
     }
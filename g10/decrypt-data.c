@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -40,6 +41,26 @@ static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
 static int decode_filter ( void *opaque, int control, IOBUF a,
 					byte *buf, size_t *ret_len);
 
+
+/* The largest chunk size for which we decrypt chunks in parallel.
+ * Each job slot needs a buffer of the chunk size.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (16*1024*1024)
+
+/* A slot to decrypt and authenticate one chunk on a separate
+ * thread.  */
+struct aead_dec_job_s
+{
+  gcry_cipher_hd_t cipher_hd;  /* The cipher handle used by this slot.  */
+  npth_t thread;               /* The thread processing this slot.  */
+  unsigned int running:1;      /* THREAD has been started.  */
+  byte *buffer;                /* Ciphertext and tag; plaintext after
+                                * decryption.  */
+  size_t datalen;              /* Length of the data part of BUFFER.  */
+  size_t outpos;               /* Number of plaintext bytes returned.  */
+  uint64_t chunkindex;         /* The index of the chunk.  */
+  gpg_error_t err;             /* The result of the job.  */
+};
+
 /* Our context object.  */
 struct decode_filter_context_s
 {
@@ -96,10 +117,51 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* If not NULL an array of NJOBS slots used to decrypt AEAD chunks
+   * in parallel.  HEADJOB is the oldest slot in use and NBUSY the
+   * number of slots in use.  */
+  struct aead_dec_job_s *jobs;
+  unsigned int njobs;
+  unsigned int headjob;
+  unsigned int nbusy;
+
+  /* Set in parallel mode after the final tag has been read into the
+   * holdback buffer.  */
+  unsigned int final_read : 1;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
 
+/* Release the job slots of DFX.  Running threads are joined first.  */
+static void
+aead_release_jobs (decode_filter_ctx_t dfx)
+{
+  unsigned int i;
+  int rc;
+
+  if (!dfx->jobs)
+    return;
+
+  for (i = 0; i < dfx->njobs; i++)
+    {
+      struct aead_dec_job_s *job = dfx->jobs + i;
+
+      if (job->running)
+        {
+          rc = npth_join (job->thread, NULL);
+          if (rc)
+            log_error ("error joining AEAD thread: %s\n", strerror (rc));
+        }
+      gcry_cipher_close (job->cipher_hd);
+      xfree (job->buffer);
+    }
+  xfree (dfx->jobs);
+  dfx->jobs = NULL;
+  dfx->njobs = dfx->nbusy = 0;
+}
+
+
 /* Helper to release the decode context.  */
 static void
 release_dfx_context (decode_filter_ctx_t dfx)
@@ -110,6 +172,7 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      aead_release_jobs (dfx);
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -119,12 +182,13 @@ release_dfx_context (decode_filter_ctx_t dfx)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  This
- * also reset the decryption machinery so that the handle can be
- * used for a new chunk.  If FINAL is set the final AEAD chunk is
- * processed.  */
+/* Set the nonce and the additional data for chunk CHUNKINDEX on the
+ * cipher handle HD.  This also reset the decryption machinery so that
+ * the handle can be used for a new chunk.  If FINAL is set the final
+ * AEAD chunk is processed.  */
 static gpg_error_t
-aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+aead_set_nonce_and_ad_hd (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                          uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char ad[21];
@@ -146,18 +210,18 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     default:
       BUG ();
     }
-  nonce[i++] ^= dfx->chunkindex >> 56;
-  nonce[i++] ^= dfx->chunkindex >> 48;
-  nonce[i++] ^= dfx->chunkindex >> 40;
-  nonce[i++] ^= dfx->chunkindex >> 32;
-  nonce[i++] ^= dfx->chunkindex >> 24;
-  nonce[i++] ^= dfx->chunkindex >> 16;
-  nonce[i++] ^= dfx->chunkindex >>  8;
-  nonce[i++] ^= dfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, i, "nonce:");
-  err = gcry_cipher_setiv (dfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -166,14 +230,14 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
   ad[2] = dfx->cipher_algo;
   ad[3] = dfx->aead_algo;
   ad[4] = dfx->chunkbyte;
-  ad[5] = dfx->chunkindex >> 56;
-  ad[6] = dfx->chunkindex >> 48;
-  ad[7] = dfx->chunkindex >> 40;
-  ad[8] = dfx->chunkindex >> 32;
-  ad[9] = dfx->chunkindex >> 24;
-  ad[10]= dfx->chunkindex >> 16;
-  ad[11]= dfx->chunkindex >>  8;
-  ad[12]= dfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = dfx->total >> 56;
@@ -187,7 +251,17 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (dfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Set the nonce and the additional data for the current chunk using
+ * the main cipher handle.  */
+static gpg_error_t
+aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+{
+  return aead_set_nonce_and_ad_hd (dfx, dfx->cipher_hd, dfx->chunkindex,
+                                   final);
 }
 
 
@@ -213,6 +287,52 @@ aead_checktag (decode_filter_ctx_t dfx, int final, const void *tagbuf)
 }
 
 
+/* Create the job slots used to decrypt chunks in parallel.  Each
+ * slot gets its own cipher handle using the key from DEK and the mode
+ * CIPHERMODE.  */
+static gpg_error_t
+aead_setup_jobs (decode_filter_ctx_t dfx, DEK *dek,
+                 enum gcry_cipher_modes ciphermode)
+{
+  gpg_error_t err = 0;
+  unsigned int i;
+
+  dfx->jobs = xtrycalloc (opt.aead_threads, sizeof *dfx->jobs);
+  if (!dfx->jobs)
+    return gpg_error_from_syserror ();
+  dfx->njobs = opt.aead_threads;
+  dfx->headjob = dfx->nbusy = 0;
+
+  for (i = 0; i < dfx->njobs && !err; i++)
+    {
+      struct aead_dec_job_s *job = dfx->jobs + i;
+
+      /* We need room for the chunk, its tag and the 32 bytes we read
+       * ahead to detect the last chunk.  */
+      job->buffer = xtrymalloc (dfx->chunksize + 48);
+      if (!job->buffer)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      err = openpgp_cipher_open (&job->cipher_hd, dfx->cipher_algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (!err)
+        {
+          err = gcry_cipher_setkey (job->cipher_hd, dek->key, dek->keylen);
+          if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+            err = 0;  /* Already reported for the main handle.  */
+        }
+    }
+  if (err)
+    aead_release_jobs (dfx);
+  else if (DBG_FILTER)
+    log_debug ("using %u threads for AEAD decryption\n", dfx->njobs);
+
+  return err;
+}
+
+
 /****************
  * Decrypt the data, specified by ED with the key DEK.  On return
  * COMPLIANCE_ERROR is set to true iff the decryption can claim that
@@ -384,6 +504,13 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
           goto leave;
         }
 
+      if (opt.aead_threads > 1
+          && dfx->chunksize <= AEAD_MAX_PARALLEL_CHUNKSIZE)
+        {
+          rc = aead_setup_jobs (dfx, dek, ciphermode);
+          if (rc)
+            goto leave;
+        }
     }
   else /* CFB encryption.  */
     {
@@ -863,6 +990,221 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
 }
 
 
+/* Decrypt the chunk in JOB and check its tag.  The nonce and the
+ * additional data have already been set.  */
+static void
+aead_decrypt_job (struct aead_dec_job_s *job)
+{
+  job->err = gcry_cipher_final (job->cipher_hd);
+  if (!job->err)
+    job->err = gcry_cipher_decrypt (job->cipher_hd, job->buffer, job->datalen,
+                                    NULL, 0);
+  if (!job->err)
+    job->err = gcry_cipher_checktag (job->cipher_hd,
+                                     job->buffer + job->datalen, 16);
+}
+
+
+/* Thread function to decrypt one chunk.  Only Libgcrypt is called
+ * and thus we can run it without holding the nPth lock.  */
+static void *
+aead_decrypt_job_thread (void *arg)
+{
+  struct aead_dec_job_s *job = arg;
+
+  npth_unprotect ();
+  aead_decrypt_job (job);
+  npth_protect ();
+  return NULL;
+}
+
+
+/* Read the next chunk from A into a free slot and start a thread to
+ * decrypt and authenticate it.  As with aead_underflow we need to
+ * read ahead 32 bytes to detect the last chunk; these bytes are kept
+ * in the holdback buffer.  FINAL_READ is set once only the final tag
+ * is left in the holdback buffer.  */
+static gpg_error_t
+aead_read_job (decode_filter_ctx_t dfx, iobuf_t a)
+{
+  gpg_error_t err;
+  struct aead_dec_job_s *job;
+  npth_attr_t tattr;
+  size_t n, take;
+  int rc;
+
+  job = dfx->jobs + (dfx->headjob + dfx->nbusy) % dfx->njobs;
+  n = dfx->holdbacklen;
+  memcpy (job->buffer, dfx->holdback, n);
+  dfx->holdbacklen = 0;
+  if (!dfx->eof_seen)
+    n = fill_buffer (dfx, a, job->buffer, dfx->chunksize + 48, n);
+
+  if (!dfx->eof_seen || n > dfx->chunksize + 32)
+    take = dfx->chunksize + 16;  /* A full chunk and more data follows.  */
+  else if (n >= 32)
+    take = n - 16;  /* The last chunk; only the final tag follows.  */
+  else if (n == 16)
+    take = 0;       /* Only the final tag is left.  */
+  else
+    return gpg_error (GPG_ERR_TRUNCATED);
+
+  dfx->holdbacklen = n - take;
+  memcpy (dfx->holdback, job->buffer + take, dfx->holdbacklen);
+  if (dfx->eof_seen && dfx->holdbacklen == 16)
+    dfx->final_read = 1;
+  if (!take)
+    return 0;
+
+  job->datalen = take - 16;
+  job->outpos = 0;
+  job->chunkindex = dfx->chunkindex;
+  err = aead_set_nonce_and_ad_hd (dfx, job->cipher_hd, job->chunkindex, 0);
+  if (err)
+    return err;
+  dfx->chunkindex++;
+  dfx->total += job->datalen;
+  dfx->nbusy++;
+
+  if (DBG_FILTER)
+    log_debug ("submitting chunk %llu (%zu bytes)\n",
+               (unsigned long long)job->chunkindex, job->datalen);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&job->thread, &tattr, aead_decrypt_job_thread, job);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    aead_decrypt_job (job);  /* Do it on the main thread.  */
+  else
+    job->running = 1;
+
+  return 0;
+}
+
+
+/* Wait for the oldest job to finish.  On error the plaintext of that
+ * chunk is wiped.  */
+static gpg_error_t
+aead_finish_job (decode_filter_ctx_t dfx)
+{
+  struct aead_dec_job_s *job = dfx->jobs + dfx->headjob;
+  gpg_error_t err;
+  int rc;
+
+  if (job->running)
+    {
+      rc = npth_join (job->thread, NULL);
+      job->running = 0;
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          log_error ("error joining AEAD thread: %s\n", gpg_strerror (err));
+          job->err = err;
+        }
+    }
+  err = job->err;
+  if (err)
+    {
+      log_error ("decrypting chunk %llu failed: %s\n",
+                 (unsigned long long)job->chunkindex, gpg_strerror (err));
+      wipememory (job->buffer, job->datalen);
+    }
+  else if (DBG_FILTER)
+    log_debug ("tag of chunk %llu is valid\n",
+               (unsigned long long)job->chunkindex);
+  return err;
+}
+
+
+/* The underflow function of the aead_decode_filter used if chunks are
+ * decrypted in parallel.  Several chunks are read ahead and handed to
+ * threads.  Plaintext is returned strictly in order and only after
+ * the tag of its chunk has been verified.  */
+static gpg_error_t
+aead_underflow_parallel (decode_filter_ctx_t dfx, iobuf_t a,
+                         byte *buf, size_t *ret_len)
+{
+  const size_t size = *ret_len; /* The allocated size of BUF.  */
+  gpg_error_t err = 0;
+  size_t totallen = 0;
+  struct aead_dec_job_s *job;
+  size_t n;
+
+  while (totallen < size)
+    {
+      /* Keep all slots busy.  */
+      while (!dfx->final_read && dfx->nbusy < dfx->njobs)
+        {
+          err = aead_read_job (dfx, a);
+          if (err)
+            goto leave;
+        }
+      if (!dfx->nbusy)
+        break;  /* All chunks have been returned.  */
+
+      job = dfx->jobs + dfx->headjob;
+      if (!job->outpos)  /* Not yet checked.  */
+        {
+          err = aead_finish_job (dfx);
+          if (err)
+            goto leave;
+        }
+      n = job->datalen - job->outpos;
+      if (n > size - totallen)
+        n = size - totallen;
+      memcpy (buf + totallen, job->buffer + job->outpos, n);
+      job->outpos += n;
+      totallen += n;
+      if (job->outpos == job->datalen)
+        {
+          /* We are done with this slot.  */
+          dfx->headjob = (dfx->headjob + 1) % dfx->njobs;
+          dfx->nbusy--;
+        }
+    }
+
+  if (!dfx->nbusy && dfx->final_read)
+    {
+      /* All chunks have been returned; check the final chunk.  */
+      if (DBG_FILTER)
+        log_debug ("eof seen: holdback has the final tag\n");
+      err = aead_set_nonce_and_ad (dfx, 1);
+      if (err)
+        goto leave;
+      gcry_cipher_final (dfx->cipher_hd);
+      /* Decrypt an empty string (using HOLDBACK as a dummy).  */
+      err = gcry_cipher_decrypt (dfx->cipher_hd, dfx->holdback, 0, NULL, 0);
+      if (err)
+        {
+          log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                     gpg_strerror (err));
+          goto leave;
+        }
+      err = aead_checktag (dfx, 1, dfx->holdback);
+      if (err)
+        goto leave;
+      aead_release_jobs (dfx);
+      err = gpg_error (GPG_ERR_EOF);
+    }
+
+ leave:
+  if (DBG_FILTER)
+    log_debug ("aead_underflow_parallel: returning %zu (%s)\n",
+               totallen, gpg_strerror (err));
+
+  /* See aead_underflow.  */
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    memset (buf, 0, size);
+
+  *ret_len = totallen;
+
+  return err;
+}
+
+
 /* The IOBUF filter used to decrypt AEAD encrypted data.  */
 static int
 aead_decode_filter (void *opaque, int control, IOBUF a,
@@ -871,11 +1213,19 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen && !dfx->jobs )
     {
       *ret_len = 0;
       rc = -1;
     }
+  else if ( control == IOBUFCTRL_UNDERFLOW && dfx->jobs )
+    {
+      log_assert (a);
+
+      rc = aead_underflow_parallel (dfx, a, buf, ret_len);
+      if (gpg_err_code (rc) == GPG_ERR_EOF)
+        rc = -1; /* We need to use the old convention in the filter.  */
+    }
   else if ( control == IOBUFCTRL_UNDERFLOW )
     {
       log_assert (a);
@@ -88,6 +88,10 @@ struct compress_filter_context_s {
 typedef struct compress_filter_context_s compress_filter_context_t;
 
 
+/* Object used by cipher-aead.c to encrypt chunks in parallel.  */
+struct aead_enc_job_s;
+
+
 typedef struct
 {
   /* Object with the key and algo */
@@ -134,6 +138,13 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* If not NULL an array of NJOBS slots used to encrypt AEAD chunks
+   * in parallel.  CURJOB is the slot being filled; the slots are
+   * used as a ring so that the next slot is always the oldest.  */
+  struct aead_enc_job_s *jobs;
+  unsigned int njobs;
+  unsigned int curjob;
+
 } cipher_filter_context_t;
 
 
@@ -445,6 +445,123 @@ leave:
 }
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Object used by getkey_prefetch_pubkeys.  */
+struct prefetch_parm_s
+{
+  ctrl_t ctrl;
+  u32 (*keyids)[2];
+  size_t nkeyids;
+};
+
+
+/* Callback for keydb_lookup_keyblocks used by
+ * getkey_prefetch_pubkeys.  */
+static gpg_error_t
+prefetch_pubkeys_cb (void *opaque, kbnode_t keyblock)
+{
+  struct prefetch_parm_s *parm = opaque;
+  kbnode_t node, k, found_key;
+  PKT_public_key pk;
+  u32 kid[2];
+  size_t n;
+
+  merge_selfsigs (parm->ctrl, keyblock);
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      keyid_from_pk (node->pkt->pkt.public_key, kid);
+      for (n = 0; n < parm->nkeyids; n++)
+        if (parm->keyids[n][0] == kid[0] && parm->keyids[n][1] == kid[1])
+          break;
+      if (n == parm->nkeyids)
+        continue;  /* Not requested.  */
+
+      /* Do what get_pubkey does for the exact key id lookup.  */
+      for (k = keyblock; k; k = k->next)
+        k->flag &= ~3;
+      node->flag |= 1;
+      found_key = finish_lookup (keyblock, 0, 1, 0, NULL);
+      if (found_key)
+        {
+          memset (&pk, 0, sizeof pk);
+          pk_from_block (&pk, keyblock, found_key);
+          cache_public_key (&pk);
+          release_public_key_parts (&pk);
+        }
+    }
+  return 0;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
+/* Fetch the public keys with the key ids (KEYIDS,NKEYIDS) from the
+ * database using a single request and store them in the public key
+ * cache.  This is used before many keys are looked up using
+ * get_pubkey so that a round trip to the keyboxd is not required for
+ * each of them.  Keys already in the cache are not fetched again.
+ * This is only an optimization; thus errors are ignored and nothing
+ * is done if the keyboxd is not used.  */
+void
+getkey_prefetch_pubkeys (ctrl_t ctrl, u32 (*keyids)[2], size_t nkeyids)
+{
+#if MAX_PK_CACHE_ENTRIES
+  struct prefetch_parm_s parm;
+  KEYDB_SEARCH_DESC *desc;
+  KEYDB_HANDLE hd;
+  pk_cache_entry_t ce;
+  size_t n, ndesc;
+  gpg_error_t err;
+
+  if (!opt.use_keyboxd || pk_cache_disabled || nkeyids < 2)
+    return;
+
+  /* It does not make sense to fetch more than the cache can hold.  */
+  if (nkeyids > MAX_PK_CACHE_ENTRIES / 2)
+    nkeyids = MAX_PK_CACHE_ENTRIES / 2;
+
+  desc = xtrycalloc (nkeyids, sizeof *desc);
+  if (!desc)
+    return;
+  for (ndesc = n = 0; n < nkeyids; n++)
+    {
+      for (ce = pk_cache; ce; ce = ce->next)
+        if (ce->keyid[0] == keyids[n][0] && ce->keyid[1] == keyids[n][1])
+          break;
+      if (ce)
+        continue;  /* Already cached.  */
+      desc[ndesc].mode = KEYDB_SEARCH_MODE_LONG_KID;
+      desc[ndesc].u.kid[0] = keyids[n][0];
+      desc[ndesc].u.kid[1] = keyids[n][1];
+      ndesc++;
+    }
+  if (ndesc < 2)
+    goto leave;  /* A batch is not worth the effort.  */
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    goto leave;
+  parm.ctrl = ctrl;
+  parm.keyids = keyids;
+  parm.nkeyids = nkeyids;
+  err = keydb_lookup_keyblocks (hd, desc, ndesc, prefetch_pubkeys_cb, &parm);
+  if (err && DBG_LOOKUP)
+    log_debug ("%s: lookup of %zu keys failed: %s\n",
+               __func__, ndesc, gpg_strerror (err));
+  keydb_release (hd);
+
+ leave:
+  xfree (desc);
+#else
+  (void)ctrl;
+  (void)keyids;
+  (void)nkeyids;
+#endif /*!MAX_PK_CACHE_ENTRIES*/
+}
+
+
 /* Same as get_pubkey but if the key was not found the function tries
  * to import it from LDAP.  FIXME: We should not need this but swicth
  * to a fingerprint lookup.  */
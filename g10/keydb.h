@@ -204,6 +204,13 @@ gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
                           size_t ndesc, size_t *descindex);
 
+/* Look up the keyblocks for many search descriptions at once.  */
+gpg_error_t keydb_lookup_keyblocks (KEYDB_HANDLE hd,
+                                    KEYDB_SEARCH_DESC *desc, size_t ndesc,
+                                    gpg_error_t (*cb)(void *opaque,
+                                                      kbnode_t keyblock),
+                                    void *cb_value);
+
 
 
 /*-- keydb.c --*/
@@ -337,6 +344,9 @@ gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
 /* Return the public key with the key id KEYID and store it at PK.  */
 int get_pubkey (ctrl_t ctrl, PKT_public_key *pk, u32 *keyid);
 
+/* Fetch many public keys at once into the public key cache.  */
+void getkey_prefetch_pubkeys (ctrl_t ctrl, u32 (*keyids)[2], size_t nkeyids);
+
 /* Same as get_pubkey but with auto LDAP fetch.  */
 gpg_error_t get_pubkey_with_ldap_fallback (ctrl_t ctrl,
                                            PKT_public_key *pk, u32 * keyid);
@@ -2232,6 +2232,55 @@ reorder_keyblock (KBNODE keyblock)
 }
 
 
+/* Fetch the keys of all signers of KEYBLOCK at once so that listing
+ * the signatures does not require a database request for each of
+ * them.  */
+static void
+prefetch_signer_keys (ctrl_t ctrl, kbnode_t keyblock)
+{
+  kbnode_t node;
+  PKT_signature *sig;
+  u32 mainkid[2];
+  u32 (*keyids)[2] = NULL;
+  void *tmp;
+  size_t n, nkeyids = 0, size = 0;
+
+  if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, mainkid);
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (sig->keyid[0] == mainkid[0] && sig->keyid[1] == mainkid[1])
+        continue;  /* Self-signature.  */
+      for (n = 0; n < nkeyids; n++)
+        if (keyids[n][0] == sig->keyid[0] && keyids[n][1] == sig->keyid[1])
+          break;
+      if (n < nkeyids)
+        continue;  /* Already listed.  */
+      if (nkeyids == size)
+        {
+          size += 64;
+          tmp = xtryrealloc (keyids, size * sizeof *keyids);
+          if (!tmp)
+            goto leave;
+          keyids = tmp;
+        }
+      keyids[nkeyids][0] = sig->keyid[0];
+      keyids[nkeyids][1] = sig->keyid[1];
+      nkeyids++;
+    }
+
+  getkey_prefetch_pubkeys (ctrl, keyids, nkeyids);
+
+ leave:
+  xfree (keyids);
+}
+
+
 static void
 list_keyblock (ctrl_t ctrl,
                KBNODE keyblock, int secret, int has_secret, int fpr,
@@ -2257,6 +2306,9 @@ list_keyblock (ctrl_t ctrl,
         return;  /* Skip this one.  */
     }
 
+  if (opt.list_sigs && opt.use_keyboxd)
+    prefetch_signer_keys (ctrl, keyblock);
+
   if (opt.with_colons)
     list_keyblock_colon (ctrl, keyblock, secret, has_secret);
   else if ((opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
@@ -259,6 +259,13 @@ int clearsign_file (ctrl_t ctrl,
                     const char *fname, strlist_t locusr, const char *outfile);
 int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
 
+/*-- sig-cache.c --*/
+void sig_cache_dump_stats (void);
+int sig_cache_lookup (PKT_public_key *pk, PKT_signature *sig,
+                      gcry_md_hd_t digest, byte *key);
+void sig_cache_put (const byte *key);
+void sig_cache_flush (void);
+
 /*-- sig-check.c --*/
 void sig_check_dump_stats (void);
 
@@ -282,6 +289,14 @@ int check_key_signature2 (ctrl_t ctrl, kbnode_t root, kbnode_t node,
                           PKT_public_key *check_pk, PKT_public_key *ret_pk,
                           int *is_selfsig, u32 *r_expiredate, int *r_expired);
 
+/* Verify user ID certifications of several keyblocks in parallel and
+   cache the results in the signature packets.  */
+void check_uid_certs_parallel (ctrl_t ctrl, kbnode_t *keyblocks,
+                               unsigned int nkeyblocks,
+                               int (*filter)(void *opaque, kbnode_t keyblock,
+                                             PKT_signature *sig),
+                               void *opaque, int nthreads);
+
 /* Returns whether SIGNER generated the signature SIG over the packet
    PACKET, which is a key, subkey or uid, and comes from the key block
    KB.  If SIGNER is NULL, it is looked up based on the information in
@@ -1321,6 +1321,12 @@ compress_algo_to_string(int algo)
       s="BZIP2";
       break;
 #endif
+
+#ifdef HAVE_ZSTD
+    case COMPRESS_ALGO_ZSTD:
+      s="ZSTD";
+      break;
+#endif
     }
 
   return s;
@@ -1343,6 +1349,10 @@ string_to_compress_algo(const char *string)
 #ifdef HAVE_BZIP2
   else if(ascii_strcasecmp(string,"bzip2")==0)
     return 3;
+#endif
+#ifdef HAVE_ZSTD
+  else if(ascii_strcasecmp(string,"zstd")==0)
+    return COMPRESS_ALGO_ZSTD;
 #endif
   else if(ascii_strcasecmp(string,"z0")==0)
     return 0;
@@ -1370,6 +1380,9 @@ check_compress_algo(int algo)
 #endif
 #ifdef HAVE_BZIP2
     case 3: return 0;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ALGO_ZSTD: return 0;
 #endif
     default: return GPG_ERR_COMPR_ALGO;
     }
@@ -62,6 +62,10 @@ struct
   /* The AEAD chunk size expressed as a power of 2.  */
   int chunk_size;
 
+  /* Number of threads used to process AEAD chunks in parallel.  A
+   * value of 0 or 1 processes the chunks on the main thread.  */
+  int aead_threads;
+
   int dry_run;
   int autostart;
   int list_only;
@@ -102,6 +106,7 @@ struct
   int compress_level;
   int bz2_compress_level;
   int bz2_decompress_lowmem;
+  int compress_threads;  /* Number of threads used for compression.  */
   strlist_t def_secret_key;
   char *def_recipient;
   int def_recipient_self;
@@ -125,6 +130,7 @@ struct
   int marginals_needed;
   int completes_needed;
   int max_cert_depth;
+  int trustdb_threads;   /* Number of threads for validate_keys.  */
   const char *agent_program;
   const char *keyboxd_program;
   const char *dirmngr_program;
@@ -216,6 +222,7 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  int persistent_sig_cache;
   int no_auto_check_trustdb;
   int preserve_permissions;
   int no_homedir_creation;
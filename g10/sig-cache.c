@@ -0,0 +1,462 @@
+/* sig-cache.c - Persistent cache for verified key signatures
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The flags.checked and flags.valid bits of a signature packet are
+ * only kept as long as the keyblock is in memory (and, for keyrings,
+ * in the ring trust packets).  This module stores the fact that a key
+ * signature has been verified successfully in the file
+ * "sigcache.dat" in the home directory so that the public key
+ * operation can be skipped the next time the same signature is
+ * checked.
+ *
+ * Each entry is the SHA-256 hash over the fingerprint of the signing
+ * key, the digest of the signed data (which includes the hashed
+ * subpackets of the signature) and the signature values.  Thus an
+ * entry can only match if exactly the same key verified exactly the
+ * same signature over exactly the same data.  Only good signatures
+ * are stored.
+ *
+ * The file starts with an 8 byte magic followed by the entries.  New
+ * entries are appended at exit while holding a dotlock on the file.
+ * If the file grows too large or its length does not match a whole
+ * number of entries, a new file is written and renamed over the old
+ * one.  Readers don't take the lock; they ignore a partial entry at
+ * the end of the file, as seen while another process is appending.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/i18n.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "main.h"
+#include "options.h"
+
+#define SIG_CACHE_FILENAME "sigcache.dat"
+#define SIG_CACHE_MAGIC    "GPGSC\x01\x00\x00"
+#define SIG_CACHE_KEYLEN   32
+
+/* The maximum number of entries we keep in the file.  */
+#define SIG_CACHE_MAX_ENTRIES (1024*1024)
+
+
+/* The hash table; open addressing with linear probing.  TABLE_SIZE
+ * is a power of 2 and the table is never more than half full.  An
+ * all zero key marks an empty slot.  */
+static byte (*cache_table)[SIG_CACHE_KEYLEN];
+static size_t cache_table_size;
+static size_t cache_table_used;
+
+/* The entries added since the file has been loaded.  */
+static byte (*new_items)[SIG_CACHE_KEYLEN];
+static size_t new_items_size;
+static size_t new_items_used;
+
+/* The number of entries read from the file.  */
+static size_t file_entries;
+
+/* Set after the file has been loaded.  */
+static int cache_loaded;
+
+/* Statistics.  */
+static unsigned int cache_hits;
+static unsigned int cache_misses;
+
+
+/* Dump stats.  */
+void
+sig_cache_dump_stats (void)
+{
+  if (!cache_loaded)
+    return;
+  log_info ("sig_cache_file: entries=%zu new=%zu hits=%u misses=%u\n",
+            cache_table_used, new_items_used, cache_hits, cache_misses);
+}
+
+
+/* Insert KEY into the hash table.  Returns true if it was not yet
+ * in the table.  */
+static int
+table_insert (const byte *key)
+{
+  size_t idx, mask;
+
+  if ((cache_table_used + 1) * 2 > cache_table_size)
+    {
+      byte (*oldtable)[SIG_CACHE_KEYLEN] = cache_table;
+      size_t oldsize = cache_table_size;
+      size_t i;
+
+      cache_table_size = oldsize? oldsize * 2 : 1024;
+      cache_table = xcalloc (cache_table_size, SIG_CACHE_KEYLEN);
+      cache_table_used = 0;
+      for (i = 0; i < oldsize; i++)
+        if (oldtable[i][0] || memcmp (oldtable[i], oldtable[i] + 1,
+                                      SIG_CACHE_KEYLEN - 1))
+          table_insert (oldtable[i]);
+      xfree (oldtable);
+    }
+
+  mask = cache_table_size - 1;
+  idx = buf32_to_size_t (key) & mask;
+  for (;;)
+    {
+      byte *slot = cache_table[idx];
+
+      if (!memcmp (slot, key, SIG_CACHE_KEYLEN))
+        return 0;
+      if (!slot[0] && !memcmp (slot, slot + 1, SIG_CACHE_KEYLEN - 1))
+        {
+          memcpy (slot, key, SIG_CACHE_KEYLEN);
+          cache_table_used++;
+          return 1;
+        }
+      idx = (idx + 1) & mask;
+    }
+}
+
+
+/* Return true if KEY is in the hash table.  */
+static int
+table_lookup (const byte *key)
+{
+  size_t idx, mask;
+
+  if (!cache_table_size)
+    return 0;
+
+  mask = cache_table_size - 1;
+  idx = buf32_to_size_t (key) & mask;
+  for (;;)
+    {
+      byte *slot = cache_table[idx];
+
+      if (!memcmp (slot, key, SIG_CACHE_KEYLEN))
+        return 1;
+      if (!slot[0] && !memcmp (slot, slot + 1, SIG_CACHE_KEYLEN - 1))
+        return 0;
+      idx = (idx + 1) & mask;
+    }
+}
+
+
+/* Load the cache file.  Errors are not fatal; we start with an
+ * empty cache in this case.  */
+static void
+load_cache (void)
+{
+  char *fname;
+  estream_t fp;
+  byte magic[8];
+  byte key[SIG_CACHE_KEYLEN];
+  size_t nread;
+
+  cache_loaded = 1;
+  fname = make_filename (gnupg_homedir (), SIG_CACHE_FILENAME, NULL);
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_info (_("can't open '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  if (es_read (fp, magic, sizeof magic, &nread)
+      || nread != sizeof magic || memcmp (magic, SIG_CACHE_MAGIC, 8))
+    {
+      if (opt.verbose)
+        log_info ("ignoring invalid signature cache '%s'\n", fname);
+      /* Make sure that sig_cache_flush rewrites the file.  */
+      file_entries = SIG_CACHE_MAX_ENTRIES;
+    }
+  else
+    {
+      while (!es_read (fp, key, sizeof key, &nread) && nread == sizeof key)
+        {
+          table_insert (key);
+          file_entries++;
+        }
+      if (DBG_CACHE)
+        log_debug ("sig_cache: loaded %zu entries from '%s'%s\n",
+                   file_entries, fname,
+                   (nread && nread < sizeof key)?
+                   " (partial entry ignored)" : "");
+    }
+
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Compute the cache key for the signature SIG made by PK.  DIGEST
+ * is the finalized hash context of the signed data.  Returns false
+ * if no key can be computed.  */
+static int
+compute_key (byte *key, PKT_public_key *pk, PKT_signature *sig,
+             gcry_md_hd_t digest)
+{
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  const byte *dig;
+  unsigned int diglen;
+  int i, nsig;
+
+  dig = gcry_md_read (digest, sig->digest_algo);
+  diglen = gcry_md_get_algo_dlen (sig->digest_algo);
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  if (!dig || !diglen || !nsig)
+    return 0;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 0;
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, pk->version);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_write (md, dig, diglen);
+  gcry_md_putc (md, sig->pubkey_algo);
+  for (i = 0; i < nsig; i++)
+    {
+      const void *p;
+      unsigned int nbits;
+      unsigned char *buf;
+      size_t buflen;
+
+      if (!sig->data[i])
+        {
+          gcry_md_close (md);
+          return 0;
+        }
+      if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          p = gcry_mpi_get_opaque (sig->data[i], &nbits);
+          buflen = (nbits + 7) / 8;
+          gcry_md_putc (md, buflen >> 8);
+          gcry_md_putc (md, buflen);
+          gcry_md_write (md, p, buflen);
+        }
+      else if (!gcry_mpi_aprint (GCRYMPI_FMT_USG, &buf, &buflen,
+                                 sig->data[i]))
+        {
+          gcry_md_putc (md, buflen >> 8);
+          gcry_md_putc (md, buflen);
+          gcry_md_write (md, buf, buflen);
+          gcry_free (buf);
+        }
+      else
+        {
+          gcry_md_close (md);
+          return 0;
+        }
+    }
+
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA256), SIG_CACHE_KEYLEN);
+  gcry_md_close (md);
+  return 1;
+}
+
+
+/* Return true if the key signature SIG made by PK over the data
+ * hashed into DIGEST is known to be good.  On a cache miss the key
+ * is stored at KEY, which must provide SIG_CACHE_KEYLEN bytes, and
+ * false is returned.  KEY[0] is set to 0 and the rest of KEY cleared
+ * if the signature can't be cached.  */
+int
+sig_cache_lookup (PKT_public_key *pk, PKT_signature *sig,
+                  gcry_md_hd_t digest, byte *key)
+{
+  memset (key, 0, SIG_CACHE_KEYLEN);
+  if (!opt.persistent_sig_cache || opt.no_sig_cache)
+    return 0;
+
+  if (!cache_loaded)
+    load_cache ();
+
+  if (!compute_key (key, pk, sig, digest))
+    {
+      memset (key, 0, SIG_CACHE_KEYLEN);
+      return 0;
+    }
+
+  if (table_lookup (key))
+    {
+      cache_hits++;
+      return 1;
+    }
+  cache_misses++;
+  return 0;
+}
+
+
+/* Record that the signature identified by KEY, as returned by
+ * sig_cache_lookup, has been verified successfully.  */
+void
+sig_cache_put (const byte *key)
+{
+  if (!cache_loaded)
+    return;
+  if (!key[0] && !memcmp (key, key + 1, SIG_CACHE_KEYLEN - 1))
+    return;  /* Not cacheable.  */
+
+  if (!table_insert (key))
+    return;  /* Already known.  */
+
+  if (new_items_used == new_items_size)
+    {
+      new_items_size = new_items_size? new_items_size * 2 : 256;
+      new_items = xrealloc (new_items, new_items_size * SIG_CACHE_KEYLEN);
+    }
+  memcpy (new_items[new_items_used++], key, SIG_CACHE_KEYLEN);
+}
+
+
+/* Write all entries of the hash table, or if there are too many of
+ * them only the new entries, to the new file FP.  */
+static gpg_error_t
+write_all_entries (estream_t fp)
+{
+  size_t i;
+
+  if (es_write (fp, SIG_CACHE_MAGIC, 8, NULL))
+    return gpg_error_from_syserror ();
+
+  if (cache_table_used > SIG_CACHE_MAX_ENTRIES)
+    {
+      if (new_items_used > SIG_CACHE_MAX_ENTRIES)
+        new_items_used = SIG_CACHE_MAX_ENTRIES;
+      if (es_write (fp, new_items, new_items_used * SIG_CACHE_KEYLEN, NULL))
+        return gpg_error_from_syserror ();
+      return 0;
+    }
+
+  for (i = 0; i < cache_table_size; i++)
+    if ((cache_table[i][0] || memcmp (cache_table[i], cache_table[i] + 1,
+                                      SIG_CACHE_KEYLEN - 1))
+        && es_write (fp, cache_table[i], SIG_CACHE_KEYLEN, NULL))
+      return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Write the new entries to the cache file.  This is called at
+ * exit.  */
+void
+sig_cache_flush (void)
+{
+  gpg_error_t err;
+  char *fname, *tmpfname = NULL;
+  dotlock_t lockhd;
+  estream_t fp;
+  struct stat sb;
+  int rewrite;
+
+  if (!new_items_used)
+    return;
+
+  fname = make_filename (gnupg_homedir (), SIG_CACHE_FILENAME, NULL);
+  lockhd = dotlock_create (fname, 0);
+  if (!lockhd)
+    {
+      log_info (_("can't create lock for '%s'\n"), fname);
+      xfree (fname);
+      return;
+    }
+  if (dotlock_take (lockhd, -1))
+    {
+      log_info (_("can't lock '%s'\n"), fname);
+      dotlock_destroy (lockhd);
+      xfree (fname);
+      return;
+    }
+
+  /* Other processes may have changed the file since we loaded it;
+   * thus we check its length again while holding the lock.  */
+  if (file_entries + new_items_used > SIG_CACHE_MAX_ENTRIES
+      || gnupg_stat (fname, &sb))
+    rewrite = 1;
+  else
+    rewrite = (sb.st_size < 8
+               || (sb.st_size - 8) % SIG_CACHE_KEYLEN
+               || ((sb.st_size - 8) / SIG_CACHE_KEYLEN + new_items_used
+                   > SIG_CACHE_MAX_ENTRIES));
+
+  if (rewrite)
+    {
+      tmpfname = xstrconcat (fname, ".tmp", NULL);
+      fp = es_fopen (tmpfname, "wb,mode=-rw");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_info (_("can't create '%s': %s\n"),
+                    tmpfname, gpg_strerror (err));
+          goto leave;
+        }
+      err = write_all_entries (fp);
+    }
+  else
+    {
+      fp = es_fopen (fname, "ab,mode=-rw");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_info (_("can't open '%s': %s\n"), fname, gpg_strerror (err));
+          goto leave;
+        }
+      if (es_write (fp, new_items, new_items_used * SIG_CACHE_KEYLEN, NULL))
+        err = gpg_error_from_syserror ();
+      else
+        err = 0;
+    }
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err && rewrite)
+    err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    {
+      log_info (_("error writing '%s': %s\n"),
+                rewrite? tmpfname : fname, gpg_strerror (err));
+      if (rewrite)
+        gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  if (DBG_CACHE)
+    log_debug ("sig_cache: %s %zu new entries to '%s'\n",
+               rewrite? "rewrote file with" : "appended",
+               new_items_used, fname);
+  new_items_used = 0;
+
+ leave:
+  dotlock_release (lockhd);
+  dotlock_destroy (lockhd);
+  xfree (tmpfname);
+  xfree (fname);
+}
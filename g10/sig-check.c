@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -492,54 +493,12 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 }
 
 
-/* This function is similar to check_signature_end, but it only checks
- * whether the signature was generated by PK.  It does not check
- * expiration, revocation, etc.  */
-static int
-check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
-                            gcry_md_hd_t digest,
-                            const void *extrahash, size_t extrahashlen)
+/* Complete DIGEST with the trailer of the signature SIG and finalize
+ * it.  EXTRAHASH is used for v5 data signatures.  */
+static void
+hash_sig_trailer (PKT_signature *sig, gcry_md_hd_t digest,
+                  const void *extrahash, size_t extrahashlen)
 {
-  gcry_mpi_t result = NULL;
-  int rc = 0;
-
-  if (!opt.flags.allow_weak_digest_algos)
-    {
-      if (is_weak_digest (sig->digest_algo))
-        {
-          print_digest_rejected_note (sig->digest_algo);
-          return GPG_ERR_DIGEST_ALGO;
-        }
-    }
-
-  /* For key signatures check that the key has a cert usage.  We may
-   * do this only for subkeys because the primary may always issue key
-   * signature.  The latter may not be reflected in the pubkey_usage
-   * field because we need to check the key signatures to extract the
-   * key usage.  */
-  if (!pk->flags.primary
-      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
-
-  /* For data signatures check that the key has sign usage.  */
-  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
-      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
-
   /* Make sure the digest algo is enabled (in case of a detached
    * signature).  */
   gcry_md_enable (digest, sig->digest_algo);
@@ -620,20 +579,83 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
       buf[i++] = n;
       gcry_md_write (digest, buf, i);
     }
-    gcry_md_final( digest );
+  gcry_md_final( digest );
+}
 
-    /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return GPG_ERR_GENERAL;
 
-    /* Verify the signature.  */
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("enter pk_verify");
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("leave pk_verify");
-    gcry_mpi_release (result);
+/* This function is similar to check_signature_end, but it only checks
+ * whether the signature was generated by PK.  It does not check
+ * expiration, revocation, etc.  */
+static int
+check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
+                            gcry_md_hd_t digest,
+                            const void *extrahash, size_t extrahashlen)
+{
+  gcry_mpi_t result = NULL;
+  int rc = 0;
+  byte cachekey[32];
+
+  if (!opt.flags.allow_weak_digest_algos)
+    {
+      if (is_weak_digest (sig->digest_algo))
+        {
+          print_digest_rejected_note (sig->digest_algo);
+          return GPG_ERR_DIGEST_ALGO;
+        }
+    }
+
+  /* For key signatures check that the key has a cert usage.  We may
+   * do this only for subkeys because the primary may always issue key
+   * signature.  The latter may not be reflected in the pubkey_usage
+   * field because we need to check the key signatures to extract the
+   * key usage.  */
+  if (!pk->flags.primary
+      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
+
+  /* For data signatures check that the key has sign usage.  */
+  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
+      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
+
+  hash_sig_trailer (sig, digest, extrahash, extrahashlen);
+
+    /* For key signatures we may already know from an earlier run that
+     * this signature is good.  */
+    if (sig->sig_class >= 0x10 && sig->sig_class <= 0x30
+        && sig_cache_lookup (pk, sig, digest, cachekey))
+      ;
+    else
+      {
+        /* Convert the digest to an MPI.  */
+        result = encode_md_value (pk, digest, sig->digest_algo );
+        if (!result)
+          return GPG_ERR_GENERAL;
+
+        /* Verify the signature.  */
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("enter pk_verify");
+        rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("leave pk_verify");
+        gcry_mpi_release (result);
+        if (!rc && sig->sig_class >= 0x10 && sig->sig_class <= 0x30)
+          sig_cache_put (cachekey);
+      }
 
   if (!rc && sig->flags.unknown_critical)
     {
@@ -1286,3 +1308,224 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* Object used by check_uid_certs_parallel for one signature.  */
+struct keysig_job_s
+{
+  PKT_signature *sig;
+  PKT_public_key *signer;       /* The issuer of SIG.  */
+  gcry_mpi_t hash;              /* The encoded digest or NULL.  */
+  byte cachekey[32];            /* Key for sig_cache_put.  */
+  int rc;                       /* Result of the verification.  */
+};
+
+/* A worker thread of check_uid_certs_parallel verifies the
+ * signatures of a contiguous range of jobs.  */
+struct keysig_shard_s
+{
+  npth_t thread;
+  unsigned int running:1;
+  struct keysig_job_s *jobs;
+  unsigned int njobs;
+};
+
+/* The maximum number of signatures prepared at once.  This limits
+ * the number of signer keys kept in memory.  */
+#define KEYSIG_BATCH_SIZE 4096
+
+
+/* Prepare JOB for the user ID certification SIG at NODE in KEYBLOCK.
+ * Returns false if the signature can't be checked here; it will then
+ * be checked in the regular way.  */
+static int
+prepare_keysig_job (ctrl_t ctrl, kbnode_t keyblock, kbnode_t node,
+                    struct keysig_job_s *job)
+{
+  PKT_public_key *pripk = keyblock->pkt->pkt.public_key;
+  PKT_signature *sig = node->pkt->pkt.signature;
+  kbnode_t unode;
+  gcry_md_hd_t md;
+
+  memset (job, 0, sizeof *job);
+
+  /* Everything which would print a diagnostic is left to the
+   * regular check.  */
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo)
+      || sig->flags.unknown_critical
+      || (!opt.flags.allow_weak_digest_algos
+          && is_weak_digest (sig->digest_algo))
+      || (sig->digest_algo == DIGEST_ALGO_SHA1
+          && !opt.flags.allow_weak_key_signatures))
+    return 0;
+
+  unode = find_prev_kbnode (keyblock, node, PKT_USER_ID);
+  if (!unode)
+    return 0;
+
+  job->signer = xmalloc_clear (sizeof *job->signer);
+  job->signer->req_usage = PUBKEY_USAGE_CERT;
+  if (get_pubkey_for_sig (ctrl, job->signer, sig, NULL)
+      || (!job->signer->flags.primary
+          && !(job->signer->pubkey_usage & PUBKEY_USAGE_CERT)))
+    goto fail;
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    goto fail;
+  hash_public_key (md, pripk);
+  hash_uid_packet (unode->pkt->pkt.user_id, md, sig);
+  hash_sig_trailer (sig, md, NULL, 0);
+
+  job->sig = sig;
+  if (!sig_cache_lookup (job->signer, sig, md, job->cachekey))
+    {
+      job->hash = encode_md_value (job->signer, md, sig->digest_algo);
+      if (!job->hash)
+        {
+          gcry_md_close (md);
+          goto fail;
+        }
+    }
+  gcry_md_close (md);
+  return 1;
+
+ fail:
+  free_public_key (job->signer);
+  job->signer = NULL;
+  job->sig = NULL;
+  return 0;
+}
+
+
+static void *
+keysig_shard_thread (void *arg)
+{
+  struct keysig_shard_s *shard = arg;
+  struct keysig_job_s *job;
+  unsigned int i;
+
+  npth_unprotect ();
+  for (i=0; i < shard->njobs; i++)
+    {
+      job = shard->jobs + i;
+      if (job->hash)
+        job->rc = pk_verify (job->sig->pubkey_algo, job->hash,
+                             job->sig->data, job->signer->pkey);
+    }
+  npth_protect ();
+  return NULL;
+}
+
+
+/* Verify the JOBS using up to NTHREADS threads and store the results
+ * in the signature packets.  */
+static void
+run_keysig_jobs (struct keysig_job_s *jobs, unsigned int njobs, int nthreads)
+{
+  struct keysig_shard_s *shards;
+  npth_attr_t tattr;
+  unsigned int i, n, per_shard;
+  int rc;
+
+  if ((unsigned int)nthreads > njobs)
+    nthreads = njobs;
+  shards = xcalloc (nthreads, sizeof *shards);
+  per_shard = (njobs + nthreads - 1) / nthreads;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=n=0; i < nthreads && n < njobs; i++, n += per_shard)
+    {
+      shards[i].jobs = jobs + n;
+      shards[i].njobs = njobs - n < per_shard? njobs - n : per_shard;
+      rc = npth_create (&shards[i].thread, &tattr,
+                        keysig_shard_thread, shards + i);
+      if (rc)
+        {
+          /* Do this shard in the main thread.  */
+          if (DBG_CRYPTO)
+            log_debug ("error creating thread: %s\n", strerror (rc));
+          keysig_shard_thread (shards + i);
+        }
+      else
+        shards[i].running = 1;
+    }
+  npth_attr_destroy (&tattr);
+
+  for (i=0; i < nthreads; i++)
+    if (shards[i].running)
+      {
+        rc = npth_join (shards[i].thread, NULL);
+        if (rc)
+          log_fatal ("error joining thread: %s\n", strerror (rc));
+      }
+  xfree (shards);
+
+  for (i=0; i < njobs; i++)
+    {
+      struct keysig_job_s *job = jobs + i;
+
+      if (!job->rc)
+        sig_cache_put (job->cachekey);
+      if (!job->rc || gpg_err_code (job->rc) == GPG_ERR_BAD_SIGNATURE)
+        cache_sig_result (job->sig, job->rc);
+      gcry_mpi_release (job->hash);
+      free_public_key (job->signer);
+    }
+}
+
+
+/* Verify the user ID certifications and certification revocations
+ * of the NKEYBLOCKS keyblocks at KEYBLOCKS for which FILTER returns
+ * true using up to NTHREADS threads.  The keyblocks must have been
+ * merged using merge_keys_and_selfsig.  The results are cached in
+ * the signature packets so that a following check_key_signature
+ * does not need to do the public key operation again.  Signatures
+ * which can't be checked this way are left alone.  */
+void
+check_uid_certs_parallel (ctrl_t ctrl, kbnode_t *keyblocks,
+                          unsigned int nkeyblocks,
+                          int (*filter)(void *opaque, kbnode_t keyblock,
+                                        PKT_signature *sig),
+                          void *opaque, int nthreads)
+{
+  struct keysig_job_s *jobs;
+  unsigned int i, njobs, total;
+  kbnode_t node;
+
+  if (opt.no_sig_cache || nthreads < 2)
+    return;
+
+  jobs = xcalloc (KEYSIG_BATCH_SIZE, sizeof *jobs);
+  njobs = total = 0;
+  for (i=0; i < nkeyblocks; i++)
+    {
+      for (node = keyblocks[i]; node; node = node->next)
+        {
+          PKT_signature *sig;
+
+          if (node->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+          sig = node->pkt->pkt.signature;
+          if (sig->flags.checked || !(IS_UID_SIG (sig) || IS_UID_REV (sig))
+              || !filter (opaque, keyblocks[i], sig))
+            continue;
+          if (!prepare_keysig_job (ctrl, keyblocks[i], node, jobs + njobs))
+            continue;
+          if (++njobs == KEYSIG_BATCH_SIZE)
+            {
+              run_keysig_jobs (jobs, njobs, nthreads);
+              total += njobs;
+              njobs = 0;
+            }
+        }
+    }
+  if (njobs)
+    run_keysig_jobs (jobs, njobs, nthreads);
+  total += njobs;
+  xfree (jobs);
+
+  if (DBG_CACHE)
+    log_debug ("check_uid_certs_parallel: %u signatures checked\n", total);
+}
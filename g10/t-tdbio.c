@@ -0,0 +1,172 @@
+/* t-tdbio.c - Tests for the trustdb journal in tdbio.c.
+ * Copyright (C) 2024 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+/* We need access to the journal functions.  */
+#include "tdbio.c"
+
+#define DBNAME "./t-tdbio.gpg"
+
+
+/* Stubs for trustdb.c and tdbdump.c.  */
+void
+how_to_fix_the_trustdb (void)
+{
+}
+
+void
+list_trustdb (ctrl_t ctrl, estream_t fp, const char *username)
+{
+  (void)ctrl;
+  (void)fp;
+  (void)username;
+}
+
+
+/* Write the journal for the current transaction and then act as if
+ * the process died before the trustdb was updated.  */
+static void
+crash_after_journal (void)
+{
+  char *fname = journal_name ();
+
+  if (write_journal (fname))
+    ABORT ("writing the journal failed");
+  xfree (fname);
+  tdbio_cancel_transaction ();
+  close (db_fd);
+  db_fd = -1;
+}
+
+
+/* Return true if the journal exists.  */
+static int
+have_journal (void)
+{
+  char *fname = journal_name ();
+  int rc = !gnupg_access (fname, F_OK);
+
+  xfree (fname);
+  return rc;
+}
+
+
+/* Modify the journal: Flip a bit at OFFSET if FLIP is set or
+ * truncate it to OFFSET bytes.  */
+static void
+damage_journal (off_t offset, int flip)
+{
+  char *fname = journal_name ();
+  int fd;
+  byte c;
+
+  fd = open (fname, O_RDWR | MY_O_BINARY);
+  if (fd == -1)
+    ABORT ("can't open the journal");
+  if (flip)
+    {
+      if (lseek (fd, offset, SEEK_SET) == -1 || read (fd, &c, 1) != 1)
+        ABORT ("can't read the journal");
+      c ^= 0x10;
+      if (lseek (fd, offset, SEEK_SET) == -1 || write (fd, &c, 1) != 1)
+        ABORT ("can't write the journal");
+    }
+  else if (ftruncate (fd, offset))
+    ABORT ("can't truncate the journal");
+  close (fd);
+  xfree (fname);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  ctrl_t ctrl;
+  char *fname;
+  int nofile;
+
+  (void) argc;
+  (void) argv;
+
+  opt.quiet = 1;
+  ctrl = xcalloc (1, sizeof *ctrl);
+  gnupg_remove (DBNAME);
+  gnupg_remove (DBNAME EXTSEP_S "wal");
+
+  if (tdbio_set_dbname (ctrl, DBNAME, 1, &nofile) || nofile)
+    ABORT ("can't create the trustdb");
+
+  /* A committed transaction leaves no journal behind.  */
+  tdbio_begin_transaction ();
+  if (!is_locked)
+    ABORT ("transaction does not hold the lock");
+  tdbio_write_nextcheck (ctrl, 100);
+  if (tdbio_end_transaction ())
+    ABORT ("committing the transaction failed");
+  if (is_locked)
+    ABORT ("lock not released after commit");
+  if (have_journal ())
+    ABORT ("journal not removed after commit");
+  if (tdbio_read_nextcheck () != 100)
+    ABORT ("wrong nextcheck after commit");
+
+  /* A complete journal is replayed when the trustdb is opened.  */
+  tdbio_begin_transaction ();
+  tdbio_write_nextcheck (ctrl, 12345);
+  crash_after_journal ();
+  if (is_locked)
+    ABORT ("lock not released after cancel");
+  if (!have_journal ())
+    ABORT ("journal not written");
+  if (tdbio_read_nextcheck () != 12345)
+    ABORT ("journal not replayed");
+  if (have_journal ())
+    ABORT ("journal not removed after replay");
+
+  /* A corrupted journal is ignored.  */
+  tdbio_begin_transaction ();
+  tdbio_write_nextcheck (ctrl, 99);
+  crash_after_journal ();
+  damage_journal (8 + 4 + 10, 1);
+  if (tdbio_read_nextcheck () != 12345)
+    ABORT ("corrupted journal replayed");
+  if (have_journal ())
+    ABORT ("corrupted journal not removed");
+
+  /* A truncated journal is ignored.  */
+  tdbio_begin_transaction ();
+  tdbio_write_nextcheck (ctrl, 99);
+  crash_after_journal ();
+  damage_journal (8 + JOURNAL_ITEMLEN + 2, 0);
+  if (tdbio_read_nextcheck () != 12345)
+    ABORT ("truncated journal replayed");
+  if (have_journal ())
+    ABORT ("truncated journal not removed");
+
+  fname = journal_name ();
+  gnupg_remove (fname);
+  xfree (fname);
+  close (db_fd);
+  db_fd = -1;
+  dotlock_destroy (lockhandle);
+  lockhandle = NULL;
+  gnupg_remove (DBNAME);
+  xfree (ctrl);
+}
@@ -58,6 +58,7 @@ typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
   CACHE_CTRL next;
+  CACHE_CTRL hnext;  /* Next in the hash bucket or in the free list.  */
   struct {
     unsigned used:1;
     unsigned dirty:1;
@@ -70,12 +71,20 @@ struct cache_ctrl_struct
    transaction this may not be sufficient and thus we may increase it
    then up to the HARD limit.  */
 #define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+#define MAX_CACHE_ENTRIES_HARD	500000
 
+/* The number of hash buckets used to find a cached record.  */
+#define CACHE_HASH_SIZE         4096
 
-/* The cache is controlled by these variables.  */
+
+/* The cache is controlled by these variables.  CACHE_LIST links all
+   allocated entries, CACHE_HASH the used ones and CACHE_FREE the
+   unused ones.  */
 static CACHE_CTRL cache_list;
+static CACHE_CTRL cache_hash[CACHE_HASH_SIZE];
+static CACHE_CTRL cache_free;
 static int cache_entries;
+static int cache_dirty_entries;
 static int cache_is_dirty;
 
 
@@ -108,7 +117,11 @@ static unsigned int is_locked;
 static int  db_fd = -1;
 
 /* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+static int in_transaction;
+
+/* Set if a transaction did not fit into the cache and records had to
+ * be written before the end of the transaction.  */
+static int transaction_spilled;
 
 
 
@@ -181,6 +194,45 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/*
+ * Return the cache entry for RECNO or NULL.
+ */
+static CACHE_CTRL
+lookup_cache (ulong recno)
+{
+  CACHE_CTRL r;
+
+  for (r = cache_hash[recno % CACHE_HASH_SIZE]; r; r = r->hnext)
+    if (r->recno == recno)
+      return r;
+  return NULL;
+}
+
+
+/*
+ * Mark the cache entry R as unused.
+ */
+static void
+drop_cache_item (CACHE_CTRL r)
+{
+  CACHE_CTRL *rp;
+
+  for (rp = &cache_hash[r->recno % CACHE_HASH_SIZE]; *rp; rp = &(*rp)->hnext)
+    if (*rp == r)
+      {
+        *rp = r->hnext;
+        break;
+      }
+  if (r->flags.dirty)
+    cache_dirty_entries--;
+  r->flags.used = 0;
+  r->flags.dirty = 0;
+  r->hnext = cache_free;
+  cache_free = r;
+  cache_entries--;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -191,12 +243,8 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
-    {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
-    }
-  return NULL;
+  r = lookup_cache (recno);
+  return r? r->data : NULL;
 }
 
 
@@ -227,6 +275,7 @@ write_cache_item (CACHE_CTRL r)
       return err;
     }
   r->flags.dirty = 0;
+  cache_dirty_entries--;
   return 0;
 }
 
@@ -240,144 +289,77 @@ write_cache_item (CACHE_CTRL r)
 static int
 put_record_into_cache (ulong recno, const char *data)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  CACHE_CTRL r;
+  int n;
 
   /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  r = lookup_cache (recno);
+  if (r)
     {
-      if (!r->flags.used)
+      if (!r->flags.dirty)
         {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
+          /* Hmmm: should we use a copy and compare? */
+          if (memcmp (r->data, data, TRUST_RECORD_LEN))
             {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
-    }
-
-  /* Not in the cache: add a new entry. */
-  if (unused)
-    {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
+              r->flags.dirty = 1;
+              cache_dirty_entries++;
+              cache_is_dirty = 1;
+            }
+        }
       memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
       return 0;
     }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
+  /* Not in the cache: add a new entry.  While in a transaction we
+   * let the cache grow up to the hard limit so that nothing needs
+   * to be written before the end of the transaction.  */
+  if (!cache_free
+      && (cache_entries < MAX_CACHE_ENTRIES_SOFT
+          || (in_transaction && cache_entries < MAX_CACHE_ENTRIES_HARD)))
     {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
+      if (opt.debug && in_transaction && cache_entries >= MAX_CACHE_ENTRIES_SOFT
+          && !(cache_entries % 1000))
+        log_debug ("increasing tdbio cache size\n");
+      r = xmalloc_clear (sizeof *r);
       r->next = cache_list;
       cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      r->hnext = cache_free;
+      cache_free = r;
     }
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
+  if (!cache_free && cache_entries > cache_dirty_entries)
     {
-      int n;
-
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
+      /* Cache is full: discard a third of the clean entries.  */
+      n = (cache_entries - cache_dirty_entries) / 3;
       if (!n)
         n = 1;
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      for (r = cache_list; r && n; r = r->next)
+        if (r->flags.used && !r->flags.dirty)
+          {
+            drop_cache_item (r);
+            n--;
+          }
     }
 
-  /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
-  if (in_transaction)
+  if (!cache_free)
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
+      /* No clean entries: We have to flush some dirty entries.  */
+      if (in_transaction && !transaction_spilled)
         {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
-    }
-#endif
-
-  if (dirty_count)
-    {
-      int n;
+          /* Hard limit for the cache size reached.  We can't keep the
+           * transaction atomic but we continue anyway.  */
+          log_info (_("trustdb transaction too large\n"));
+          transaction_spilled = 1;
+        }
 
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
+      /* Write some dirty entries. */
+      n = cache_dirty_entries / 5;
       if (!n)
         n = 1;
 
       take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
+      for (r = cache_list; r && n; r = r->next)
         {
           if (r->flags.used && r->flags.dirty)
             {
@@ -385,31 +367,31 @@ put_record_into_cache (ulong recno, const char *data)
 
               rc = write_cache_item (r);
               if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
+                {
+                  release_write_lock ();
+                  return rc;
+                }
+              drop_cache_item (r);
+              n--;
 	    }
 	}
       release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
     }
 
-  /* We should never reach this.  */
-  BUG();
+  /* Now put into the cache.  */
+  log_assert (cache_free);
+  r = cache_free;
+  cache_free = r->hnext;
+  r->flags.used = 1;
+  r->flags.dirty = 1;
+  r->recno = recno;
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  r->hnext = cache_hash[recno % CACHE_HASH_SIZE];
+  cache_hash[recno % CACHE_HASH_SIZE] = r;
+  cache_entries++;
+  cache_dirty_entries++;
+  cache_is_dirty = 1;
+  return 0;
 }
 
 
@@ -421,55 +403,316 @@ tdbio_is_dirty (void)
 }
 
 
+/* Flush the data written by write_dirty_records to the disk.  */
+static int
+sync_fd (int fd)
+{
+#ifdef HAVE_W32_SYSTEM
+  if (!FlushFileBuffers ((HANDLE)_get_osfhandle (fd)))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+  return 0;
+#else
+  return fsync (fd);
+#endif
+}
+
+
+/* Helper for write_dirty_records.  */
+static int
+cmp_cache_recno (const void *a, const void *b)
+{
+  ulong x = (*(const CACHE_CTRL *)a)->recno;
+  ulong y = (*(const CACHE_CTRL *)b)->recno;
+
+  return x < y? -1 : x > y;
+}
+
+
+/*
+ * Return an array with all dirty cache entries sorted by record
+ * number.  The number of entries is stored at R_COUNT.
+ */
+static CACHE_CTRL *
+collect_dirty_records (int *r_count)
+{
+  CACHE_CTRL *list, r;
+  int n = 0;
+
+  list = xmalloc ((cache_dirty_entries + 1) * sizeof *list);
+  for (r = cache_list; r; r = r->next)
+    if (r->flags.used && r->flags.dirty)
+      list[n++] = r;
+  log_assert (n == cache_dirty_entries);
+  qsort (list, n, sizeof *list, cmp_cache_recno);
+  *r_count = n;
+  return list;
+}
+
+
+/*
+ * Write all dirty cache entries to the trustdb.  Records with
+ * consecutive numbers are written with one system call.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+write_dirty_records (void)
+{
+  CACHE_CTRL *list;
+  char *buffer;
+  int i, j, count, n, nbytes;
+  int rc = 0;
+
+  list = collect_dirty_records (&count);
+  buffer = xmalloc (64 * TRUST_RECORD_LEN);
+  for (i = 0; i < count && !rc; i = j)
+    {
+      for (j = i + 1; j < count && j - i < 64; j++)
+        if (list[j]->recno != list[j-1]->recno + 1)
+          break;
+      if (j - i == 1)
+        {
+          rc = write_cache_item (list[i]);
+          continue;
+        }
+
+      for (n = i; n < j; n++)
+        memcpy (buffer + (n - i) * TRUST_RECORD_LEN, list[n]->data,
+                TRUST_RECORD_LEN);
+      nbytes = (j - i) * TRUST_RECORD_LEN;
+      if (lseek (db_fd, list[i]->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+        {
+          rc = gpg_error_from_syserror ();
+          log_error (_("trustdb rec %lu: lseek failed: %s\n"),
+                     list[i]->recno, strerror (errno));
+        }
+      else if ((n = write (db_fd, buffer, nbytes)) != nbytes)
+        {
+          rc = gpg_error_from_syserror ();
+          log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
+                     list[i]->recno, n, strerror (errno) );
+        }
+      else
+        {
+          for (n = i; n < j; n++)
+            list[n]->flags.dirty = 0;
+          cache_dirty_entries -= j - i;
+        }
+    }
+  xfree (buffer);
+  xfree (list);
+  return rc;
+}
+
+
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this does nothing; the
+ * records are written by tdbio_end_transaction.
  */
 int
 tdbio_sync (void)
 {
-    CACHE_CTRL r;
-    int did_lock = 0;
+    int rc;
 
     if( db_fd == -1 )
 	open_db();
-#if 0 /* Transactions are not yet used.  */
     if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
+	return 0;
 
     if( !cache_is_dirty )
 	return 0;
 
-    if (!take_write_lock ())
-        did_lock = 1;
+    /* Note that take_write_lock always bumps the lock counter.  */
+    take_write_lock ();
+    rc = write_dirty_records ();
+    if (!rc)
+      cache_is_dirty = 0;
+    release_write_lock ();
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
+    return rc;
+}
+
+
+
+/*************************************
+ ************* journal ***************
+ *************************************/
+
+/*
+ * A transaction is committed by first writing all modified records to
+ * the journal file "trustdb.gpg.wal" next to the trustdb and syncing
+ * it to the disk.  Only then the records are written to the trustdb
+ * and the journal is removed.  If the process dies while writing the
+ * trustdb, the journal is replayed the next time the trustdb is
+ * opened.  A journal which is not complete is ignored because in that
+ * case the trustdb has not yet been touched.
+ *
+ * The journal consists of the magic, the records each prefixed by the
+ * 4 byte record number, the 4 byte number of records, and the SHA-256
+ * hash over everything before.
+ */
+#define JOURNAL_MAGIC    "GPGTDBJ\x01"
+#define JOURNAL_ITEMLEN  (4 + TRUST_RECORD_LEN)
+
+
+/* Return a malloced string with the name of the journal.  */
+static char *
+journal_name (void)
+{
+  return xstrconcat (db_name, EXTSEP_S "wal", NULL);
+}
+
+
+/*
+ * Write all dirty records of the cache to the journal and make sure
+ * it is on the disk.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+write_journal (const char *fname)
+{
+  CACHE_CTRL *list;
+  byte *buffer, *p;
+  size_t length;
+  int i, count, fd, n;
+  int rc = 0;
+
+  list = collect_dirty_records (&count);
+  length = 8 + count * JOURNAL_ITEMLEN + 4 + 32;
+  p = buffer = xmalloc (length);
+  memcpy (p, JOURNAL_MAGIC, 8); p += 8;
+  for (i = 0; i < count; i++)
+    {
+      ulongtobuf (p, list[i]->recno); p += 4;
+      memcpy (p, list[i]->data, TRUST_RECORD_LEN); p += TRUST_RECORD_LEN;
     }
-    cache_is_dirty = 0;
-    if (did_lock)
-        release_write_lock ();
+  ulongtobuf (p, count); p += 4;
+  gcry_md_hash_buffer (GCRY_MD_SHA256, p, buffer, p - buffer);
+  xfree (list);
 
-    return 0;
+  fd = gnupg_open (fname, O_WRONLY | O_CREAT | O_TRUNC | MY_O_BINARY, 0600);
+  if (fd == -1)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("can't create '%s': %s\n"), fname, gpg_strerror (rc));
+      goto leave;
+    }
+  n = write (fd, buffer, length);
+  if (n != (int)length || sync_fd (fd))
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("error writing '%s': %s\n"), fname, gpg_strerror (rc));
+      close (fd);
+      gnupg_remove (fname);
+      goto leave;
+    }
+  if (close (fd))
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("error closing '%s': %s\n"), fname, gpg_strerror (rc));
+      gnupg_remove (fname);
+    }
+
+ leave:
+  xfree (buffer);
+  return rc;
+}
+
+
+/*
+ * Replay a journal left behind by a process which died while
+ * committing a transaction.  DB_FD must be open for writing and the
+ * caller must hold the write lock.
+ */
+static void
+replay_journal (void)
+{
+  char *fname;
+  estream_t fp;
+  byte *buffer = NULL;
+  size_t length, nread, count, i;
+  byte hash[32];
+  const byte *p;
+  int n;
+
+  fname = journal_name ();
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_info (_("can't open '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  if (es_fseek (fp, 0, SEEK_END) || (length = es_ftello (fp)) == (size_t)-1
+      || es_fseek (fp, 0, SEEK_SET))
+    goto invalid;
+  if (length < 8 + 4 + 32 || (length - 8 - 4 - 32) % JOURNAL_ITEMLEN)
+    goto invalid;
+  buffer = xmalloc (length);
+  if (es_read (fp, buffer, length, &nread) || nread != length)
+    goto invalid;
+  count = buf32_to_ulong (buffer + length - 32 - 4);
+  gcry_md_hash_buffer (GCRY_MD_SHA256, hash, buffer, length - 32);
+  if (memcmp (buffer, JOURNAL_MAGIC, 8)
+      || memcmp (hash, buffer + length - 32, 32)
+      || count != (length - 8 - 4 - 32) / JOURNAL_ITEMLEN)
+    goto invalid;
+
+  for (i = 0, p = buffer + 8; i < count; i++, p += JOURNAL_ITEMLEN)
+    {
+      ulong recno = buf32_to_ulong (p);
+
+      if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+        log_fatal (_("trustdb rec %lu: lseek failed: %s\n"),
+                   recno, strerror (errno));
+      n = write (db_fd, p + 4, TRUST_RECORD_LEN);
+      if (n != TRUST_RECORD_LEN)
+        log_fatal (_("trustdb rec %lu: write failed (n=%d): %s\n"),
+                   recno, n, strerror (errno));
+    }
+  if (sync_fd (db_fd))
+    log_fatal (_("error writing '%s': %s\n"), db_name, strerror (errno));
+  log_info (_("trustdb: %lu records recovered from '%s'\n"),
+            (ulong)count, fname);
+  goto leave;
+
+ invalid:
+  /* The process died while writing the journal; the trustdb has not
+   * been changed.  */
+  if (opt.verbose)
+    log_info ("trustdb: ignoring incomplete journal '%s'\n", fname);
+
+ leave:
+  es_fclose (fp);
+  gnupg_remove (fname);
+  xfree (buffer);
+  xfree (fname);
 }
 
 
-#if 0  /* Not yet used.  */
+
+/*************************************
+ ************* transactions **********
+ *************************************/
+
 /*
  * Simple transactions system:
  * Everything between begin_transaction and end/cancel_transaction
  * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * Calls to tdbio_sync within a transaction are ignored.  Transactions
+ * can't be nested.  The write lock is held for the entire transaction
+ * so that another process can't allocate the same records.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction (void)
 {
+  CACHE_CTRL r;
   int rc;
 
   if (in_transaction)
@@ -478,28 +721,70 @@ tdbio_begin_transaction ()  /* Not yet used.  */
   rc = tdbio_sync();
   if (rc)
     return rc;
+
+  take_write_lock ();
+
+  /* Another process may have changed records we read before we took
+   * the lock.  Drop them so that they are read again.  */
+  for (r = cache_list; r; r = r->next)
+    if (r->flags.used && !r->flags.dirty)
+      drop_cache_item (r);
+
   in_transaction = 1;
+  transaction_spilled = 0;
   return 0;
 }
 
+
+/*
+ * Commit the current transaction.  All records changed during the
+ * transaction are first written to the journal and then to the
+ * trustdb.  Finally the write lock is released.
+ */
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction (void)
 {
-  int rc;
+  char *fname = NULL;
+  int rc = 0;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
-  take_write_lock ();
   gnupg_block_all_signals ();
   in_transaction = 0;
-  rc = tdbio_sync();
+  if (cache_is_dirty)
+    {
+      if (DBG_TRUST)
+        log_debug ("tdbio: committing %d records%s\n", cache_dirty_entries,
+                   transaction_spilled? " (spilled)":"");
+      fname = journal_name ();
+      rc = write_journal (fname);
+      if (!rc)
+        rc = write_dirty_records ();
+      if (!rc && sync_fd (db_fd))
+        {
+          rc = gpg_error_from_syserror ();
+          log_error (_("error writing '%s': %s\n"), db_name, gpg_strerror (rc));
+        }
+      if (!rc)
+        {
+          cache_is_dirty = 0;
+          gnupg_remove (fname);
+        }
+    }
   gnupg_unblock_all_signals();
   release_write_lock ();
+  xfree (fname);
   return rc;
 }
 
+
+/*
+ * Abort the current transaction and release the write lock.  Note
+ * that records which had to be written because the transaction did
+ * not fit into the cache are not rolled back.
+ */
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction (void)
 {
   CACHE_CTRL r;
 
@@ -513,18 +798,15 @@ tdbio_cancel_transaction () /* Not yet used.  */
       for (r = cache_list; r; r = r->next)
         {
           if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
+            drop_cache_item (r);
 	}
       cache_is_dirty = 0;
     }
 
   in_transaction = 0;
+  release_write_lock ();
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
 
@@ -780,6 +1062,8 @@ static void
 open_db (void)
 {
   TRUSTREC rec;
+  int readonly = 0;
+  char *fname;
 
   log_assert( db_fd == -1 );
 
@@ -794,10 +1078,21 @@ open_db (void)
       db_fd = gnupg_open (db_name, O_RDONLY | MY_O_BINARY, 0);
       if (db_fd != -1 && !opt.quiet)
           log_info (_("Note: trustdb not writable\n"));
+      readonly = 1;
   }
   if ( db_fd == -1 )
     log_fatal( _("can't open '%s': %s\n"), db_name, strerror(errno) );
 
+  /* Finish a transaction which has been interrupted.  */
+  fname = journal_name ();
+  if (!readonly && !gnupg_access (fname, F_OK))
+    {
+      take_write_lock ();
+      replay_journal ();
+      release_write_lock ();
+    }
+  xfree (fname);
+
   register_secured_file (db_name);
 
   /* Read the version record. */
@@ -297,6 +297,17 @@ revalidation_mark (ctrl_t ctrl)
 }
 
 
+void
+revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+#ifdef NO_TRUST_MODELS
+  (void)pk;
+#else
+  tdb_revalidation_mark_key (ctrl, pk);
+#endif
+}
+
+
 void
 check_trustdb_stale (ctrl_t ctrl)
 {
@@ -116,6 +116,23 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 
 static int pending_check_trustdb;
 
+/* The primary keys changed by an import since the last check.  As
+ * long as these are the only reason for a pending check (i.e.
+ * CHANGED_KEYS_ONLY is set), validate_keys can skip the run if none
+ * of them is connected to the web of trust.  CHANGED_KEYS_NEXTCHECK
+ * is the time of the next check as it was before the first key was
+ * marked.  */
+#define MAX_CHANGED_KEYS 10000
+struct changed_key_s
+{
+  byte fpr[MAX_FINGERPRINT_LEN];
+  byte fprlen;
+};
+static struct changed_key_s *changed_keys;
+static unsigned int n_changed_keys, max_changed_keys;
+static int changed_keys_only;
+static ulong changed_keys_nextcheck;
+
 static int validate_keys (ctrl_t ctrl, int interactive);
 
 
@@ -225,6 +242,186 @@ release_key_array ( struct key_array *keys )
     }
 }
 
+#define CERT_GRAPH_TABLE_SIZE 4096
+
+/*
+ * The certification graph is built while validate_keys does its first
+ * walk over the keyDB.  For each key which may become valid later, it
+ * records the key IDs of the keys which issued certifications on its
+ * user IDs.  For the following depths we only need to look at the
+ * keys certified by a key in the new klist; those are found with the
+ * graph and everything else in the keyDB is skipped.  Note that the
+ * signatures are not checked here; this is left to
+ * validate_one_keyblock.
+ */
+struct cert_edge
+{
+  struct cert_edge *next;
+  u32 signer[2];      /* Key ID of the issuer of the certification.  */
+  unsigned int idx;   /* Index of the certified key in KEYS.  */
+};
+
+struct cert_graph_key
+{
+  u32 kid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+  byte fprlen;
+  unsigned int mark;  /* Last depth this key was selected (plus one).  */
+};
+
+struct cert_graph
+{
+  int complete;                    /* The graph has been built.  */
+  struct cert_edge **edges;        /* Hash table over SIGNER.  */
+  struct cert_graph_key *keys;
+  unsigned int nkeys, maxkeys;
+  unsigned long nedges;
+};
+
+
+static struct cert_graph *
+new_cert_graph (void)
+{
+  struct cert_graph *graph;
+
+  graph = xmalloc_clear (sizeof *graph);
+  graph->edges = xmalloc_clear (CERT_GRAPH_TABLE_SIZE * sizeof *graph->edges);
+  return graph;
+}
+
+static void
+release_cert_graph (struct cert_graph *graph)
+{
+  struct cert_edge *e, *e2;
+  int i;
+
+  if (!graph)
+    return;
+  for (i=0; i < CERT_GRAPH_TABLE_SIZE; i++)
+    for (e = graph->edges[i]; e; e = e2)
+      {
+        e2 = e->next;
+        xfree (e);
+      }
+  xfree (graph->edges);
+  xfree (graph->keys);
+  xfree (graph);
+}
+
+/*
+ * Add the certifications on the user IDs of KEYBLOCK to GRAPH.
+ * Self-signatures are ignored and nothing is recorded for keys
+ * without certifications.
+ */
+static void
+cert_graph_add_keyblock (struct cert_graph *graph, kbnode_t keyblock)
+{
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  struct cert_graph_key *gk = NULL;
+  struct cert_edge *e;
+  kbnode_t node;
+  int in_uid = 0;
+  u32 main_kid[2];
+  size_t fprlen;
+
+  keyid_from_pk (pk, main_kid);
+  for (node = keyblock; node; node = node->next)
+    {
+      PKT_signature *sig;
+      int i;
+
+      if (node->pkt->pkttype == PKT_USER_ID)
+        in_uid = 1;
+      else if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        in_uid = 0;
+      if (!in_uid || node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (!IS_UID_SIG (sig)
+          || (sig->keyid[0] == main_kid[0] && sig->keyid[1] == main_kid[1]))
+        continue;
+
+      if (!gk)
+        {
+          if (graph->nkeys == graph->maxkeys)
+            {
+              graph->maxkeys += 1000;
+              graph->keys = xrealloc (graph->keys,
+                                      graph->maxkeys * sizeof *graph->keys);
+            }
+          gk = graph->keys + graph->nkeys++;
+          memset (gk, 0, sizeof *gk);
+          gk->kid[0] = main_kid[0];
+          gk->kid[1] = main_kid[1];
+          fingerprint_from_pk (pk, gk->fpr, &fprlen);
+          gk->fprlen = fprlen;
+        }
+
+      /* The edges of this key are at the head of the lists; thus we
+         only need to look at those to skip duplicates.  */
+      i = sig->keyid[1] % CERT_GRAPH_TABLE_SIZE;
+      for (e = graph->edges[i]; e && e->idx == graph->nkeys - 1; e = e->next)
+        if (e->signer[0] == sig->keyid[0] && e->signer[1] == sig->keyid[1])
+          break;
+      if (e && e->idx == graph->nkeys - 1)
+        continue;
+
+      e = xmalloc (sizeof *e);
+      e->signer[0] = sig->keyid[0];
+      e->signer[1] = sig->keyid[1];
+      e->idx = graph->nkeys - 1;
+      e->next = graph->edges[i];
+      graph->edges[i] = e;
+      graph->nedges++;
+    }
+}
+
+static int
+cmp_uint (const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+
+  return x < y? -1 : x > y;
+}
+
+/*
+ * Return an array with the indices of all keys in GRAPH certified by
+ * a key in KLIST.  The indices are sorted so that the keys are
+ * visited in the order of the keyDB.  DEPTH is used to mark the
+ * selected keys.  The number of items is stored at R_COUNT; NULL is
+ * returned if there are none.
+ */
+static unsigned int *
+cert_graph_candidates (struct cert_graph *graph, struct key_item *klist,
+                       int depth, unsigned int *r_count)
+{
+  unsigned int *cand = NULL;
+  unsigned int count = 0, size = 0;
+  struct key_item *k;
+  struct cert_edge *e;
+
+  for (k = klist; k; k = k->next)
+    for (e = graph->edges[k->kid[1] % CERT_GRAPH_TABLE_SIZE]; e; e = e->next)
+      if (e->signer[0] == k->kid[0] && e->signer[1] == k->kid[1]
+          && graph->keys[e->idx].mark != depth + 1)
+        {
+          graph->keys[e->idx].mark = depth + 1;
+          if (count == size)
+            {
+              size += 256;
+              cand = xrealloc (cand, size * sizeof *cand);
+            }
+          cand[count++] = e->idx;
+        }
+
+  if (count > 1)
+    qsort (cand, count, sizeof *cand, cmp_uint);
+  *r_count = count;
+  return cand;
+}
+
+
 
 /*********************************************
  **********  Initialization  *****************
@@ -712,6 +909,53 @@ tdb_revalidation_mark (ctrl_t ctrl)
   if (tdbio_write_nextcheck (ctrl, 1))
     do_sync ();
   pending_check_trustdb = 1;
+  changed_keys_only = 0;
+  n_changed_keys = 0;
+}
+
+
+/*
+ * Same as tdb_revalidation_mark but only the keyblock of the primary
+ * key PK has been changed, for example by an import.  This allows
+ * validate_keys to skip the run if PK is not part of the web of
+ * trust.
+ */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  struct changed_key_s *ck;
+  size_t fprlen;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  if (!pending_check_trustdb)
+    {
+      changed_keys_only = 1;
+      changed_keys_nextcheck = tdbio_read_nextcheck ();
+    }
+  if (changed_keys_only && n_changed_keys < MAX_CHANGED_KEYS)
+    {
+      if (n_changed_keys == max_changed_keys)
+        {
+          max_changed_keys += 64;
+          changed_keys = xrealloc (changed_keys,
+                                   max_changed_keys * sizeof *changed_keys);
+        }
+      ck = changed_keys + n_changed_keys++;
+      fingerprint_from_pk (pk, ck->fpr, &fprlen);
+      ck->fprlen = fprlen;
+    }
+  else
+    {
+      changed_keys_only = 0;
+      n_changed_keys = 0;
+    }
+
+  if (tdbio_write_nextcheck (ctrl, 1))
+    do_sync ();
+  pending_check_trustdb = 1;
 }
 
 int
@@ -1508,13 +1752,17 @@ enum_cert_paths_print (void **context, FILE *fp,
  *********** NEW NEW NEW ****************
  ****************************************/
 
+/* Ask for the ownertrust of the key KID.  Returns the ownertrust or
+ * -1 if the user wants to quit.  R_CHANGED is set if the ownertrust
+ * has been stored in the trustdb.  */
 static int
-ask_ownertrust (ctrl_t ctrl, u32 *kid, int minimum)
+ask_ownertrust (ctrl_t ctrl, u32 *kid, int minimum, int *r_changed)
 {
   PKT_public_key *pk;
   int rc;
   int ot;
 
+  *r_changed = 0;
   pk = xmalloc_clear (sizeof *pk);
   rc = get_pubkey (ctrl, pk, kid);
   if (rc)
@@ -1531,12 +1779,16 @@ ask_ownertrust (ctrl_t ctrl, u32 *kid, int minimum)
 	       keystr(kid),trust_value_to_string(opt.force_ownertrust));
       tdb_update_ownertrust (ctrl, pk, opt.force_ownertrust, 0);
       ot=opt.force_ownertrust;
+      *r_changed = 1;
     }
   else
     {
       ot=edit_ownertrust (ctrl, pk, 0);
       if(ot>0)
-	ot = tdb_get_ownertrust (ctrl, pk, 0);
+        {
+          ot = tdb_get_ownertrust (ctrl, pk, 0);
+          *r_changed = 1;
+        }
       else if(ot==0)
 	ot = minimum?minimum:TRUST_UNDEFINED;
       else
@@ -1936,33 +2188,234 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/* The number of keyblocks validate_key_list reads before it processes
+ * them.  */
+#define VALIDATE_BATCH_SIZE 256
+
+/* State of validate_key_list.  */
+struct validate_key_list_s
+{
+  ctrl_t ctrl;
+  KeyHashTable full_trust;
+  struct key_item *klist;
+  u32 curtime;
+  u32 *next_expire;
+  struct cert_graph *graph;     /* NULL or graph to fill.  */
+
+  struct key_array *keys;       /* The result.  */
+  size_t nkeys, maxkeys;
+
+  kbnode_t batch[VALIDATE_BATCH_SIZE];  /* Keyblocks not yet processed.  */
+  unsigned int nbatch;
+};
+
+
+/* Filter for check_uid_certs_parallel to select the certifications
+ * validate_one_keyblock will look at.  See mark_usable_uid_certs.  */
+static int
+klist_cert_filter (void *opaque, kbnode_t keyblock, PKT_signature *sig)
+{
+  struct key_item *klist = opaque;
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  u32 *main_kid = pk_keyid (pk);
+
+  if (pk->has_expired || pk->flags.revoked)
+    return 0;
+  if (sig->keyid[0] == main_kid[0] && sig->keyid[1] == main_kid[1])
+    return 0;
+  if (sig->sig_class >= 0x11 && sig->sig_class <= 0x13
+      && sig->sig_class - 0x10 < opt.min_cert_level)
+    return 0;
+  return !!is_in_klist (klist, sig);
+}
+
+
+/*
+ * Helper for validate_key_list to process the KEYBLOCK read from the
+ * keyDB.  Returns true if the keyblock has been signed by a key in
+ * KLIST; the caller then takes ownership of KEYBLOCK.  If GRAPH is
+ * not NULL the certifications of keys which may become valid at a
+ * later depth are recorded there.
+ */
+static int
+validate_key_list_one (struct validate_key_list_s *vkl, kbnode_t keyblock)
+{
+  PKT_public_key *pk;
+  KBNODE node;
+
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->has_expired || pk->flags.revoked)
+    {
+      /* it does not make sense to look further at those keys */
+      mark_keyblock_seen (vkl->full_trust, keyblock);
+      return 0;
+    }
+
+  if (!validate_one_keyblock (vkl->ctrl, keyblock, vkl->klist,
+                              vkl->curtime, vkl->next_expire))
+    {
+      if (vkl->graph)
+        cert_graph_add_keyblock (vkl->graph, keyblock);
+      return 0;
+    }
+
+  if (pk->expiredate && pk->expiredate >= vkl->curtime
+      && pk->expiredate < *vkl->next_expire)
+    *vkl->next_expire = pk->expiredate;
+
+  /* Optimization - if all uids are fully trusted, then we
+     never need to consider this key as a candidate again. */
+
+  for (node=keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+      break;
+
+  if(node==NULL)
+    mark_keyblock_seen (vkl->full_trust, keyblock);
+  else if (vkl->graph)
+    cert_graph_add_keyblock (vkl->graph, keyblock);
+
+  return 1;
+}
+
+
+/*
+ * Process the batched keyblocks of VKL.  With --trustdb-threads the
+ * certifications relevant for this depth are first verified in
+ * parallel; validate_one_keyblock then finds the cached results.
+ */
+static void
+flush_validate_batch (struct validate_key_list_s *vkl)
+{
+  unsigned int i;
+
+  if (opt.trustdb_threads > 1)
+    check_uid_certs_parallel (vkl->ctrl, vkl->batch, vkl->nbatch,
+                              klist_cert_filter, vkl->klist,
+                              opt.trustdb_threads);
+
+  for (i=0; i < vkl->nbatch; i++)
+    {
+      if (validate_key_list_one (vkl, vkl->batch[i]))
+        {
+          if (vkl->nkeys == vkl->maxkeys) {
+            vkl->maxkeys += 1000;
+            vkl->keys = xrealloc (vkl->keys,
+                                  (vkl->maxkeys+1) * sizeof *vkl->keys);
+          }
+          vkl->keys[vkl->nkeys++].keyblock = vkl->batch[i];
+        }
+      else
+        release_kbnode (vkl->batch[i]);
+      vkl->batch[i] = NULL;
+    }
+  vkl->nbatch = 0;
+}
+
+
+/* Add the KEYBLOCK read from the keyDB to the batch of VKL.  */
+static void
+add_to_validate_batch (struct validate_key_list_s *vkl, kbnode_t keyblock)
+{
+  /* prepare the keyblock for further processing */
+  merge_keys_and_selfsig (vkl->ctrl, keyblock);
+  clear_kbnode_flags (keyblock);
+
+  vkl->batch[vkl->nbatch++] = keyblock;
+  if (vkl->nbatch == VALIDATE_BATCH_SIZE)
+    flush_validate_batch (vkl);
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * klist.  The caller has to pass keydb handle so that we don't use
  * to create our own.  Returns either a key_array or NULL in case of
  * an error.  No results found are indicated by an empty array.
  * Caller hast to release the returned array.
+ *
+ * On the first call GRAPH is filled with the certifications found
+ * during the scan.  Later calls do not scan the keyDB but only fetch
+ * the keys from GRAPH which are certified by a key in KLIST.
  */
 static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
-                   struct key_item *klist, u32 curtime, u32 *next_expire)
+                   struct key_item *klist, u32 curtime, u32 *next_expire,
+                   struct cert_graph *graph, int depth)
 {
   KBNODE keyblock = NULL;
-  struct key_array *keys = NULL;
-  size_t nkeys, maxkeys;
+  struct validate_key_list_s *vkl;
+  struct key_array *keys;
   int rc;
   KEYDB_SEARCH_DESC desc;
-
-  maxkeys = 1000;
-  keys = xmalloc ((maxkeys+1) * sizeof *keys);
-  nkeys = 0;
+  unsigned int *cand = NULL;
+  unsigned int ncand, n;
+
+  vkl = xmalloc_clear (sizeof *vkl);
+  vkl->ctrl = ctrl;
+  vkl->full_trust = full_trust;
+  vkl->klist = klist;
+  vkl->curtime = curtime;
+  vkl->next_expire = next_expire;
+  vkl->graph = graph->complete? NULL : graph;
+  vkl->maxkeys = 1000;
+  vkl->keys = xmalloc ((vkl->maxkeys+1) * sizeof *vkl->keys);
 
   rc = keydb_search_reset (hd);
   if (rc)
     {
       log_error ("keydb_search_reset failed: %s\n", gpg_strerror (rc));
-      xfree (keys);
-      return NULL;
+      goto die;
+    }
+
+  if (graph->complete)
+    {
+      cand = cert_graph_candidates (graph, klist, depth, &ncand);
+      if (DBG_TRUST)
+        log_debug ("validate_key_list: depth %d: %u of %u keys to check\n",
+                   depth, ncand, graph->nkeys);
+
+      for (n=0; n < ncand; n++)
+        {
+          struct cert_graph_key *gk = graph->keys + cand[n];
+
+          if (test_key_hash_table (full_trust, gk->kid))
+            continue;
+
+          /* The candidates are sorted in the order of the keyDB and
+             thus we can continue the search from the last hit.  Only
+             if the key can't be found (e.g. because another process
+             changed the keyDB meanwhile) we start from the top.  */
+          rc = keydb_search_fpr (hd, gk->fpr, gk->fprlen);
+          if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+            {
+              rc = keydb_search_reset (hd);
+              if (!rc)
+                rc = keydb_search_fpr (hd, gk->fpr, gk->fprlen);
+              if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+                continue;
+            }
+          if (rc)
+            {
+              log_error ("keydb_search_fpr failed: %s\n", gpg_strerror (rc));
+              goto die;
+            }
+
+          rc = keydb_get_keyblock (hd, &keyblock);
+          if (rc)
+            {
+              log_error ("keydb_get_keyblock failed: %s\n",
+                         gpg_strerror (rc));
+              goto die;
+            }
+
+          if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+            add_to_validate_batch (vkl, keyblock);
+          else
+            release_kbnode (keyblock);
+          keyblock = NULL;
+        }
+      goto ready;
     }
 
   memset (&desc, 0, sizeof desc);
@@ -1972,8 +2425,8 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   rc = keydb_search (hd, &desc, 1, NULL);
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
-      keys[nkeys].keyblock = NULL;
-      return keys;
+      graph->complete = 1;
+      goto ready;
     }
   if (rc)
     {
@@ -1984,8 +2437,6 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
   do
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
@@ -2002,44 +2453,7 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
           continue;
         }
 
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (ctrl, keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
-        {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
-        }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
-        {
-	  KBNODE node;
-
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
-
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
-
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
-
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
-
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
-
-          keyblock = NULL;
-        }
-
-      release_kbnode (keyblock);
+      add_to_validate_batch (vkl, keyblock);
       keyblock = NULL;
     }
   while (!(rc = keydb_search (hd, &desc, 1, NULL)));
@@ -2050,12 +2464,26 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       goto die;
     }
 
-  keys[nkeys].keyblock = NULL;
+  graph->complete = 1;
+
+ ready:
+  flush_validate_batch (vkl);
+  if (vkl->graph && DBG_TRUST)
+    log_debug ("validate_key_list: certification graph: %u keys, %lu edges\n",
+               graph->nkeys, graph->nedges);
+  xfree (cand);
+  keys = vkl->keys;
+  keys[vkl->nkeys].keyblock = NULL;
+  xfree (vkl);
   return keys;
 
  die:
-  keys[nkeys].keyblock = NULL;
-  release_key_array (keys);
+  for (n=0; n < vkl->nbatch; n++)
+    release_kbnode (vkl->batch[n]);
+  xfree (cand);
+  vkl->keys[vkl->nkeys].keyblock = NULL;
+  release_key_array (vkl->keys);
+  xfree (vkl);
   return NULL;
 }
 
@@ -2103,6 +2531,99 @@ reset_trust_records (ctrl_t ctrl)
     }
 }
 
+/*
+ * Return true if PK has an ownertrust or a validity in the trustdb.
+ */
+static int
+key_in_trustdb (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC trec, vrec;
+  ulong recno;
+  gpg_error_t err;
+
+  err = read_trust_record (ctrl, pk, &trec);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    return 0;
+  if (err)
+    return 1;  /* Let validate_keys handle this.  */
+
+  if ((trec.r.trust.ownertrust & TRUST_MASK) || trec.r.trust.min_ownertrust)
+    return 1;
+  for (recno = trec.r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK)
+          || vrec.r.valid.marginal_count || vrec.r.valid.full_count)
+        return 1;
+    }
+  return 0;
+}
+
+
+/*
+ * Return true if a run of validate_keys may change the validity of
+ * one of the keys noted by tdb_revalidation_mark_key or, through
+ * them, of other keys.  This is not the case if none of the changed
+ * keys has an ownertrust or a validity and none of them carries a
+ * signature made by an ultimately trusted key or by a key with a
+ * validity: the last run did not reach the changed keys and the new
+ * signatures do not connect them to the web of trust; thus all keys
+ * they certify keep their validity as well.  Note that a chain of
+ * several changed keys always starts at a key which meets one of the
+ * above conditions.
+ */
+static int
+changed_keys_affect_validity (ctrl_t ctrl)
+{
+  struct changed_key_s *ck;
+  kbnode_t keyblock, node;
+  PKT_public_key *pk, *signer;
+  PKT_signature *sig;
+  u32 *main_kid;
+  int affected = 0;
+
+  signer = xmalloc_clear (sizeof *signer);
+  for (ck = changed_keys;
+       !affected && ck < changed_keys + n_changed_keys; ck++)
+    {
+      if (get_pubkey_byfprint (ctrl, NULL, &keyblock, ck->fpr, ck->fprlen))
+        {
+          affected = 1;  /* Deleted meanwhile?  */
+          break;
+        }
+
+      pk = keyblock->pkt->pkt.public_key;
+      main_kid = pk_keyid (pk);
+      if (key_in_trustdb (ctrl, pk))
+        affected = 1;
+
+      for (node = keyblock; !affected && node; node = node->next)
+        {
+          if (node->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+          sig = node->pkt->pkt.signature;
+          if (sig->keyid[0] == main_kid[0] && sig->keyid[1] == main_kid[1])
+            continue;
+
+          if (tdb_keyid_is_utk (sig->keyid))
+            affected = 1;
+          else if (!get_pubkey_fast (ctrl, signer, sig->keyid))
+            {
+              affected = key_in_trustdb (ctrl, signer);
+              release_public_key_parts (signer);
+            }
+        }
+      release_kbnode (keyblock);
+    }
+  xfree (signer);
+
+  if (DBG_TRUST)
+    log_debug ("changed_keys_affect_validity: %u keys: %s\n",
+               n_changed_keys, affected? "yes":"no");
+  return affected;
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -2113,6 +2634,8 @@ reset_trust_records (ctrl_t ctrl)
  * Step 3:   if OWNERTRUST of any key in klist is undefined
  *             ask user to assign ownertrust
  * Step 4:   Loop over all keys in the keyDB which are not marked seen
+ *           (after the first round only over those keys which are
+ *           certified by a key in klist; see struct cert_graph)
  * Step 5:     if key is revoked or expired
  *                mark key as seen
  *                continue loop at Step 4
@@ -2126,6 +2649,9 @@ reset_trust_records (ctrl_t ctrl)
  *           End Loop
  *         Ready
  *
+ * If the only changes since the last run are keys noted by
+ * tdb_revalidation_mark_key, the run is skipped if these keys are not
+ * connected to the web of trust; see changed_keys_affect_validity.
  */
 static int
 validate_keys (ctrl_t ctrl, int interactive)
@@ -2141,8 +2667,26 @@ validate_keys (ctrl_t ctrl, int interactive)
   int depth;
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
+  struct cert_graph *graph = NULL;
+  struct key_item *new_ownertrusts = NULL;
+  int in_transaction = 0;
   u32 start_time, next_expire;
 
+  if (!interactive && changed_keys_only && n_changed_keys
+      && (!changed_keys_nextcheck
+          || changed_keys_nextcheck > make_timestamp ())
+      && !changed_keys_affect_validity (ctrl))
+    {
+      if (opt.verbose)
+        log_info (_("no need for a trustdb check\n"));
+      if (tdbio_write_nextcheck (ctrl, changed_keys_nextcheck))
+        do_sync ();
+      pending_check_trustdb = 0;
+      changed_keys_only = 0;
+      n_changed_keys = 0;
+      return 0;
+    }
+
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
      Perhaps combine this with reset_trust_records(), or only check
@@ -2159,6 +2703,16 @@ validate_keys (ctrl_t ctrl, int interactive)
   stored = new_key_hash_table ();
   used = new_key_hash_table ();
   full_trust = new_key_hash_table ();
+  graph = new_cert_graph ();
+
+  /* All changes of this run are written at once at the end.  */
+  rc = tdbio_begin_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+      g10_exit (2);
+    }
+  in_transaction = 1;
 
   reset_trust_records (ctrl);
 
@@ -2237,13 +2791,25 @@ validate_keys (ctrl_t ctrl, int interactive)
 
           if (interactive && k->ownertrust == TRUST_UNKNOWN)
 	    {
-	      k->ownertrust = ask_ownertrust (ctrl, k->kid,min);
+              int changed;
+
+	      k->ownertrust = ask_ownertrust (ctrl, k->kid, min, &changed);
 
 	      if (k->ownertrust == (unsigned int)(-1))
 		{
 		  quit=1;
 		  goto leave;
 		}
+              if (changed)
+                {
+                  struct key_item *ot = new_key_item ();
+
+                  ot->kid[0] = k->kid[0];
+                  ot->kid[1] = k->kid[1];
+                  ot->ownertrust = k->ownertrust;
+                  ot->next = new_ownertrusts;
+                  new_ownertrusts = ot;
+                }
 	    }
 
 	  /* This can happen during transition from an old trustdb
@@ -2280,7 +2846,7 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       /* Find all keys which are signed by a key in kdlist */
       keys = validate_key_list (ctrl, kdb, full_trust, klist,
-				start_time, &next_expire);
+				start_time, &next_expire, graph, depth);
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2360,6 +2926,7 @@ validate_keys (ctrl_t ctrl, int interactive)
   release_key_array (keys);
   if (klist != utk_list)
     release_key_items (klist);
+  release_cert_graph (graph);
   release_key_hash_table (full_trust);
   release_key_hash_table (used);
   release_key_hash_table (stored);
@@ -2387,7 +2954,34 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       do_sync ();
       pending_check_trustdb = 0;
+      changed_keys_only = 0;
+      n_changed_keys = 0;
+    }
+
+  if (in_transaction && (rc || quit))
+    {
+      /* Nothing of an incomplete run is written but we keep the
+       * ownertrust values the user entered before quitting.  */
+      tdbio_cancel_transaction ();
+      for (k = new_ownertrusts; k; k = k->next)
+        {
+          PKT_public_key *pk = xmalloc_clear (sizeof *pk);
+
+          if (!get_pubkey (ctrl, pk, k->kid))
+            tdb_update_ownertrust (ctrl, pk, k->ownertrust, 0);
+          free_public_key (pk);
+        }
+    }
+  else if (in_transaction)
+    {
+      int rc2 = tdbio_end_transaction ();
+      if (rc2)
+        {
+          log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc2));
+          g10_exit (2);
+        }
     }
+  release_key_items (new_ownertrusts);
 
   return rc;
 }
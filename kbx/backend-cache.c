@@ -38,12 +38,17 @@
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
-#define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
-#define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+/* The initial number of buckets of the hash tables.  This must be a
+ * power of 2.  The tables are doubled in size if they get too full.  */
+#define INITIAL_KEY_ITEM_BUCKETS  512
+#define INITIAL_BLOB_BUCKETS      512
+
+/* The average number of items per bucket which triggers a resize.  */
+#define MAX_ITEMS_PER_BUCKET  2
+
+/* The key table may use 1/KEY_TABLE_SHARE of the cache size; the
+ * rest is used for the blobs.  */
+#define KEY_TABLE_SHARE  8
 
 
 /* Our definition of the backend handle.  */
@@ -60,18 +65,30 @@ typedef struct blob_s
   struct blob_s *next;
   enum pubkey_types pktype;
   unsigned int refcount;
-  unsigned int usecount;
+  unsigned int used:1;        /* The reference bit for the CLOCK.  */
+  unsigned int ephemeral:1;   /* The key is marked as ephemeral.   */
+  unsigned int revoked:1;     /* The key is marked as revoked.     */
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
   unsigned char ubid[UBID_LEN];
 } *blob_t;
 
 
+/* Information about a hash table.  */
+struct table_info_s
+{
+  size_t size;          /* Number of allocated buckets; a power of 2. */
+  size_t items;         /* Number of items in the table.              */
+  size_t bytes;         /* Memory used by the items.                  */
+  size_t hand;          /* The bucket the CLOCK hand points to.       */
+  unsigned long added;  /* Number of items added.                     */
+  unsigned long dropped;/* Number of items evicted.                   */
+  unsigned long hits;   /* Number of successful lookups.              */
+  unsigned long misses; /* Number of failed lookups.                  */
+};
+
 static blob_t *blob_table;                /* Hash table with the blobs.   */
-static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int blob_table_added;     /* Number of items added.       */
-static unsigned int blob_table_dropped;   /* Number of items dropped.     */
+static struct table_info_s blob_info;     /* Info about that table.       */
 static blob_t blob_attic;                 /* List of freed blobs.         */
 
 
@@ -107,41 +124,61 @@ typedef struct key_item_s
 {
   struct key_item_s *next;
   bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
+  unsigned int used:1;     /* The reference bit for the CLOCK.  */
+  unsigned int nblist;     /* Number of items in BLIST.  */
   unsigned int refcount;   /* Reference counter for this item.  */
   u32 kid_h;               /* Upper 4 bytes of the keyid.  */
   u32 kid_l;               /* Lower 4 bytes of the keyid.  */
 } *key_item_t;
 
 static key_item_t *key_table;            /* Hash table with the keys.    */
-static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int key_table_added;     /* Number of items added.       */
-static unsigned int key_table_dropped;   /* Number of items dropped.     */
+static struct table_info_s key_info;     /* Info about that table.       */
 static key_item_t key_item_attic;        /* List of freed items.         */
 
 
+/* The memory accounted for a blob item B.  */
+#define BLOB_BYTES(b)  (sizeof (struct blob_s) + (b)->datalen)
 
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
+/* The memory accounted for a key item KI.  */
+#define KEY_ITEM_BYTES(ki)  (sizeof (struct key_item_s) \
+                             + (ki)->nblist * sizeof (struct bloblist_s))
+
+
+
+/* Return the maximum number of bytes to be used by the blob table.  */
+static size_t
+blob_table_limit (void)
+{
+  return opt.cache_size - opt.cache_size / KEY_TABLE_SHARE;
+}
+
+
+/* Return the maximum number of bytes to be used by the key table.  */
+static size_t
+key_table_limit (void)
+{
+  return opt.cache_size / KEY_TABLE_SHARE;
+}
+
+
+/* The hash function we use for the blob_table.  Must not call a
+ * system function.  The UBID is a hash value and thus we can take
+ * any of its bits.  */
 static inline unsigned int
 blob_table_hasher (const unsigned char *ubid)
 {
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
+  return buf32_to_uint (ubid) & (blob_info.size - 1);
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the blob table.  */
 static gpg_error_t
 blob_table_init (void)
 {
   if (blob_table)
     return 0;
-  blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
-  blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
+  blob_info.size = INITIAL_BLOB_BUCKETS;
+  blob_table = xtrycalloc (blob_info.size, sizeof *blob_table);
   if (!blob_table)
     return gpg_error_from_syserror ();
   return 0;
@@ -168,56 +205,118 @@ blob_unref (blob_t blob)
 
 
 /* Given the hash value and the ubid, find the blob in the bucket.
- * Returns NULL if not found or the blob item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  */
+ * Returns NULL if not found or the blob item if found.  */
 static blob_t
-find_blob (unsigned int hash, const unsigned char *ubid,
-           unsigned int *r_count)
+find_blob (unsigned int hash, const unsigned char *ubid)
 {
   blob_t b;
-  unsigned int count = 0;
 
-  for (b = blob_table[hash]; b; b = b->next, count++)
+  for (b = blob_table[hash]; b; b = b->next)
     if (!memcmp (b->ubid, ubid, UBID_LEN))
       break;
-  if (r_count)
-    *r_count = count;
   return b;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
+/* Double the size of the blob table if it has too many items.  */
+static void
+blob_table_maybe_grow (void)
 {
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
+  blob_t *newtable, b, b_next;
+  size_t oldsize, newsize, idx;
+  unsigned int hash;
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  oldsize = blob_info.size;
+  if (blob_info.items <= oldsize * MAX_ITEMS_PER_BUCKET)
+    return;
+  newsize = oldsize * 2;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - we keep the old table.  */
+  if (blob_info.size != oldsize)
+    {
+      /* Another thread resized the table in the meantime.  */
+      xfree (newtable);
+      return;
+    }
+
+  /* Move the items; note that we may not use any system call here.  */
+  blob_info.size = newsize;
+  for (idx=0; idx < oldsize; idx++)
+    for (b = blob_table[idx]; b; b = b_next)
+      {
+        b_next = b->next;
+        hash = blob_table_hasher (b->ubid);
+        b->next = newtable[hash];
+        newtable[hash] = b;
+      }
+  xfree (blob_table);
+  blob_table = newtable;
+  blob_info.hand = 0;
+}
+
+
+/* Evict blobs until the table uses no more than LIMIT bytes.  This
+ * implements the CLOCK algorithm: The hand sweeps over the buckets;
+ * an item which has been used since the last sweep is spared but its
+ * reference bit is cleared.  */
+static void
+blob_table_evict (size_t limit)
+{
+  blob_t b, *bp, victims = NULL;
+
+  /* Unlink the victims; note that we may not use any system call
+   * here.  */
+  while (blob_info.bytes > limit && blob_info.items)
+    {
+      for (bp = blob_table + blob_info.hand; (b = *bp); )
+        {
+          if (b->used)
+            {
+              b->used = 0;
+              bp = &b->next;
+            }
+          else
+            {
+              *bp = b->next;
+              b->next = victims;
+              victims = b;
+              blob_info.items--;
+              blob_info.bytes -= BLOB_BYTES (b);
+              blob_info.dropped++;
+            }
+        }
+      blob_info.hand = (blob_info.hand + 1) & (blob_info.size - 1);
+    }
+
+  for (; victims; victims = b)
+    {
+      b = victims->next;
+      blob_unref (victims);
+    }
 }
 
 
 /* Put the blob (BLOBDATA, BLOBDATALEN) into the cache using UBID as
- * the index.  If it is already in the cache nothing happens.  */
+ * the index.  IS_EPHEMERAL and IS_REVOKED are the flags of the key.
+ * If it is already in the cache nothing happens.  */
 static void
 blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
-                const void *blobdata, unsigned int blobdatalen)
+                const void *blobdata, unsigned int blobdatalen,
+                int is_ephemeral, int is_revoked)
 {
   unsigned int hash;
   blob_t b;
-  unsigned int count, n;
+  unsigned int n;
   void *blobdatacopy = NULL;
 
-  hash = blob_table_hasher (ubid);
+  /* Do not let a single blob flush a large part of the cache.  */
+  if (sizeof *b + blobdatalen > blob_table_limit () / 16)
+    return;
+
  find_again:
-  b = find_blob (hash, ubid, &count);
+  hash = blob_table_hasher (ubid);
+  b = find_blob (hash, ubid);
   if (b)
     {
       xfree (blobdatacopy);
@@ -237,72 +336,6 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
       memcpy (blobdatacopy, blobdata, blobdatalen);
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
-    {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
-    }
-
   /* Add an item to the bucket.  We allocate a whole block of items
    * for cache performance reasons.  */
   if (!blob_attic)
@@ -331,19 +364,28 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
     }
 
   /* We now know that there is an item in the attic.  Put it into the
-   * chain.  Note that we may not use any system call here. */
+   * chain.  Note that we may not use any system call here.  The
+   * reference bit is not set so that blobs which are used only once,
+   * for example by a listing of all keys, are evicted first.  */
   b = blob_attic;
   blob_attic = b->next;
   b->next = NULL;
   b->pktype = pktype;
+  b->ephemeral = !!is_ephemeral;
+  b->revoked = !!is_revoked;
   b->data = blobdatacopy;
   b->datalen = blobdatalen;
   memcpy (b->ubid, ubid, UBID_LEN);
-  b->usecount = 1;
+  b->used = 0;
   b->refcount = 1;
   b->next = blob_table[hash];
   blob_table[hash] = b;
-  blob_table_added++;
+  blob_info.items++;
+  blob_info.bytes += BLOB_BYTES (b);
+  blob_info.added++;
+
+  blob_table_evict (blob_table_limit ());
+  blob_table_maybe_grow ();
 }
 
 
@@ -356,38 +398,56 @@ blob_table_get (const unsigned char *ubid)
   blob_t b;
 
   hash = blob_table_hasher (ubid);
-  b = find_blob (hash, ubid, NULL);
+  b = find_blob (hash, ubid);
   if (b)
     {
-      b->usecount++;
+      blob_info.hits++;
+      b->used = 1;
       b->refcount++;
       return b;  /* Found  */
     }
 
+  blob_info.misses++;
   return NULL;
 }
 
 
-
+/* Remove the blob with UBID from the cache.  */
+static void
+blob_table_remove (const unsigned char *ubid)
+{
+  blob_t b, *bp;
+
+  for (bp = blob_table + blob_table_hasher (ubid); (b = *bp); bp = &b->next)
+    if (!memcmp (b->ubid, ubid, UBID_LEN))
+      {
+        *bp = b->next;
+        blob_info.items--;
+        blob_info.bytes -= BLOB_BYTES (b);
+        blob_unref (b);
+        break;
+      }
+}
+
+
+
 /* The hash function we use for the key_table.  Must not call a system
  * function.  */
 static inline unsigned int
 key_table_hasher (u32 kid_l)
 {
-  return kid_l % key_table_size;
+  return kid_l & (key_info.size - 1);
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the key table.  */
 static gpg_error_t
 key_table_init (void)
 {
   if (key_table)
     return 0;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
-  key_table = xtrycalloc (key_table_size, sizeof *key_table);
+  key_info.size = INITIAL_KEY_ITEM_BUCKETS;
+  key_table = xtrycalloc (key_info.size, sizeof *key_table);
   if (!key_table)
     return gpg_error_from_syserror ();
   return 0;
@@ -406,6 +466,7 @@ key_item_unref (key_item_t ki)
     {
       bl = ki->blist;
       ki->blist = NULL;
+      ki->nblist = 0;
       ki->next = key_item_attic;
       key_item_attic = ki;
 
@@ -421,40 +482,93 @@ key_item_unref (key_item_t ki)
 
 
 /* Given the hash value and the search info, find the key item in the
- * bucket.  Return NULL if not found or the key item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  Note that FPR may only be NULL
- * if FPRLEN is 0. */
+ * bucket.  Return NULL if not found or the key item if found.  */
 static key_item_t
-find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
-               unsigned int *r_count)
+find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l)
 {
   key_item_t ki = key_table[hash];
-  unsigned int count = 0;
 
-  for (; ki; ki = ki->next, count++)
+  for (; ki; ki = ki->next)
     if (ki->kid_h == kid_h && ki->kid_l == kid_l)
       break;
-  if (r_count)
-    *r_count = count;
   return ki;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_key_items (const void *arg_a, const void *arg_b)
+/* Double the size of the key table if it has too many items.  */
+static void
+key_table_maybe_grow (void)
 {
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
+  key_item_t *newtable, ki, ki_next;
+  size_t oldsize, newsize, idx;
+  unsigned int hash;
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  oldsize = key_info.size;
+  if (key_info.items <= oldsize * MAX_ITEMS_PER_BUCKET)
+    return;
+  newsize = oldsize * 2;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - we keep the old table.  */
+  if (key_info.size != oldsize)
+    {
+      /* Another thread resized the table in the meantime.  */
+      xfree (newtable);
+      return;
+    }
+
+  /* Move the items; note that we may not use any system call here.  */
+  key_info.size = newsize;
+  for (idx=0; idx < oldsize; idx++)
+    for (ki = key_table[idx]; ki; ki = ki_next)
+      {
+        ki_next = ki->next;
+        hash = key_table_hasher (ki->kid_l);
+        ki->next = newtable[hash];
+        newtable[hash] = ki;
+      }
+  xfree (key_table);
+  key_table = newtable;
+  key_info.hand = 0;
+}
+
+
+/* Evict key items until the table uses no more than LIMIT bytes.  See
+ * blob_table_evict for a description.  */
+static void
+key_table_evict (size_t limit)
+{
+  key_item_t ki, *kip, victims = NULL;
+
+  /* Unlink the victims; note that we may not use any system call
+   * here.  */
+  while (key_info.bytes > limit && key_info.items)
+    {
+      for (kip = key_table + key_info.hand; (ki = *kip); )
+        {
+          if (ki->used)
+            {
+              ki->used = 0;
+              kip = &ki->next;
+            }
+          else
+            {
+              *kip = ki->next;
+              ki->next = victims;
+              victims = ki;
+              key_info.items--;
+              key_info.bytes -= KEY_ITEM_BYTES (ki);
+              key_info.dropped++;
+            }
+        }
+      key_info.hand = (key_info.hand + 1) & (key_info.size - 1);
+    }
+
+  for (; victims; victims = ki)
+    {
+      ki = victims->next;
+      key_item_unref (victims);
+    }
 }
 
 
@@ -545,85 +659,6 @@ new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
-{
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
-
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
-    {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
-    }
-
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
-
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
-    }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
-
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
-    {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
-    }
-  return err;
-}
-
-
 /* This is the core of
  *   key_table_put,
  *   key_table_put_no_fpr,
@@ -637,14 +672,13 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   unsigned int hash;
   key_item_t ki;
   bloblist_t bl, bl_tail;
-  unsigned int count;
   int do_find_again;
   int mark_not_found = !fpr;
 
-  hash = key_table_hasher (kid_l);
  find_again:
   do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
+  hash = key_table_hasher (kid_l);
+  ki = find_in_chain (hash, kid_h, kid_l);
   if (ki)
     {
       if (mark_not_found)
@@ -673,18 +707,13 @@ do_key_table_put (u32 kid_h, u32 kid_l,
         bl_tail->next = bl;
       else
         ki->blist = bl;
+      ki->nblist++;
+      key_info.bytes += sizeof *bl;
 
+      key_table_evict (key_table_limit ());
       return;
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
-
   if (!key_item_attic)
     {
       if (alloc_more_key_items ())
@@ -709,18 +738,29 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   ki->next = NULL;
 
   if (mark_not_found)
-    ki->blist = NULL;
+    {
+      ki->blist = NULL;
+      ki->nblist = 0;
+    }
   else
-    ki->blist = new_bloblist_item (fpr, fprlen, ubid, subkey);
+    {
+      ki->blist = new_bloblist_item (fpr, fprlen, ubid, subkey);
+      ki->nblist = 1;
+    }
 
   ki->kid_h = kid_h;
   ki->kid_l = kid_l;
-  ki->usecount = 1;
+  ki->used = 0;
   ki->refcount = 1;
 
   ki->next = key_table[hash];
   key_table[hash] = ki;
-  key_table_added++;
+  key_info.items++;
+  key_info.bytes += KEY_ITEM_BYTES (ki);
+  key_info.added++;
+
+  key_table_evict (key_table_limit ());
+  key_table_maybe_grow ();
 }
 
 
@@ -793,10 +833,10 @@ key_table_get (u32 kid_h, u32 kid_l)
   key_item_t ki;
 
   hash = key_table_hasher (kid_l);
-  ki = find_in_chain (hash, kid_h, kid_l, NULL);
+  ki = find_in_chain (hash, kid_h, kid_l);
   if (ki)
     {
-      ki->usecount++;
+      ki->used = 1;
       ki->refcount++;
       return ki;  /* Found  */
     }
@@ -805,6 +845,47 @@ key_table_get (u32 kid_h, u32 kid_l)
 }
 
 
+/* Remove the key item for the keyid (KID_H,KID_L) from the cache.  */
+static void
+key_table_remove (u32 kid_h, u32 kid_l)
+{
+  key_item_t ki, *kip;
+
+  for (kip = key_table + key_table_hasher (kid_l); (ki = *kip);
+       kip = &ki->next)
+    if (ki->kid_h == kid_h && ki->kid_l == kid_l)
+      {
+        *kip = ki->next;
+        key_info.items--;
+        key_info.bytes -= KEY_ITEM_BYTES (ki);
+        key_item_unref (ki);
+        break;
+      }
+}
+
+
+/* Remove all key items from the cache.  */
+static void
+key_table_flush (void)
+{
+  key_item_t ki, ki_next;
+  size_t idx;
+
+  for (idx=0; idx < key_info.size; idx++)
+    {
+      ki = key_table[idx];
+      key_table[idx] = NULL;
+      for (; ki; ki = ki_next)
+        {
+          ki_next = ki->next;
+          key_item_unref (ki);
+        }
+    }
+  key_info.items = 0;
+  key_info.bytes = 0;
+}
+
+
 /* Return a key item by searching for the keyid.  The caller must use
  * key_item_unref on it.  */
 static key_item_t
@@ -859,6 +940,29 @@ be_cache_initialize (void)
 }
 
 
+/* Return a malloced string with statistics about the cache.  There
+ * is one line for each table:
+ *
+ *   <table> items=N bytes=N limit=N buckets=N hits=N misses=N
+ *           added=N dropped=N
+ *
+ * (printed as a single line) where TABLE is either "blob" or "key".
+ * NULL is returned on error with ERRNO set.  */
+char *
+be_cache_stats (void)
+{
+  return xtryasprintf
+    ("blob items=%zu bytes=%zu limit=%zu buckets=%zu"
+     " hits=%lu misses=%lu added=%lu dropped=%lu\n"
+     "key items=%zu bytes=%zu limit=%zu buckets=%zu"
+     " hits=%lu misses=%lu added=%lu dropped=%lu\n",
+     blob_info.items, blob_info.bytes, blob_table_limit (), blob_info.size,
+     blob_info.hits, blob_info.misses, blob_info.added, blob_info.dropped,
+     key_info.items, key_info.bytes, key_table_limit (), key_info.size,
+     key_info.hits, key_info.misses, key_info.added, key_info.dropped);
+}
+
+
 /* Install a new resource and return a handle for that backend.  */
 gpg_error_t
 be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd)
@@ -1017,7 +1121,7 @@ be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
                 {
                   err = be_return_pubkey (ctrl, b->data, b->datalen,
                                           b->pktype, desc[n].u.ubid,
-                                          0, 0, 0, 0);
+                                          b->ephemeral, b->revoked, 0, 0);
                   blob_unref (b);
                   reqpart->cache_seqno.ubid++;
                 }
@@ -1059,7 +1163,8 @@ be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
           if (b)
             {
               err = be_return_pubkey (ctrl, b->data, b->datalen,
-                                      PUBKEY_TYPE_OPGP, bl->ubid, 0, 0, 0, 0);
+                                      PUBKEY_TYPE_OPGP, bl->ubid,
+                                      b->ephemeral, b->revoked, 0, 0);
               blob_unref (b);
             }
           else
@@ -1083,6 +1188,86 @@ be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
 }
 
 
+/* Try to answer the search (DESC,NDESC) from the cache.  This is
+ * called by the frontend before the actual database is searched and
+ * only for the first search of a request.  Returns:
+ *   0                 - found and returned via the cache
+ *   GPG_ERR_NOT_FOUND - marked in the cache as not available
+ *   GPG_ERR_EOF       - cache miss; the database needs to be searched.
+ * A search for a single UBID is answered from the blob table.  For
+ * searches by fingerprint or long keyid we only use the not-found
+ * marks: the bloblists are not guaranteed to be complete and thus
+ * can't be used to answer a search which may be continued using the
+ * NEXT command.  */
+gpg_error_t
+be_cache_lookup (ctrl_t ctrl, db_request_t request,
+                 KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
+{
+  gpg_error_t err;
+  unsigned int n;
+  key_item_t ki;
+  blob_t b;
+  int not_found;
+
+  if (!ndesc)
+    return gpg_error (GPG_ERR_EOF);
+
+  if (ndesc == 1 && desc[0].mode == KEYDB_SEARCH_MODE_UBID)
+    {
+      /* We only cache OpenPGP keys.  */
+      if (ctrl->filter_x509 && !ctrl->filter_opgp)
+        return gpg_error (GPG_ERR_EOF);
+
+      b = blob_table_get (desc[0].u.ubid);
+      if (!b)
+        return gpg_error (GPG_ERR_EOF);
+      err = be_return_pubkey (ctrl, b->data, b->datalen, b->pktype,
+                              desc[0].u.ubid, b->ephemeral, b->revoked, 0, 0);
+      blob_unref (b);
+      if (!err)
+        {
+          /* A UBID is unique; thus a NEXT will not find anything.  */
+          memcpy (request->last_cached_ubid, desc[0].u.ubid, UBID_LEN);
+          request->last_cached_valid = 1;
+          request->last_cached_final = 1;
+        }
+      return err;
+    }
+
+  /* Return not found only if all descriptors are marked as such.  */
+  not_found = 1;
+  for (n=0; not_found && n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          ki = query_by_kid (desc[n].u.kid[0], desc[n].u.kid[1]);
+          break;
+
+        case KEYDB_SEARCH_MODE_FPR:
+          ki = query_by_fpr (desc[n].u.fpr, desc[n].fprlen);
+          break;
+
+        default:
+          return gpg_error (GPG_ERR_EOF); /* Not cacheable.  */
+        }
+
+      if (!ki || ki->blist)
+        not_found = 0;
+      key_item_unref (ki);
+    }
+
+  if (!not_found)
+    {
+      key_info.misses++;
+      return gpg_error (GPG_ERR_EOF);
+    }
+
+  key_info.hits++;
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+
 /* Mark the last cached item as the final item.  This is called when
  * the actual database returned EOF in respond to a restart from the
  * last cached UBID.  */
@@ -1134,11 +1319,14 @@ be_cache_mark_final (ctrl_t ctrl, db_request_t request)
 }
 
 
-/* Put the key (BLOB,BLOBLEN) of PUBKEY_TYPE into the cache.  */
+/* Put the key (BLOB,BLOBLEN) of PUBKEY_TYPE into the cache.
+ * IS_EPHEMERAL and IS_REVOKED are the flags as returned by the
+ * backend.  */
 void
 be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                  const void *blob, unsigned int bloblen,
-                 enum pubkey_types pubkey_type)
+                 enum pubkey_types pubkey_type,
+                 int is_ephemeral, int is_revoked)
 {
   gpg_error_t err;
 
@@ -1157,7 +1345,8 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
           return;
         }
 
-      blob_table_put (ubid, pubkey_type, blob, bloblen);
+      blob_table_put (ubid, pubkey_type, blob, bloblen,
+                      is_ephemeral, is_revoked);
 
       kinfo = &info.primary;
       key_table_put (kinfo->fpr, kinfo->fprlen, ubid, 0);
@@ -1171,6 +1360,47 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
 }
 
 
+/* Remove the key (BLOB,BLOBLEN) of PUBKEY_TYPE with UBID from the
+ * cache.  This needs to be called before a key is updated, inserted,
+ * or deleted.  For a deletion BLOB is NULL.  */
+void
+be_cache_invalidate (ctrl_t ctrl, const unsigned char *ubid,
+                     const void *blob, unsigned int bloblen,
+                     enum pubkey_types pubkey_type)
+{
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *kinfo;
+
+  (void)ctrl;
+
+  blob_table_remove (ubid);
+
+  /* A deleted key does not invalidate the not-found marks and a stale
+   * entry in a bloblist is never used to answer a search.  */
+  if (!blob)
+    return;
+
+  /* A new or updated key may carry a keyid which we marked as not
+   * found.  If we can't figure out the keyids flush all marks.  */
+  if (pubkey_type != PUBKEY_TYPE_OPGP
+      || _keybox_parse_openpgp (blob, bloblen, NULL, &info))
+    {
+      key_table_flush ();
+      return;
+    }
+
+  kinfo = &info.primary;
+  key_table_remove (buf32_to_u32 (kinfo->keyid),
+                    buf32_to_u32 (kinfo->keyid+4));
+  if (info.nsubkeys)
+    for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
+      key_table_remove (buf32_to_u32 (kinfo->keyid),
+                        buf32_to_u32 (kinfo->keyid+4));
+
+  _keybox_destroy_openpgp_info (&info);
+}
+
+
 /* Put the a non-found mark for PUBKEY_TYPE into the cache.  The
  * indices are taken from the search descriptors (DESC,NDESC).  */
 void
@@ -1184,7 +1414,7 @@ be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
 
   for (n=0; n < ndesc; n++)
     {
-      switch (desc->mode)
+      switch (desc[n].mode)
         {
         case KEYDB_SEARCH_MODE_LONG_KID:
           key_table_put_no_kid (desc[n].u.kid[0], desc[n].u.kid[1]);
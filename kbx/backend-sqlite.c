@@ -51,6 +51,10 @@ struct be_sqlite_local_s
   /* The statement object of the current select command.  */
   sqlite3_stmt *select_stmt;
 
+  /* The database handle SELECT_STMT belongs to.  This is either
+   * DATABASE_HD or a handle taken from the reader pool.  */
+  sqlite3 *select_db;
+
   /* The column numbers for UIDNO and SUBKEY or 0.  */
   int select_col_uidno;
   int select_col_subkey;
@@ -58,6 +62,13 @@ struct be_sqlite_local_s
   /* The search mode represented by the current select command.  */
   KeydbSearchMode select_mode;
 
+  /* The current select command uses the full-text index.  */
+  unsigned int select_fts : 1;
+
+  /* The number of search descriptions handled by the current select
+   * command.  */
+  unsigned int select_nbatch;
+
   /* The flags active when the select was first done.  */
   unsigned int filter_opgp : 1;
   unsigned int filter_x509 : 1;
@@ -88,9 +99,36 @@ static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
 static sqlite3 *database_hd;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
+/* The name of the database file.  */
+static char *database_filename;
+
+/* The maximum number of read-only handles we open in addition to
+ * DATABASE_HD.  */
+#define MAX_DB_READERS 32
+
+/* The pool of read-only database handles.  They are only used if the
+ * database is in WAL mode so that they can run concurrently with each
+ * other and with the writer.  A handle is assigned to one request at
+ * a time; thus no mutex is required and we can release the sceptre
+ * while stepping a select on it.  */
+static struct
+{
+  sqlite3 *hd;
+  int in_use;
+} db_readers[MAX_DB_READERS];
+/* The number of opened handles in DB_READERS.  */
+static int db_readers_used;
+/* Set if the reader pool may be used.  */
+static int db_readers_enabled;
+/* Set if the full-text indices for the user ids are available.  */
+static int db_fts_enabled;
 
 /* The version of our current database schema.  */
-#define DATABASE_VERSION 1
+#define DATABASE_VERSION 3
+
+/* The maximum number of search descriptions combined into one select
+ * statement.  Older SQLite versions allow only 999 parameters.  */
+#define MAX_BATCH_DESC 256
 
 /* Table definitions for the database.  */
 static struct
@@ -103,7 +141,7 @@ static struct
 
    /* Table to store config values:
     * Standard name value pairs:
-    *   dbversion = 1
+    *   dbversion = 3
     *   created = <ISO time string>
     */
    { "CREATE TABLE IF NOT EXISTS config ("
@@ -149,7 +187,9 @@ static struct
    { "CREATE INDEX IF NOT EXISTS fingerprintidx1 on fingerprint (fpr)"     },
    { "CREATE INDEX IF NOT EXISTS fingerprintidx2 on fingerprint (keygrip)" },
 
-   /* Table to allow fast access via user ids or mail addresses.  */
+   /* Table to allow fast access via user ids or mail addresses.
+    * Version 3 of the schema adds the column RID as INTEGER PRIMARY
+    * KEY; see schema_upgrades.  */
    { "CREATE TABLE IF NOT EXISTS userid ("
      /* The full user id - for X.509 the Subject or altSubject.  */
      "uid  TEXT NOT NULL,"
@@ -185,6 +225,95 @@ static struct
   };
 
 
+/* Upgrades of the database schema.  The statements for VERSION are
+ * run on a database of version VERSION-1 and the version is then
+ * set to VERSION.  A new database is first created with the tables
+ * of version 1 and then upgraded.  */
+static struct
+{
+  int version;
+  const char *sql;
+} schema_upgrades[] =
+  {
+   /* An index for short keyid searches; i.e. the low 32 bits of the
+    * keyid.  The expression must match the one used by the search
+    * for KEYDB_SEARCH_MODE_SHORT_KID.  */
+   { 2, "CREATE INDEX IF NOT EXISTS fingerprintidx3"
+        " on fingerprint (substr(kid,5))" },
+
+   /* Give the userid table an explicit rowid so that a VACUUM does
+    * not renumber the rows; the full-text indices refer to them.
+    * The triggers of the full-text indices are dropped along with
+    * the old table and create_fts_tables rebuilds the indices.  */
+   { 3, "CREATE TABLE userid_v3 ("
+        "rid  INTEGER PRIMARY KEY,"
+        "uid  TEXT NOT NULL,"
+        "addrspec TEXT,"
+        "type  INTEGER NOT NULL,"
+        "uidno INTEGER NOT NULL,"
+        "ubid BLOB NOT NULL REFERENCES pubkey"
+        ")" },
+   { 3, "INSERT INTO userid_v3 (rid, uid, addrspec, type, uidno, ubid)"
+        " SELECT rowid, uid, addrspec, type, uidno, ubid FROM userid" },
+   { 3, "DROP TABLE userid" },
+   { 3, "ALTER TABLE userid_v3 RENAME TO userid" },
+   { 3, "CREATE INDEX IF NOT EXISTS userididx0 on userid (ubid)"     },
+   { 3, "CREATE INDEX IF NOT EXISTS userididx1 on userid (uid)"      },
+   { 3, "CREATE INDEX IF NOT EXISTS userididx3 on userid (addrspec)" }
+  };
+
+
+/* Definitions for the full-text indices over the userid table.  They
+ * are only created if SQLite supports them; see create_fts_tables.
+ * USERID_FTS uses the trigram tokenizer and is used for substring
+ * searches; USERID_WORDS indexes the words of the user ids.  Both
+ * are external content tables which are kept in sync with the userid
+ * table by triggers.  They refer to the rowid of the userid table,
+ * which is an INTEGER PRIMARY KEY since version 3 of the schema and
+ * thus kept by a VACUUM.  */
+static const char *fts_definitions[] =
+  {
+   "CREATE VIRTUAL TABLE IF NOT EXISTS userid_fts USING fts5("
+   "uid, addrspec,"
+   "content='userid', content_rowid='rowid', tokenize='trigram'"
+   ")",
+
+   "CREATE VIRTUAL TABLE IF NOT EXISTS userid_words USING fts5("
+   "uid,"
+   "content='userid', content_rowid='rowid', tokenize='unicode61'"
+   ")",
+
+   "CREATE TRIGGER IF NOT EXISTS userid_fts_ai AFTER INSERT ON userid BEGIN"
+   "  INSERT INTO userid_fts(rowid, uid, addrspec)"
+   "   VALUES (new.rowid, new.uid, new.addrspec);"
+   "  INSERT INTO userid_words(rowid, uid)"
+   "   VALUES (new.rowid, new.uid);"
+   " END",
+
+   "CREATE TRIGGER IF NOT EXISTS userid_fts_ad AFTER DELETE ON userid BEGIN"
+   "  INSERT INTO userid_fts(userid_fts, rowid, uid, addrspec)"
+   "   VALUES ('delete', old.rowid, old.uid, old.addrspec);"
+   "  INSERT INTO userid_words(userid_words, rowid, uid)"
+   "   VALUES ('delete', old.rowid, old.uid);"
+   " END",
+
+   "CREATE TRIGGER IF NOT EXISTS userid_fts_au AFTER UPDATE ON userid BEGIN"
+   "  INSERT INTO userid_fts(userid_fts, rowid, uid, addrspec)"
+   "   VALUES ('delete', old.rowid, old.uid, old.addrspec);"
+   "  INSERT INTO userid_words(userid_words, rowid, uid)"
+   "   VALUES ('delete', old.rowid, old.uid);"
+   "  INSERT INTO userid_fts(rowid, uid, addrspec)"
+   "   VALUES (new.rowid, new.uid, new.addrspec);"
+   "  INSERT INTO userid_words(rowid, uid)"
+   "   VALUES (new.rowid, new.uid);"
+   " END"
+  };
+
+/* The names of the triggers in FTS_DEFINITIONS.  */
+static const char *fts_triggers[] =
+  { "userid_fts_ai", "userid_fts_ad", "userid_fts_au" };
+
+
 /*-- prototypes --*/
 static gpg_error_t get_config_value (const char *name, char **r_value);
 static gpg_error_t set_config_value (const char *name, const char *value);
@@ -315,12 +444,13 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA or EXTRA2 are not NULL these parts are appended to the SQL
- * statement.  */
+/* Run an SQL prepare for SQLSTR on the database handle DB and return
+ * a statement at R_STMT.  If EXTRA or EXTRA2 are not NULL these parts
+ * are appended to the SQL statement.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
-                 sqlite3_stmt **r_stmt)
+run_sql_prepare_db (sqlite3 *db, const char *sqlstr,
+                    const char *extra, const char *extra2,
+                    sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
   int res;
@@ -334,7 +464,7 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  res = sqlite3_prepare_v2 (db, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -344,6 +474,27 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
 }
 
 
+/* Run an SQL prepare for SQLSTR on the main database handle.  See
+ * run_sql_prepare_db for details.  */
+static gpg_error_t
+run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 sqlite3_stmt **r_stmt)
+{
+  return run_sql_prepare_db (database_hd, sqlstr, extra, extra2, r_stmt);
+}
+
+
+/* Prepare the select statement for the request CTX on its database
+ * handle.  See run_sql_prepare_db for details.  */
+static gpg_error_t
+ctx_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 be_sqlite_local_t ctx)
+{
+  return run_sql_prepare_db (ctx->select_db, sqlstr, extra, extra2,
+                             &ctx->select_stmt);
+}
+
+
 /* Helper to bind a BLOB parameter to a statement.  */
 static gpg_error_t
 run_sql_bind_blob (sqlite3_stmt *stmt, int no,
@@ -458,14 +609,20 @@ run_sql_step (sqlite3_stmt *stmt)
 
 /* Wrapper around sqlite3_step for use with select.  This version does
  * not print diags for SQLITE_DONE or SQLITE_ROW but returns them as
- * gpg error codes.  */
+ * gpg error codes.  If CONCURRENT is set the step is done with the
+ * sceptre released; the caller must make sure that no other thread
+ * uses the database handle of STMT.  */
 static gpg_error_t
-run_sql_step_for_select (sqlite3_stmt *stmt)
+run_sql_step_for_select (sqlite3_stmt *stmt, int concurrent)
 {
   gpg_error_t err;
   int res;
 
+  if (concurrent)
+    npth_unprotect ();
   res = sqlite3_step (stmt);
+  if (concurrent)
+    npth_protect ();
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -521,6 +678,235 @@ run_sql_statement (const char *sqlstr)
 }
 
 
+/* Switch the main database handle to WAL mode.  Only if this
+ * succeeds the reader pool is used.  */
+static void
+enable_wal_mode (void)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  const char *s;
+
+  if (!sqlite3_threadsafe ())
+    {
+      log_info ("SQLite has been built without thread support;"
+                " not using concurrent readers\n");
+      return;
+    }
+
+  err = run_sql_prepare ("PRAGMA journal_mode=WAL", NULL, NULL, &stmt);
+  if (err)
+    return;
+  err = run_sql_step_for_select (stmt, 0);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      s = sqlite3_column_text (stmt, 0);
+      if (s && !ascii_strcasecmp (s, "wal"))
+        db_readers_enabled = 1;
+      else
+        log_info ("database journal mode is '%s';"
+                  " not using concurrent readers\n", s? s : "[?]");
+    }
+  sqlite3_finalize (stmt);
+}
+
+
+/* Upgrade the database schema from version DBVERSION to
+ * DATABASE_VERSION.  Each step is done in its own transaction.  If
+ * NEWDB is set the database has just been created and no info is
+ * printed.  */
+static gpg_error_t
+upgrade_database (int dbversion, int newdb)
+{
+  gpg_error_t err = 0;
+  int idx;
+  int version;
+
+  for (version = dbversion + 1; version <= DATABASE_VERSION; version++)
+    {
+      if (!newdb)
+        log_info ("upgrading database to version %d\n", version);
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        break;
+      for (idx=0; !err && idx < DIM(schema_upgrades); idx++)
+        if (schema_upgrades[idx].version == version)
+          err = run_sql_statement (schema_upgrades[idx].sql);
+      if (!err)
+        {
+          char numbuf[35];
+
+          snprintf (numbuf, sizeof numbuf, "%d", version);
+          err = set_config_value ("dbversion", numbuf);
+        }
+      if (!err)
+        err = run_sql_statement ("commit");
+      else if (run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+      if (err)
+        {
+          log_error ("error upgrading database to version %d: %s\n",
+                     version, gpg_strerror (err));
+          break;
+        }
+    }
+
+  return err;
+}
+
+
+/* Create the full-text indices for the user ids if they do not yet
+ * exist and fill them from the userid table.  The indices are also
+ * rebuilt if their triggers are missing because then they have not
+ * been kept in sync.  If SQLite does not support them we keep on
+ * using LIKE for the searches.  */
+static gpg_error_t
+create_fts_tables (void)
+{
+  gpg_error_t err = 0;
+  sqlite3_stmt *stmt;
+  int idx;
+  int exists = 0;
+  char *sqlstr;
+
+  if (!sqlite3_compileoption_used ("ENABLE_FTS5")
+      || sqlite3_libversion_number () < 3034000)
+    {
+      log_info ("SQLite lacks FTS5 with the trigram tokenizer;"
+                " not using a full-text index\n");
+      /* The triggers of indices created by another SQLite would let
+       * each insert into the userid table fail.  */
+      for (idx=0; !err && idx < DIM(fts_triggers); idx++)
+        {
+          sqlstr = strconcat ("DROP TRIGGER IF EXISTS ", fts_triggers[idx],
+                              NULL);
+          if (!sqlstr)
+            err = gpg_error_from_syserror ();
+          else
+            err = run_sql_statement (sqlstr);
+          xfree (sqlstr);
+        }
+      return err;
+    }
+
+  err = run_sql_prepare ("SELECT count(*) FROM sqlite_master"
+                         " WHERE type = 'trigger' AND name IN"
+                         " ('userid_fts_ai', 'userid_fts_ad', 'userid_fts_au')",
+                         NULL, NULL, &stmt);
+  if (err)
+    return err;
+  err = run_sql_step_for_select (stmt, 0);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      exists = (sqlite3_column_int (stmt, 0) == DIM(fts_triggers));
+      err = 0;
+    }
+  sqlite3_finalize (stmt);
+  if (err)
+    return err;
+
+  if (!exists)
+    {
+      if (!opt.quiet)
+        log_info ("creating the full-text index for the user ids\n");
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        return err;
+      for (idx=0; !err && idx < DIM(fts_definitions); idx++)
+        err = run_sql_statement (fts_definitions[idx]);
+      if (!err)
+        err = run_sql_statement
+          ("INSERT INTO userid_fts(userid_fts) VALUES ('rebuild')");
+      if (!err)
+        err = run_sql_statement
+          ("INSERT INTO userid_words(userid_words) VALUES ('rebuild')");
+      if (!err)
+        err = run_sql_statement ("commit");
+      else if (run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+      if (err)
+        return err;
+    }
+
+  db_fts_enabled = 1;
+  return 0;
+}
+
+
+/* Return a database handle from the reader pool or NULL if none is
+ * available.  The handle must be put back using put_reader_db.  */
+static sqlite3 *
+get_reader_db (void)
+{
+  int idx, res;
+  sqlite3 *hd;
+
+  if (!db_readers_enabled)
+    return NULL;
+
+  for (idx=0; idx < db_readers_used; idx++)
+    if (!db_readers[idx].in_use)
+      {
+        db_readers[idx].in_use = 1;
+        return db_readers[idx].hd;
+      }
+  if (db_readers_used == MAX_DB_READERS)
+    return NULL;  /* All in use - the caller falls back to the main hd.  */
+
+  res = sqlite3_open_v2 (database_filename, &hd,
+                         (SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX), NULL);
+  if (res)
+    {
+      log_error ("error opening '%s' for reading: %s\n",
+                 database_filename, sqlite3_errstr (res));
+      sqlite3_close (hd);
+      return NULL;
+    }
+  sqlite3_extended_result_codes (hd, 1);
+  /* A busy reader in WAL mode is rare and short; e.g. while another
+   * connection runs a recovery.  */
+  sqlite3_busy_timeout (hd, 1000);
+
+  idx = db_readers_used++;
+  db_readers[idx].hd = hd;
+  db_readers[idx].in_use = 1;
+  if (DBG_LOOKUP)
+    log_debug ("opened database reader %d\n", idx);
+  return hd;
+}
+
+
+/* Put the reader handle HD back into the pool.  */
+static void
+put_reader_db (sqlite3 *hd)
+{
+  int idx;
+
+  for (idx=0; idx < db_readers_used; idx++)
+    if (db_readers[idx].hd == hd)
+      {
+        log_assert (db_readers[idx].in_use);
+        db_readers[idx].in_use = 0;
+        return;
+      }
+  log_assert (!"reader not in pool");
+}
+
+
+/* Finalize the select statement of CTX and if it was done on a
+ * handle from the reader pool, put that handle back.  */
+static void
+release_select_stmt (be_sqlite_local_t ctx)
+{
+  if (ctx->select_stmt)
+    sqlite3_finalize (ctx->select_stmt);
+  ctx->select_stmt = NULL;
+  if (ctx->select_db && ctx->select_db != database_hd)
+    put_reader_db (ctx->select_db);
+  ctx->select_db = NULL;
+}
+
+
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
  * available.  */
@@ -568,7 +954,9 @@ create_or_open_database (const char *filename)
    * the tables exist, and prepare the required statements.  We use
    * our own locking instead of the more complex serialization sqlite
    * would have to do and it avoid that we call
-   * npth_unprotect/protect.  */
+   * npth_unprotect/protect.  The handles of the reader pool are used
+   * by only one thread at a time and thus do not need a mutex
+   * either.  */
   res = sqlite3_open_v2 (filename,
                          &database_hd,
                          (SQLITE_OPEN_READWRITE
@@ -584,6 +972,16 @@ create_or_open_database (const char *filename)
   /* Enable extended error codes.  */
   sqlite3_extended_result_codes (database_hd, 1);
 
+  database_filename = xtrystrdup (filename);
+  if (!database_filename)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Allow concurrent readers.  */
+  enable_wal_mode ();
+
   /* Create the tables if needed.  */
   for (idx=0; idx < DIM(table_definitions); idx++)
     {
@@ -628,6 +1026,24 @@ create_or_open_database (const char *filename)
         }
     }
 
+  /* Bring the schema up to date.  A new database has just been
+   * created with the tables of version 1.  */
+  if (setdbversion)
+    dbversion = 1;
+  if (dbversion > DATABASE_VERSION)
+    log_info ("database version %d is newer than ours (%d)\n",
+              dbversion, DATABASE_VERSION);
+  else if (dbversion)
+    {
+      err = upgrade_database (dbversion, setdbversion);
+      if (err)
+        goto leave;
+    }
+
+  /* The full-text index is optional; thus errors are not fatal.  */
+  if (create_fts_tables ())
+    log_info ("not using a full-text index for the user ids\n");
+
   if (!opt.quiet)
     log_info (_("database '%s' created\n"), filename);
 
@@ -720,8 +1136,7 @@ be_sqlite_init_local (backend_handle_t backend_hd, db_request_part_t part)
 void
 be_sqlite_release_local (be_sqlite_local_t ctx)
 {
-  if (ctx->select_stmt)
-    sqlite3_finalize (ctx->select_stmt);
+  release_select_stmt (ctx);
   xfree (ctx);
 }
 
@@ -784,7 +1199,7 @@ get_config_value (const char *name, char **r_value)
   if (err)
     return err;
 
-  err = run_sql_step_for_select (stmt);
+  err = run_sql_step_for_select (stmt, 0);
   if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
     {
       s = sqlite3_column_text (stmt, 0);
@@ -829,6 +1244,79 @@ set_config_value (const char *name, const char *value)
 }
 
 
+/* Append the string (S,LEN) as an FTS5 string to the membuf MB.  */
+static void
+put_fts_string (membuf_t *mb, const char *s, size_t len)
+{
+  put_membuf_str (mb, "\"");
+  for (; len; s++, len--)
+    {
+      if (*s == '"')
+        put_membuf_str (mb, "\"\"");
+      else
+        put_membuf (mb, s, 1);
+    }
+  put_membuf_str (mb, "\"");
+}
+
+
+/* Return a malloced FTS5 query for NAME.  If WORDS is set the query
+ * matches all user ids which have all the words of NAME; else NAME is
+ * searched as a substring.  Returns NULL and sets ERRNO on error.  */
+static char *
+make_fts_query (const char *name, int words)
+{
+  membuf_t mb;
+  const char *s;
+  size_t n;
+  int any = 0;
+
+  init_membuf (&mb, 128);
+  if (!words)
+    put_fts_string (&mb, name, strlen (name));
+  else
+    {
+      /* Words are delimited by ASCII characters which are not
+       * alphanumeric.  This matches the unicode61 tokenizer.  */
+      for (s = name; *s; s += n)
+        {
+          while (*s && !(*s & 0x80) && !alnump (s))
+            s++;
+          for (n=0; s[n] && ((s[n] & 0x80) || alnump (s+n)); n++)
+            ;
+          if (!n)
+            break;
+          if (any)
+            put_membuf_str (&mb, " AND ");
+          put_fts_string (&mb, s, n);
+          any = 1;
+        }
+      if (!any)
+        put_membuf_str (&mb, "\"\"");  /* Matches nothing.  */
+    }
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Return a malloced SQL statement consisting of SQLSTR followed by
+ * the list " IN (?1,...,?N)".  Returns NULL and sets ERRNO on
+ * error.  */
+static char *
+make_sql_in_list (const char *sqlstr, unsigned int n)
+{
+  membuf_t mb;
+  unsigned int i;
+
+  init_membuf (&mb, strlen (sqlstr) + 8 * n + 8);
+  put_membuf_str (&mb, sqlstr);
+  for (i=1; i <= n; i++)
+    put_membuf_printf (&mb, "%s?%u", i > 1? ",":" IN (", i);
+  put_membuf (&mb, ")", 2);
+  return get_membuf (&mb, NULL);
+}
+
+
 /* Run a select for the search given by (DESC,NDESC).  The data is not
  * returned but stored in the request item.  */
 static gpg_error_t
@@ -841,6 +1329,10 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
   unsigned char kidbuf[8];
   const char *s;
   size_t n;
+  int fts;
+  unsigned int nbatch, i;
+  char *query = NULL;
+  char *sqlstr = NULL;
 
 
   descidx = ctx->descidx;
@@ -850,10 +1342,47 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       goto leave;
     }
 
-  /* Check whether we can re-use the current select statement.  */
+  /* Check whether to use the full-text index.  The trigram tokenizer
+   * requires at least 3 characters.  */
+  switch (desc[descidx].mode)
+    {
+    case KEYDB_SEARCH_MODE_SUBSTR:
+    case KEYDB_SEARCH_MODE_MAILSUB:
+      fts = (db_fts_enabled && desc[descidx].u.name
+             && utf8_charcount (desc[descidx].u.name, -1) >= 3);
+      break;
+    case KEYDB_SEARCH_MODE_WORDS:
+      fts = db_fts_enabled;
+      break;
+    default:
+      fts = 0;
+      break;
+    }
+
+  /* Searches for fingerprints and keyids following each other are
+   * combined into one statement using an IN list.  This is much
+   * faster than running a statement for each of them.  */
+  nbatch = 1;
+  switch (desc[descidx].mode)
+    {
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+    case KEYDB_SEARCH_MODE_LONG_KID:
+    case KEYDB_SEARCH_MODE_FPR:
+      while (descidx + nbatch < ndesc && nbatch < MAX_BATCH_DESC
+             && desc[descidx + nbatch].mode == desc[descidx].mode)
+        nbatch++;
+      break;
+    default:
+      break;
+    }
+
+  /* Check whether we can re-use the current select statement.  Note
+   * that the database handle is kept.  */
   if (!ctx->select_stmt)
     ;
-  else if (ctx->select_mode != desc[descidx].mode)
+  else if (ctx->select_mode != desc[descidx].mode
+           || ctx->select_fts != fts
+           || ctx->select_nbatch != nbatch)
     {
       sqlite3_finalize (ctx->select_stmt);
       ctx->select_stmt = NULL;
@@ -867,6 +1396,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     }
 
   ctx->select_mode = desc[descidx].mode;
+  ctx->select_fts = fts;
+  ctx->select_nbatch = nbatch;
   ctx->filter_opgp = ctrl->filter_opgp;
   ctx->filter_x509 = ctrl->filter_x509;
 
@@ -901,22 +1432,22 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.uid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         {
           s = desc[descidx].u.name;
@@ -936,12 +1467,28 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
+      if (fts)
+        {
+          if (!ctx->select_stmt)
+            err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+                                   " p.revoked, p.keyblob, u.uidno"
+                                   " FROM pubkey as p, userid as u"
+                                   " WHERE p.ubid = u.ubid AND u.rowid IN"
+                                   " (SELECT rowid FROM userid_fts"
+                                   "  WHERE addrspec MATCH ?1)",
+                                   extra, " ORDER BY p.ubid", ctx);
+          if (!err && !(query = make_fts_query (desc[descidx].u.name, 0)))
+            err = gpg_error_from_syserror ();
+          if (!err)
+            err = run_sql_bind_text (ctx->select_stmt, 1, query);
+          break;
+        }
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -949,30 +1496,66 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
+      if (fts)
+        {
+          if (!ctx->select_stmt)
+            err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+                                   " p.revoked, p.keyblob, u.uidno"
+                                   " FROM pubkey as p, userid as u"
+                                   " WHERE p.ubid = u.ubid AND u.rowid IN"
+                                   " (SELECT rowid FROM userid_fts"
+                                   "  WHERE uid MATCH ?1)",
+                                   extra, " ORDER BY p.ubid", ctx);
+          if (!err && !(query = make_fts_query (desc[descidx].u.name, 0)))
+            err = gpg_error_from_syserror ();
+          if (!err)
+            err = run_sql_bind_text (ctx->select_stmt, 1, query);
+          break;
+        }
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
       break;
 
-    case KEYDB_SEARCH_MODE_MAILEND:
     case KEYDB_SEARCH_MODE_WORDS:
+      if (!fts)
+        {
+          err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+          break;
+        }
+      ctx->select_col_uidno = 5;
+      if (!ctx->select_stmt)
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                               " p.keyblob, u.uidno"
+                               " FROM pubkey as p, userid as u"
+                               " WHERE p.ubid = u.ubid AND u.rowid IN"
+                               " (SELECT rowid FROM userid_words"
+                               "  WHERE uid MATCH ?1)",
+                               extra, " ORDER BY p.ubid", ctx);
+      if (!err && !(query = make_fts_query (desc[descidx].u.name, 1)))
+        err = gpg_error_from_syserror ();
+      if (!err)
+        err = run_sql_bind_text (ctx->select_stmt, 1, query);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
       err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
       break;
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob"
                                " FROM pubkey as p, issuer as i"
                                " WHERE p.ubid = i.ubid"
                                " AND i.dn = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -988,13 +1571,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+            err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
                                    " p.revoked, p.keyblob"
                                    " FROM pubkey as p, issuer as i"
                                    " WHERE p.ubid = i.ubid"
                                    " AND i.sn = $1 AND i.dn = $2",
-                                   extra, " ORDER BY p.ubid",
-                                   &ctx->select_stmt);
+                                   extra, " ORDER BY p.ubid", ctx);
           if (!err)
             err = run_sql_bind_ntext (ctx->select_stmt, 1,
                                       desc[descidx].sn, desc[descidx].snlen);
@@ -1014,67 +1596,87 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid"
                                " AND u.uid = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
       break;
 
     case KEYDB_SEARCH_MODE_SHORT_KID:
+      /* Note that the expression is served by fingerprintidx3.  */
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND"
-                               " substr(f.kid,5) = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
-      if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
+        {
+          sqlstr = make_sql_in_list ("SELECT p.ubid, p.type, p.ephemeral,"
+                                     " p.revoked, p.keyblob, f.subkey"
+                                     " FROM pubkey as p, fingerprint as f"
+                                     " WHERE p.ubid = f.ubid AND"
+                                     " substr(f.kid,5)", nbatch);
+          if (!sqlstr)
+            err = gpg_error_from_syserror ();
+          else
+            err = ctx_sql_prepare (sqlstr, extra, " ORDER BY p.ubid", ctx);
+        }
+      for (i=0; !err && i < nbatch; i++)
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 kid_from_u32 (desc[descidx+i].u.kid,
+                                               kidbuf) + 4,
                                  4);
       break;
 
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
-      if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 kid_from_u32 (desc[descidx].u.kid, kidbuf),
+        {
+          sqlstr = make_sql_in_list ("SELECT p.ubid, p.type, p.ephemeral,"
+                                     " p.revoked, p.keyblob, f.subkey"
+                                     " FROM pubkey as p, fingerprint as f"
+                                     " WHERE p.ubid = f.ubid AND f.kid",
+                                     nbatch);
+          if (!sqlstr)
+            err = gpg_error_from_syserror ();
+          else
+            err = ctx_sql_prepare (sqlstr, extra, " ORDER BY p.ubid", ctx);
+        }
+      for (i=0; !err && i < nbatch; i++)
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 kid_from_u32 (desc[descidx+i].u.kid, kidbuf),
                                  8);
       break;
 
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
-      if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 desc[descidx].u.fpr, desc[descidx].fprlen);
+        {
+          sqlstr = make_sql_in_list ("SELECT p.ubid, p.type, p.ephemeral,"
+                                     " p.revoked, p.keyblob, f.subkey"
+                                     " FROM pubkey as p, fingerprint as f"
+                                     " WHERE p.ubid = f.ubid AND f.fpr",
+                                     nbatch);
+          if (!sqlstr)
+            err = gpg_error_from_syserror ();
+          else
+            err = ctx_sql_prepare (sqlstr, extra, " ORDER BY p.ubid", ctx);
+        }
+      for (i=0; !err && i < nbatch; i++)
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 desc[descidx+i].u.fpr,
+                                 desc[descidx+i].fprlen);
       break;
 
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, f.subkey"
                                " FROM pubkey as p, fingerprint as f"
                                " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.grip, KEYGRIP_LEN);
@@ -1082,10 +1684,10 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
+        err = ctx_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
                                " FROM pubkey as p"
                                " WHERE ubid = ?1",
-                               extra, NULL, &ctx->select_stmt);
+                               extra, NULL, ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.ubid, UBID_LEN);
@@ -1103,10 +1705,10 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
+          err = ctx_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
                                  " keyblob"
                                  " FROM pubkey as p",
-                                 extra, NULL, &ctx->select_stmt);
+                                 extra, NULL, ctx);
         }
       break;
 
@@ -1120,6 +1722,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     }
 
  leave:
+  xfree (sqlstr);
+  xfree (query);
   return err;
 }
 
@@ -1135,12 +1739,12 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  int got_mutex = 0;
+  int concurrent;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
 
-  acquire_mutex ();
-
   /* Find the specific request part or allocate it.  */
   err = be_find_request_part (backend_hd, request, &part);
   if (err)
@@ -1149,7 +1753,10 @@ be_sqlite_search (ctrl_t ctrl,
 
   if (!desc)
     {
-      /* Reset */
+      /* Reset.  A handle from the reader pool is put back so that
+       * idle sessions do not hold them.  */
+      if (ctx->select_db != database_hd)
+        release_select_stmt (ctx);
       ctx->select_done = 0;
       ctx->select_eof = 0;
       ctx->descidx = 0;
@@ -1165,8 +1772,39 @@ be_sqlite_search (ctrl_t ctrl,
       goto leave;
     }
 
+  /* Select the database handle for a new search.  Within a global
+   * transaction we need to see our own changes and thus use the main
+   * handle; else we take a handle from the reader pool.  If none is
+   * available we also use the main handle.  A running search stays
+   * on its handle.  */
+  if (!ctx->select_done || !ctx->select_db)
+    {
+      if (opt.in_transaction)
+        {
+          if (ctx->select_db != database_hd)
+            release_select_stmt (ctx);
+        }
+      else if (!ctx->select_db || ctx->select_db == database_hd)
+        {
+          sqlite3 *hd = get_reader_db ();
+          if (hd)
+            {
+              release_select_stmt (ctx);
+              ctx->select_db = hd;
+            }
+        }
+      if (!ctx->select_db)
+        ctx->select_db = database_hd;
+    }
+  concurrent = (ctx->select_db != database_hd);
+  if (!concurrent)
+    {
+      acquire_mutex ();
+      got_mutex = 1;
+    }
+
   /* Start a global transaction if needed.  */
-  if (!opt.active_transaction && opt.in_transaction)
+  if (!opt.active_transaction && opt.in_transaction && !concurrent)
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1188,7 +1826,7 @@ be_sqlite_search (ctrl_t ctrl,
   show_sqlstmt (ctx->select_stmt);
 
   /* SQL select succeeded - get the first or next row. */
-  err = run_sql_step_for_select (ctx->select_stmt);
+  err = run_sql_step_for_select (ctx->select_stmt, concurrent);
   if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
     {
       int n;
@@ -1202,7 +1840,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1235,7 +1873,7 @@ be_sqlite_search (ctrl_t ctrl,
       ctx->lastubid_valid = 1;
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1246,7 +1884,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1257,7 +1895,7 @@ be_sqlite_search (ctrl_t ctrl,
       is_ephemeral = !!n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1271,7 +1909,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1285,7 +1923,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1304,7 +1942,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1323,17 +1961,21 @@ be_sqlite_search (ctrl_t ctrl,
       err = be_return_pubkey (ctrl, keyblob, keybloblen, pubkey_type,
                               ubid, is_ephemeral, is_revoked, uid_no, pk_no);
       if (!err)
-        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type);
+        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type,
+                         is_ephemeral, is_revoked);
     }
   else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
     {
-      if (++ctx->descidx < ndesc)
+      ctx->descidx += ctx->select_nbatch;
+      if (ctx->descidx < ndesc)
         {
           ctx->select_done = 0;
           goto again;
         }
       err = gpg_error (GPG_ERR_EOF);
       ctx->select_eof = 1;
+      if (concurrent)
+        release_select_stmt (ctx);
     }
   else
     {
@@ -1341,7 +1983,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (got_mutex)
+    release_mutex ();
   return err;
 }
 
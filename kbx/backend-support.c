@@ -163,7 +163,8 @@ be_find_request_part (backend_handle_t backend_hd, db_request_t request,
 
 
 /* Return the public key (BUFFER,BUFLEN) which has the type
- * PUBKEY_TYPE to the caller.  */
+ * PUBKEY_TYPE to the caller.  Returns GPG_ERR_TRUNCATED without
+ * emitting anything if the data for a LOOKUP would grow too large.  */
 gpg_error_t
 be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
                   enum pubkey_types pubkey_type, const unsigned char *ubid,
@@ -172,6 +173,9 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
   gpg_error_t err;
   char hexubid[2*UBID_LEN+1];
 
+  if (!ctrl->no_data_return && !kbxd_data_has_room (ctrl, buflen))
+    return gpg_error (GPG_ERR_TRUNCATED);
+
   bin2hex (ubid, UBID_LEN, hexubid);
   err = kbxd_status_printf (ctrl, "PUBKEY_INFO", "%d %s %c%c %d %d",
                             pubkey_type, hexubid,
@@ -122,15 +122,22 @@ gpg_error_t be_get_x509_keygrip (ksba_cert_t cert, unsigned char *keygrip);
 
 /*-- backend-cache.c --*/
 gpg_error_t be_cache_initialize (void);
+char *be_cache_stats (void);
 gpg_error_t be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd);
 void be_cache_release_resource (ctrl_t ctrl, backend_handle_t hd);
 gpg_error_t be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd,
                              db_request_t request,
                              KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+gpg_error_t be_cache_lookup (ctrl_t ctrl, db_request_t request,
+                             KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
 void be_cache_mark_final (ctrl_t ctrl, db_request_t request);
 void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       const void *blob, unsigned int bloblen,
-                      enum pubkey_types pubkey_type);
+                      enum pubkey_types pubkey_type,
+                      int is_ephemeral, int is_revoked);
+void be_cache_invalidate (ctrl_t ctrl, const unsigned char *ubid,
+                          const void *blob, unsigned int bloblen,
+                          enum pubkey_types pubkey_type);
 void be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
 
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -39,14 +40,25 @@ struct
   backend_handle_t backend_handle;
 } the_database;
 
+/* The lock to serialize writers against readers.  Any number of
+ * searches may run at the same time but a store or delete requires
+ * exclusive access.  */
+static npth_rwlock_t database_rwlock;
+
 
 
 /* Take a lock for reading the databases.  */
 static void
 take_read_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  log_assert (!ctrl->db_locked);
+  res = npth_rwlock_rdlock (&database_rwlock);
+  if (res)
+    log_fatal ("failed to acquire database read lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_locked = 1;
 }
 
 
@@ -54,8 +66,14 @@ take_read_lock (ctrl_t ctrl)
 static void
 take_read_write_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  log_assert (!ctrl->db_locked);
+  res = npth_rwlock_wrlock (&database_rwlock);
+  if (res)
+    log_fatal ("failed to acquire database write lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_locked = 1;
 }
 
 
@@ -64,8 +82,15 @@ take_read_write_lock (ctrl_t ctrl)
 static void
 release_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  if (!ctrl->db_locked)
+    return;
+  res = npth_rwlock_unlock (&database_rwlock);
+  if (res)
+    log_fatal ("failed to release database lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_locked = 0;
 }
 
 
@@ -83,6 +108,7 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
   enum database_types db_type = 0;
   backend_handle_t handle = NULL;
   unsigned int n;
+  int res;
 
   /* Do tilde expansion etc. */
   if (strchr (filename_arg, DIRSEP_C)
@@ -105,6 +131,11 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
       goto leave;
     }
 
+  res = npth_rwlock_init (&database_rwlock, NULL);
+  if (res)
+    log_fatal ("can't initialize database lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+
   /* Init the cache.  */
   err = be_cache_initialize ();
   if (err)
@@ -333,6 +364,8 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
       request->any_search = 0;
       request->any_found = 0;
+      request->last_cached_valid = 0;
+      request->last_cached_final = 0;
       request->next_dbidx = 0;
       if (!desc) /* Reset only mode */
         {
@@ -341,6 +374,32 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
     }
 
+  /* Try the cache first.  The cache is only used for the first
+   * search of a request; a cached UBID is final and thus a NEXT for
+   * it won't find anything.  */
+  if (the_database.db_type != DB_TYPE_CACHE)
+    {
+      if (!request->any_search)
+        {
+          err = be_cache_lookup (ctrl, request, desc, ndesc);
+          if (gpg_err_code (err) != GPG_ERR_EOF)
+            {
+              if (DBG_LOOKUP)
+                log_debug ("%s: searched cache => %s\n",
+                           __func__, gpg_strerror (err));
+              request->any_search = 1;
+              if (!err)
+                request->any_found = 1;
+              goto leave;
+            }
+        }
+      else if (request->last_cached_final)
+        {
+          err = gpg_error (GPG_ERR_NOT_FOUND);
+          goto leave;
+        }
+    }
+
   /* Divert to the backend for the actual search.  */
   switch (the_database.db_type)
     {
@@ -386,8 +445,10 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
             goto leave;
         }
       request->next_dbidx++;
-      /* FIXME: We need to see which pubkey type we need to insert.  */
-      be_cache_not_found (ctrl, PUBKEY_TYPE_UNKNOWN, desc, ndesc);
+      /* We can only put a not-found mark if the search was not
+       * restricted to one pubkey type and nothing was found.  */
+      if (!request->any_found && ctrl->filter_opgp == ctrl->filter_x509)
+        be_cache_not_found (ctrl, PUBKEY_TYPE_UNKNOWN, desc, ndesc);
       err = gpg_error (GPG_ERR_NOT_FOUND);
       goto leave;
     }
@@ -443,6 +504,8 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
   if (err)
     goto leave;
 
+  be_cache_invalidate (ctrl, ubid, blob, bloblen, pktype);
+
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
@@ -528,6 +591,8 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
       goto leave;
     }
 
+  be_cache_invalidate (ctrl, ubid, NULL, 0, 0);
+
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
@@ -37,9 +37,18 @@
 #include "../common/asshelp.h"
 #include "../common/host2net.h"
 #include "frontend.h"
+#include "backend.h"
 
 
 
+/* The maximum number of patterns accepted by the LOOKUP command.  */
+#define MAX_LOOKUP_PATTERNS 1000
+
+/* The maximum amount of data returned by the LOOKUP command.  This
+ * must not be larger than what the client accepts for one blob.  */
+#define MAX_LOOKUP_DATA (16*1024*1024 - 1024)
+
+
 #define PARM_ERROR(t) assuan_set_error (ctx, \
                                         gpg_error (GPG_ERR_ASS_PARAMETER), (t))
 #define set_error(e,t) (ctx ? assuan_set_error (ctx, gpg_error (e), (t)) \
@@ -103,6 +112,10 @@ struct server_local_s
 
   /* If not NULL write output to this stream instead of using D lines.  */
   estream_t outstream;
+
+  /* If not NULL the data is collected in this buffer instead of
+   * sending it.  This is used by cmd_lookup.  */
+  membuf_t *lookup_data;
 };
 
 
@@ -191,6 +204,22 @@ kbxd_status_printf (ctrl_t ctrl, const char *keyword, const char *format, ...)
 }
 
 
+/* Return true if a key of SIZE bytes can still be returned.  This is
+ * only false if the data collected for a LOOKUP would grow too
+ * large.  */
+int
+kbxd_data_has_room (ctrl_t ctrl, size_t size)
+{
+  size_t len;
+
+  if (!ctrl || !ctrl->server_local || !ctrl->server_local->lookup_data)
+    return 1;
+
+  peek_membuf (ctrl->server_local->lookup_data, &len);
+  return len + 4 + size <= MAX_LOOKUP_DATA;
+}
+
+
 /* A wrapper around assuan_send_data which makes debugging the output
  * in verbose mode easier.  It also takes CTRL as argument.  */
 gpg_error_t
@@ -203,6 +232,20 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
   if (!ctx) /* Oops - no assuan context.  */
     return gpg_error (GPG_ERR_NOT_PROCESSED);
 
+  /* Collect the data for a batched lookup.  Each blob is prefixed
+   * with its length so that the client can split them.  */
+  if (ctrl && ctrl->server_local && ctrl->server_local->lookup_data)
+    {
+      unsigned char lenbuf[4];
+
+      if (!kbxd_data_has_room (ctrl, size))
+        return gpg_error (GPG_ERR_TOO_LARGE);
+      ulongtobuf (lenbuf, size);
+      put_membuf (ctrl->server_local->lookup_data, lenbuf, 4);
+      put_membuf (ctrl->server_local->lookup_data, buffer, size);
+      return 0;
+    }
+
   /* Write toa file descriptor if enabled.  */
   if (ctrl && ctrl->server_local && ctrl->server_local->outstream)
     {
@@ -563,6 +606,154 @@ cmd_next (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_lookup[] =
+  "LOOKUP [--no-data] [--openpgp|--x509]\n"
+  "\n"
+  "Search for all keys given by a list of fingerprints, key ids,\n"
+  "keygrips or UBIDs and return them at once.  The patterns are\n"
+  "requested by this function using\n"
+  "  INQUIRE PATTERNS\n"
+  "which needs to be answered with one pattern per line.  At most\n"
+  "1000 patterns are allowed.  For each key found a PUBKEY_INFO\n"
+  "status line is emitted; the data is returned in one block as a\n"
+  "sequence of keys each prefixed with its length as a 4 byte\n"
+  "big endian integer.  The order of the keys is that of the\n"
+  "status lines.  With --no-data only the status lines are\n"
+  "returned.  If no key was found the error NOT_FOUND is returned.\n"
+  "If the keys do not fit into one data block the keys found so far\n"
+  "are returned along with the status line\n"
+  "  TRUNCATED <n>\n"
+  "where <n> is the number of returned keys.  The client may then\n"
+  "split the patterns and send several LOOKUP commands.\n"
+  "Note that this command ends a previous SEARCH.";
+static gpg_error_t
+cmd_lookup (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  int opt_no_data, opt_openpgp, opt_x509;
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *p, *pend;
+  KEYDB_SEARCH_DESC *desc = NULL;
+  unsigned int ndesc = 0;
+  unsigned int nfound = 0;
+  membuf_t mb;
+  void *data;
+  size_t datalen;
+
+  opt_no_data = has_option (line, "--no-data");
+  opt_openpgp = has_option (line, "--openpgp");
+  opt_x509 = has_option (line, "--x509");
+  line = skip_options (line);
+  if (*line)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "no args expected");
+      goto leave;
+    }
+
+  /* This command uses the same search state as SEARCH.  */
+  ctrl->server_local->search_any_found = 0;
+  ctrl->server_local->search_expecting_more = 0;
+  ctrl->server_local->multi_search_desc_len = 0;
+
+  /* Ask for the patterns.  */
+  err = assuan_inquire (ctx, "PATTERNS", &value, &valuelen,
+                        MAX_LOOKUP_PATTERNS * 80);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  desc = xtrycalloc (MAX_LOOKUP_PATTERNS, sizeof *desc);
+  if (!desc)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Parse the patterns.  VALUE is not Nul terminated but we may
+   * replace the linefeeds.  */
+  for (p = (char*)value; p < (char*)value + valuelen; p = pend + 1)
+    {
+      pend = memchr (p, '\n', (char*)value + valuelen - p);
+      if (!pend)
+        {
+          err = set_error (GPG_ERR_INV_ARG, "pattern not terminated");
+          goto leave;
+        }
+      *pend = 0;
+      if (!*p)
+        continue;
+      if (ndesc == MAX_LOOKUP_PATTERNS)
+        {
+          err = set_error (GPG_ERR_TOO_MANY, "too many patterns");
+          goto leave;
+        }
+      err = classify_user_id (p, desc + ndesc, 1);
+      if (err)
+        goto leave;
+      switch (desc[ndesc].mode)
+        {
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_FPR:
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+        case KEYDB_SEARCH_MODE_UBID:
+          break;
+        default:
+          err = set_error (GPG_ERR_INV_USER_ID, "unsupported pattern");
+          goto leave;
+        }
+      ndesc++;
+    }
+  if (!ndesc)
+    {
+      err = set_error (GPG_ERR_MISSING_VALUE, "no pattern");
+      goto leave;
+    }
+
+  ctrl->server_local->inhibit_data_logging = 1;
+  ctrl->server_local->inhibit_data_logging_now = 0;
+  ctrl->server_local->inhibit_data_logging_count = 0;
+  ctrl->no_data_return = opt_no_data;
+  ctrl->filter_opgp = opt_openpgp;
+  ctrl->filter_x509 = opt_x509;
+  err = prepare_outstream (ctrl);
+  if (err)
+    goto leave;
+
+  /* Run the search and collect all results.  */
+  init_membuf (&mb, 32768);
+  ctrl->server_local->lookup_data = &mb;
+  err = kbxd_search (ctrl, desc, ndesc, 1);
+  while (!err)
+    {
+      nfound++;
+      err = kbxd_search (ctrl, desc, ndesc, 0);
+    }
+  ctrl->server_local->lookup_data = NULL;
+  data = get_membuf (&mb, &datalen);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND && nfound)
+    err = 0;
+  else if (gpg_err_code (err) == GPG_ERR_TRUNCATED)
+    err = kbxd_status_printf (ctrl, "TRUNCATED", "%u", nfound);
+  if (!err && !data)
+    err = gpg_error_from_syserror ();
+  if (!err && datalen)
+    err = kbxd_write_data_line (ctrl, data, datalen);
+  xfree (data);
+
+ leave:
+  xfree (desc);
+  xfree (value);
+  ctrl->no_data_return = 0;
+  ctrl->server_local->inhibit_data_logging = 0;
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_store[] =
   "STORE [--update|--insert]\n"
   "\n"
@@ -741,7 +932,8 @@ static const char hlp_getinfo[] =
   "pid         - Return the process id of the server.\n"
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
-  "getenv NAME - Return value of envvar NAME\n";
+  "getenv NAME - Return value of envvar NAME\n"
+  "cache       - Return statistics of the key cache.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -771,6 +963,17 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%u", ctrl->server_local->session_id);
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "cache"))
+    {
+      char *s = be_cache_stats ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
     {
@@ -849,6 +1052,7 @@ register_commands (assuan_context_t ctx)
   } table[] = {
     { "SEARCH",     cmd_search,     hlp_search },
     { "NEXT",       cmd_next,       hlp_next   },
+    { "LOOKUP",     cmd_lookup,     hlp_lookup },
     { "STORE",      cmd_store,      hlp_store  },
     { "DELETE",     cmd_delete,     hlp_delete  },
     { "TRANSACTION",cmd_transaction,hlp_transaction },
@@ -91,6 +91,7 @@ enum cmd_and_opt_values
     oFakedSystemTime,
     oListenBacklog,
     oDisableCheckOwnSocket,
+    oCacheSize,
 
     oDummy
   };
@@ -124,6 +125,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCacheSize, "cache-size",
+                N_("|N|use at most N MiB for the key cache")),
 
   ARGPARSE_end () /* End of list */
 };
@@ -381,6 +384,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.verbose = 0;
       opt.debug = 0;
       disable_check_own_socket = 0;
+      opt.cache_size = DEFAULT_CACHE_SIZE;
       return 1;
     }
 
@@ -408,6 +412,15 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
 
     case oDisableCheckOwnSocket: disable_check_own_socket = 1; break;
 
+    case oCacheSize:
+      if (!pargs->r.ret_ulong)
+        log_info (_("a cache size of 0 is not supported - ignored\n"));
+      else if (pargs->r.ret_ulong > MAX_CACHE_SIZE_MB)
+        opt.cache_size = (size_t)MAX_CACHE_SIZE_MB * 1024 * 1024;
+      else
+        opt.cache_size = (size_t)pargs->r.ret_ulong * 1024 * 1024;
+      break;
+
     default:
       return 0; /* not handled */
     }
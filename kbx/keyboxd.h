@@ -32,6 +32,15 @@
 #include "../common/sysutils.h" /* (gnupg_fd_t) */
 
 
+/* The default and the maximum size of the in-memory cache.  The
+ * maximum must fit into a size_t.  */
+#define DEFAULT_CACHE_SIZE  (32*1024*1024)
+#if SIZEOF_SIZE_T > 4
+# define MAX_CACHE_SIZE_MB  4096
+#else
+# define MAX_CACHE_SIZE_MB  1024
+#endif
+
 /* A large struct name "opt" to keep global flags */
 EXTERN_UNLESS_MAIN_MODULE
 struct
@@ -43,6 +52,9 @@ struct
   /* True if we are running detached from the tty. */
   int running_detached;
 
+  /* The maximum number of bytes used by the in-memory cache.  */
+  size_t cache_size;
+
   /*
    * Global state variables.
    */
@@ -126,6 +138,9 @@ struct server_control_s
   /* Used by SEARCH and NEXT.  */
   unsigned int no_data_return : 1;
 
+  /* Set while a database lock is held by frontend.c.  */
+  unsigned int db_locked : 1;
+
 };
 
 
@@ -173,6 +188,7 @@ void kbxd_sighup_action (void);
 /*-- kbxserver.c --*/
 gpg_error_t kbxd_status_printf (ctrl_t ctrl, const char *keyword,
                                 const char *format, ...);
+int kbxd_data_has_room (ctrl_t ctrl, size_t size);
 gpg_error_t kbxd_write_data_line (ctrl_t ctrl,
                                   const void *buffer_arg, size_t size);
 void kbxd_start_command_handler (ctrl_t, gnupg_fd_t, unsigned int);
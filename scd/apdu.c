@@ -114,6 +114,8 @@ struct reader_table_s {
     ccid_driver_t handle;
   } ccid;
   struct {
+    HANDLE context;  /* The context of this reader or 0 to use the
+                        global context.  */
     HANDLE card;
     pcsc_dword_t protocol;
     pcsc_dword_t verify_ioctl;
@@ -788,9 +790,17 @@ pcsc_send_apdu (int slot, unsigned char *apdu, size_t apdulen,
       send_pci.protocol = PCSC_PROTOCOL_T0;
   send_pci.pci_len = sizeof send_pci;
   recv_len = *buflen;
+  /* The slot is locked and thus we can let other threads run while
+   * the card is busy.  */
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
   err = pcsc_transmit (reader_table[slot].pcsc.card,
                        &send_pci, apdu, apdulen,
                        NULL, buffer, &recv_len);
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
   *buflen = recv_len;
   if (err)
     log_error ("pcsc_transmit failed: %s (0x%lx)\n",
@@ -820,8 +830,16 @@ control_pcsc (int slot, pcsc_dword_t ioctl_code,
 {
   long err;
 
+  /* This may wait for the user to enter the PIN on the pinpad; as
+   * with pcsc_send_apdu the slot is locked.  */
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
   err = pcsc_control (reader_table[slot].pcsc.card, ioctl_code,
                       cntlbuf, len, buffer, buflen? *buflen:0, buflen);
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
   if (err)
     {
       log_error ("pcsc_control failed: %s (0x%lx)\n",
@@ -846,7 +864,11 @@ static int
 close_pcsc_reader (int slot)
 {
   /*log_debug ("%s: count=%d (ctx=%x)\n", __func__, pcsc.count, pcsc.context);*/
-  (void)slot;
+  if (reader_table[slot].pcsc.context)
+    {
+      pcsc_release_context (reader_table[slot].pcsc.context);
+      reader_table[slot].pcsc.context = 0;
+    }
   log_assert (pcsc.count > 0);
   if (!--pcsc.count)
     release_pcsc_context ();
@@ -859,6 +881,7 @@ static int
 connect_pcsc_card (int slot)
 {
   long err;
+  HANDLE context;
 
   log_assert (slot >= 0 && slot < MAX_READER);
 
@@ -868,7 +891,10 @@ connect_pcsc_card (int slot)
   reader_table[slot].atrlen = 0;
   reader_table[slot].is_t0 = 0;
 
-  err = pcsc_connect (pcsc.context,
+  context = reader_table[slot].pcsc.context;
+  if (!context)
+    context = pcsc.context;
+  err = pcsc_connect (context,
                       reader_table[slot].rdrname,
                       opt.pcsc_shared? PCSC_SHARE_SHARED:PCSC_SHARE_EXCLUSIVE,
                       PCSC_PROTOCOL_T0|PCSC_PROTOCOL_T1,
@@ -883,7 +909,7 @@ connect_pcsc_card (int slot)
       if (err == PCSC_W_REMOVED_CARD && pcsc_cancel)
         {
           long err2;
-          if ((err2=pcsc_cancel (pcsc.context)))
+          if ((err2=pcsc_cancel (context)))
             log_error ("pcsc_cancel failed: %s (0x%lx)\n",
                        pcsc_error_string (err2), err2);
           else if (opt.verbose)
@@ -1246,6 +1272,7 @@ open_pcsc_reader (const char *rdrname)
     return -1;
 
   pcsc.count++;
+  reader_table[slot].pcsc.context = 0;
   reader_table[slot].rdrname = xtrystrdup (rdrname);
   if (!reader_table[slot].rdrname)
     {
@@ -1256,6 +1283,13 @@ open_pcsc_reader (const char *rdrname)
       return -1;
     }
 
+  /* PC/SC-lite serializes all calls using the same context.  To be
+   * able to use several cards at the same time each reader gets its
+   * own context.  If that fails we fall back to the global one.  */
+  if (pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                              &reader_table[slot].pcsc.context))
+    reader_table[slot].pcsc.context = 0;
+
   reader_table[slot].pcsc.card = 0;
   reader_table[slot].atrlen = 0;
 
@@ -0,0 +1,63 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(unless (have-compression-algo? "ZSTD")
+	(skip "ZSTD support not compiled in."))
+
+(for-each-p
+ "Checking zstd compression with several threads"
+ (lambda (source)
+   (tr:do
+    (tr:open source)
+    (tr:gpg "" `(--yes --encrypt --recipient ,usrname2
+		       --compress-algo zstd --compress-threads 4))
+    (tr:gpg "" '(--yes --decrypt))
+    (tr:assert-identity source)))
+ (append plain-files data-files))
+
+;; Return an armored message with only the first half of the base64
+;; lines of ARMOR.  The CRC is replaced by a lone pad character; an
+;; armor without CRC is valid and thus the truncation is seen by the
+;; decompressor and not by the armor filter.
+(define (truncate-armor armor)
+  (let ((body (filter (lambda (l)
+			(not (or (string=? l "")
+				 (string-prefix? l "-")
+				 (string-prefix? l "=")
+				 (string-contains? l ": "))))
+		      (string-split-newlines armor))))
+    (let loop ((acc "-----BEGIN PGP MESSAGE-----\n\n")
+	       (n (quotient (length body) 2))
+	       (rest body))
+      (if (= n 0)
+	  (string-append acc "=\n-----END PGP MESSAGE-----\n")
+	  (loop (string-append acc (car rest) "\n") (- n 1) (cdr rest))))))
+
+(info "Checking that truncated zstd data is detected")
+(let ((armor (call-popen `(,@GPG --output - --armor --sign
+				 --local-user ,usrname3
+				 --compress-algo zstd --compress-threads 4
+				 "data-80000")
+			 "")))
+  (catch (assert (string-contains? (car *error*) "unexpected EOF in zstd"))
+	 (call-popen `(,@GPG --output - --decrypt) (truncate-armor armor))
+	 (fail "Expected an error but got none")))